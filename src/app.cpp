@@ -1,19 +1,39 @@
 #include "app.h"
+#include "logger.h"
+
+#include <chrono>
+#include <fstream>
 
 static void framebufferResizeCallback(GLFWwindow* window, int width, int height) {
 	auto graphics = reinterpret_cast<VulkanGraphics*>(glfwGetWindowUserPointer(window));
 	graphics->ResizeBuffer(width, height);
 }
 
-void GraphicsApplication::Initialize()
+// P cycles through the present policies, the frame timing statistics are kept per policy so they can be compared in one run
+static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+	auto app = reinterpret_cast<GraphicsApplication*>(glfwGetWindowUserPointer(window));
+	if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+		uint32_t next = (static_cast<uint32_t>(app->graphics->GetPresentPolicy()) + 1) % static_cast<uint32_t>(BP_PresentPolicy::COUNT);
+		app->graphics->SetPresentPolicy(static_cast<BP_PresentPolicy>(next));
+	}
+}
+
+bool GraphicsApplication::Initialize(const BP_RenderSettings& settings)
 {
 	app_window = new GLFWWindowImpl();
-	graphics = new VulkanGraphics(app_window);
+	graphics = new VulkanGraphics(app_window, settings);
 
 	// Give pointer of application to glfw to allow communication between static functions
 	glfwSetWindowUserPointer(app_window->GLFWGetWindow(), this);
 	glfwSetFramebufferSizeCallback(app_window->GLFWGetWindow(), framebufferResizeCallback);
+	glfwSetKeyCallback(app_window->GLFWGetWindow(), keyCallback);
+	return graphics->IsInitialized();
+}
 
+bool GraphicsApplication::InitializeHeadless(uint32_t width, uint32_t height, const BP_RenderSettings& settings)
+{
+	graphics = new VulkanGraphics(width, height, settings);
+	return graphics->IsInitialized();
 }
 
 void GraphicsApplication::Edulcorate()
@@ -24,13 +44,65 @@ void GraphicsApplication::Edulcorate()
 
 void GraphicsApplication::Run()
 {
-	while (app_window->GetShouldClose() == false) {
+	while (app_window->GetShouldClose() == false && !graphics->IsDeviceLost()) {
+		// Paces the loop and marks when the input of the frame is sampled
+		graphics->WaitForNextFrame();
 		app_window->UpdateWindow();
 
 		RenderFrame();
+
+		// Nothing is rendered while minimized, block until the window changes instead of spinning
+		if (graphics->IsMinimized()) {
+			glfwWaitEvents();
+		}
 	}
 }
 
+void GraphicsApplication::RunHeadless(uint32_t frame_count)
+{
+	// Frames skip models that are still uploading, the measured frames should draw the whole scene
+	graphics->WaitForUploads();
+
+	auto start_time = std::chrono::high_resolution_clock::now();
+
+	for (uint32_t i = 0; i < frame_count && !graphics->IsDeviceLost(); i++) {
+		RenderFrame();
+	}
+
+	// Include the GPU work of the last frames in the measurement
+	std::vector<uint8_t> pixels;
+	uint32_t width, height;
+	graphics->ReadbackFrame(pixels, width, height);
+
+	auto end_time = std::chrono::high_resolution_clock::now();
+	double seconds = std::chrono::duration<double, std::chrono::seconds::period>(end_time - start_time).count();
+	LOG << "Headless rendered " << frame_count << " frames in " << seconds << "s, " << (seconds > 0.0 ? frame_count / seconds : 0.0) << " frames/s";
+}
+
+bool GraphicsApplication::SaveFrame(const std::string& path)
+{
+	std::vector<uint8_t> pixels;
+	uint32_t width, height;
+	if (!graphics->ReadbackFrame(pixels, width, height)) {
+		return false;
+	}
+
+	std::ofstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		LOG << "ERROR\t Couldn't open " << path << " for writing";
+		return false;
+	}
+
+	// PPM has no alpha channel
+	file << "P6\n" << width << " " << height << "\n255\n";
+	for (size_t i = 0; i < pixels.size(); i += 4) {
+		file.write(reinterpret_cast<const char*>(&pixels[i]), 3);
+	}
+
+	LOG << "SUCCESS\t Saved frame to " << path;
+	return true;
+}
+
 void GraphicsApplication::RenderFrame()
 {
 	graphics->RenderFrame();
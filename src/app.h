@@ -12,10 +12,17 @@ public:
 
 	bool shouldRun;
 
-	void Initialize();
+	// Both return false when no device can run the renderer
+	bool Initialize(const BP_RenderSettings& settings = {});
+	// Initializes the renderer without a window, frames are rendered into offscreen targets
+	bool InitializeHeadless(uint32_t width, uint32_t height, const BP_RenderSettings& settings = {});
 	void Edulcorate();
 	void Run();
+	// Renders a fixed amount of frames as fast as possible and logs the throughput
+	void RunHeadless(uint32_t frame_count);
 	void RenderFrame();
+	// Writes the last rendered headless frame as binary PPM
+	bool SaveFrame(const std::string& path);
 
 	GraphicsApplication();
 	~GraphicsApplication();
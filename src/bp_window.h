@@ -47,8 +47,10 @@ struct WindowConfig {
 };
 
 struct WindowData {
+#ifdef WIN32
 	HWND hwnd;
 	HINSTANCE hinstance;
+#endif // WIN32
 	VkSurfaceKHR vulkan_surface;
 	uint32_t window_width;  // In pixels
 	uint32_t window_height; // In pixels
@@ -0,0 +1,162 @@
+#include "frustum_culling.h"
+
+#if defined(__AVX__)
+#define BP_CULLING_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BP_CULLING_SSE
+#include <emmintrin.h>
+#endif
+
+#include <cmath>
+
+namespace {
+    glm::vec4 NormalizePlane(const glm::vec4& plane) {
+        float length = glm::length(glm::vec3{ plane });
+        return length > 0.0f ? plane / length : plane;
+    }
+
+    // Used when the compiler may not emit SSE, the vector kernels test the same conditions
+    [[maybe_unused]] void CullScalar(const backpack::Frustum& frustum, uint32_t begin, uint32_t end,
+        const float* sphere_x, const float* sphere_y, const float* sphere_z, const float* sphere_radius,
+        const float* box_x, const float* box_y, const float* box_z, const float* extent_x, const float* extent_y, const float* extent_z,
+        uint8_t* visible) {
+        for (uint32_t i = begin; i < end; i++) {
+            bool inside = true;
+            for (const glm::vec4& plane : frustum.planes) {
+                float sphere_distance = plane.x * sphere_x[i] + plane.y * sphere_y[i] + plane.z * sphere_z[i] + plane.w;
+                // Distance of the box corner furthest along the plane normal
+                float box_distance = plane.x * box_x[i] + plane.y * box_y[i] + plane.z * box_z[i] + plane.w
+                    + std::abs(plane.x) * extent_x[i] + std::abs(plane.y) * extent_y[i] + std::abs(plane.z) * extent_z[i];
+                inside = inside && sphere_distance >= -sphere_radius[i] && box_distance >= 0.0f;
+            }
+            visible[i] = inside ? 1 : 0;
+        }
+    }
+}
+
+namespace backpack {
+
+    Frustum ExtractFrustum(const glm::mat4& view_projection) {
+        // Rows of the matrix, glm stores columns
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; i++) {
+            rows[i] = glm::vec4{ view_projection[0][i], view_projection[1][i], view_projection[2][i], view_projection[3][i] };
+        }
+
+        Frustum frustum;
+        frustum.planes[0] = NormalizePlane(rows[3] + rows[0]); // Left
+        frustum.planes[1] = NormalizePlane(rows[3] - rows[0]); // Right
+        frustum.planes[2] = NormalizePlane(rows[3] + rows[1]); // Bottom
+        frustum.planes[3] = NormalizePlane(rows[3] - rows[1]); // Top
+        frustum.planes[4] = NormalizePlane(rows[2]);           // Near, z >= 0
+        frustum.planes[5] = NormalizePlane(rows[3] - rows[2]); // Far
+        return frustum;
+    }
+
+    const char* GetCullingKernelName() {
+#if defined(BP_CULLING_AVX)
+        return "AVX";
+#elif defined(BP_CULLING_SSE)
+        return "SSE";
+#else
+        return "scalar";
+#endif
+    }
+
+    void CullingSet::Resize(uint32_t object_count) {
+        count_ = object_count;
+        size_t padded = (object_count + CULLING_BATCH - 1) / CULLING_BATCH * CULLING_BATCH;
+        for (std::vector<float>* component : { &sphere_x_, &sphere_y_, &sphere_z_, &sphere_radius_, &box_x_, &box_y_, &box_z_, &extent_x_, &extent_y_, &extent_z_ }) {
+            component->resize(padded, 0.0f);
+        }
+    }
+
+    void CullingSet::SetBounds(uint32_t index, const Model3D& model, const glm::mat4& world) {
+        glm::vec3 sphere_center = glm::vec3{ world * glm::vec4{ model.sphere_center, 1.0f } };
+        // Non uniform scales grow the sphere by the largest axis
+        float scale = glm::max(glm::length(glm::vec3{ world[0] }), glm::max(glm::length(glm::vec3{ world[1] }), glm::length(glm::vec3{ world[2] })));
+        sphere_x_[index] = sphere_center.x;
+        sphere_y_[index] = sphere_center.y;
+        sphere_z_[index] = sphere_center.z;
+        sphere_radius_[index] = model.sphere_radius * scale;
+
+        // Box that encloses the rotated box (Arvo 1990)
+        glm::vec3 box_center = glm::vec3{ world * glm::vec4{ (model.bounds_min + model.bounds_max) * 0.5f, 1.0f } };
+        glm::vec3 half_extent = (model.bounds_max - model.bounds_min) * 0.5f;
+        glm::vec3 extent = glm::abs(glm::vec3{ world[0] }) * half_extent.x + glm::abs(glm::vec3{ world[1] }) * half_extent.y + glm::abs(glm::vec3{ world[2] }) * half_extent.z;
+        box_x_[index] = box_center.x;
+        box_y_[index] = box_center.y;
+        box_z_[index] = box_center.z;
+        extent_x_[index] = extent.x;
+        extent_y_[index] = extent.y;
+        extent_z_[index] = extent.z;
+    }
+
+    uint32_t CullingSet::Cull(const Frustum& frustum, std::vector<uint8_t>& visible) const {
+        visible.resize(count_);
+        // Padding lets the last iteration load full registers, only the results of real objects are written
+#if defined(BP_CULLING_AVX)
+        const uint32_t width = 8;
+        for (uint32_t i = 0; i < count_; i += width) {
+            __m256 sx = _mm256_loadu_ps(&sphere_x_[i]), sy = _mm256_loadu_ps(&sphere_y_[i]), sz = _mm256_loadu_ps(&sphere_z_[i]);
+            __m256 negative_radius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&sphere_radius_[i]));
+            __m256 bx = _mm256_loadu_ps(&box_x_[i]), by = _mm256_loadu_ps(&box_y_[i]), bz = _mm256_loadu_ps(&box_z_[i]);
+            __m256 ex = _mm256_loadu_ps(&extent_x_[i]), ey = _mm256_loadu_ps(&extent_y_[i]), ez = _mm256_loadu_ps(&extent_z_[i]);
+
+            __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            for (const glm::vec4& plane : frustum.planes) {
+                __m256 nx = _mm256_set1_ps(plane.x), ny = _mm256_set1_ps(plane.y), nz = _mm256_set1_ps(plane.z), nw = _mm256_set1_ps(plane.w);
+                __m256 sphere_distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, sx), _mm256_mul_ps(ny, sy)), _mm256_add_ps(_mm256_mul_ps(nz, sz), nw));
+                __m256 box_distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, bx), _mm256_mul_ps(ny, by)), _mm256_add_ps(_mm256_mul_ps(nz, bz), nw));
+                box_distance = _mm256_add_ps(box_distance, _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(std::abs(plane.x)), ex),
+                    _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(std::abs(plane.y)), ey), _mm256_mul_ps(_mm256_set1_ps(std::abs(plane.z)), ez))));
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(sphere_distance, negative_radius, _CMP_GE_OQ));
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(box_distance, _mm256_setzero_ps(), _CMP_GE_OQ));
+            }
+
+            int mask = _mm256_movemask_ps(inside);
+            for (uint32_t lane = 0; lane < width && i + lane < count_; lane++) {
+                visible[i + lane] = (mask >> lane) & 1;
+            }
+        }
+#elif defined(BP_CULLING_SSE)
+        const uint32_t width = 4;
+        for (uint32_t i = 0; i < count_; i += width) {
+            __m128 sx = _mm_loadu_ps(&sphere_x_[i]), sy = _mm_loadu_ps(&sphere_y_[i]), sz = _mm_loadu_ps(&sphere_z_[i]);
+            __m128 negative_radius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&sphere_radius_[i]));
+            __m128 bx = _mm_loadu_ps(&box_x_[i]), by = _mm_loadu_ps(&box_y_[i]), bz = _mm_loadu_ps(&box_z_[i]);
+            __m128 ex = _mm_loadu_ps(&extent_x_[i]), ey = _mm_loadu_ps(&extent_y_[i]), ez = _mm_loadu_ps(&extent_z_[i]);
+
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (const glm::vec4& plane : frustum.planes) {
+                __m128 nx = _mm_set1_ps(plane.x), ny = _mm_set1_ps(plane.y), nz = _mm_set1_ps(plane.z), nw = _mm_set1_ps(plane.w);
+                __m128 sphere_distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, sx), _mm_mul_ps(ny, sy)), _mm_add_ps(_mm_mul_ps(nz, sz), nw));
+                __m128 box_distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, bx), _mm_mul_ps(ny, by)), _mm_add_ps(_mm_mul_ps(nz, bz), nw));
+                box_distance = _mm_add_ps(box_distance, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(std::abs(plane.x)), ex),
+                    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(std::abs(plane.y)), ey), _mm_mul_ps(_mm_set1_ps(std::abs(plane.z)), ez))));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(sphere_distance, negative_radius));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(box_distance, _mm_setzero_ps()));
+            }
+
+            int mask = _mm_movemask_ps(inside);
+            for (uint32_t lane = 0; lane < width && i + lane < count_; lane++) {
+                visible[i + lane] = (mask >> lane) & 1;
+            }
+        }
+#else
+        CullScalar(frustum, 0, count_, sphere_x_.data(), sphere_y_.data(), sphere_z_.data(), sphere_radius_.data(),
+            box_x_.data(), box_y_.data(), box_z_.data(), extent_x_.data(), extent_y_.data(), extent_z_.data(), visible.data());
+#endif
+
+        uint32_t visible_count = 0;
+        for (uint32_t i = 0; i < count_; i++) {
+            visible_count += visible[i];
+        }
+        return visible_count;
+    }
+
+    uint32_t CullingSet::GetCount() const {
+        return count_;
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include "geometry-helpers.h"
+
+namespace backpack {
+
+    // Objects tested per iteration of the widest kernel, the bounds arrays are padded to a multiple of it
+    const uint32_t CULLING_BATCH = 8;
+
+    // Planes point inwards, a point p is inside when dot(plane.xyz, p) + plane.w >= 0
+    struct Frustum {
+        std::array<glm::vec4, 6> planes;
+    };
+
+    struct CullingStatistics {
+        // Last culled frame
+        uint32_t visible_objects = 0;
+        uint32_t culled_objects = 0;
+        uint64_t total_visible = 0;
+        uint64_t total_culled = 0;
+        uint64_t frame_count = 0;
+    };
+
+    // Planes of a clip space with depth from 0 to 1, as set up by GLM_FORCE_DEPTH_ZERO_TO_ONE
+    Frustum ExtractFrustum(const glm::mat4& view_projection);
+
+    // AVX, SSE or scalar, depending on what the compiler was allowed to target
+    const char* GetCullingKernelName();
+
+    /*
+    * World space bounding spheres and boxes of all objects, one array per component so the kernels test 4 or 8 objects at once.
+    * The sphere rejects most objects, the box is tighter for long and flat objects.
+    */
+    class CullingSet {
+    public:
+        void Resize(uint32_t object_count);
+
+        // Transforms the object space bounds of the model into world space
+        void SetBounds(uint32_t index, const Model3D& model, const glm::mat4& world);
+
+        // visible receives 1 for every object that intersects the frustum, returns the number of visible objects
+        uint32_t Cull(const Frustum& frustum, std::vector<uint8_t>& visible) const;
+
+        uint32_t GetCount() const;
+
+    private:
+        uint32_t count_ = 0;
+        std::vector<float> sphere_x_, sphere_y_, sphere_z_, sphere_radius_;
+        // Boxes as center and half extent
+        std::vector<float> box_x_, box_y_, box_z_;
+        std::vector<float> extent_x_, extent_y_, extent_z_;
+    };
+}
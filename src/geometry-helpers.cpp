@@ -2,90 +2,207 @@
 
 #include "logger.h"
 #include "vk_helper_functions.h"
+#include "mesh_cache.h"
+#include "obj_parser.h"
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <chrono>
+
+static_assert(sizeof(BP_GpuMesh::lods) / sizeof(BP_GpuMeshLod) == backpack::MAX_MESH_LODS, "BP_GpuMesh holds a different number of levels than Model3D");
+
 namespace backpack {
 
-    VkVertexInputBindingDescription GetVertexBindingDescription() {
+    VkVertexInputBindingDescription GetVertexBindingDescription(VertexLayout layout) {
         // How the vertex data is passed. So through index 0 in the binding array of the pipeline, how large the vertex is and how it should be processed.
         VkVertexInputBindingDescription desc{};
         desc.binding = 0;
-        desc.stride = sizeof(Vertex);
+        desc.stride = GetVertexStride(layout);
         desc.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
         return desc;
     }
 
-    std::array<VkVertexInputAttributeDescription, 3> GetVertexAttributeDescription() {
+    std::array<VkVertexInputAttributeDescription, 3> GetVertexAttributeDescription(VertexLayout layout) {
+        // Normalized and half float formats are converted to floats by the input assembler, so the shaders don't change with the layout
+        bool compact = layout == VertexLayout::COMPACT;
+
         VkVertexInputAttributeDescription desc_1{};
         desc_1.binding = 0;
         desc_1.location = 0;
-        desc_1.offset = offsetof(Vertex, position);
-        desc_1.format = VK_FORMAT_R32G32B32_SFLOAT;
+        desc_1.offset = compact ? offsetof(CompactVertex, position) : offsetof(Vertex, position);
+        desc_1.format = compact ? VK_FORMAT_R16G16B16A16_UNORM : VK_FORMAT_R32G32B32_SFLOAT;
 
         VkVertexInputAttributeDescription desc_2{};
         desc_2.binding = 0;
         desc_2.location = 1;
-        desc_2.offset = offsetof(Vertex, color);
-        desc_2.format = VK_FORMAT_R32G32B32_SFLOAT;
+        desc_2.offset = compact ? offsetof(CompactVertex, color) : offsetof(Vertex, color);
+        desc_2.format = compact ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_R32G32B32_SFLOAT;
 
         VkVertexInputAttributeDescription desc_3{};
         desc_3.binding = 0;
         desc_3.location = 2;
-        desc_3.offset = offsetof(Vertex, texcoord);
-        desc_3.format = VK_FORMAT_R32G32_SFLOAT;
+        desc_3.offset = compact ? offsetof(CompactVertex, texcoord) : offsetof(Vertex, texcoord);
+        desc_3.format = compact ? VK_FORMAT_R16G16_SFLOAT : VK_FORMAT_R32G32_SFLOAT;
 
         return std::array<VkVertexInputAttributeDescription, 3>{desc_1, desc_2, desc_3};
     }
 
+    VkVertexInputBindingDescription GetInstanceBindingDescription() {
+        VkVertexInputBindingDescription desc{};
+        desc.binding = 1;
+        desc.stride = sizeof(BP_Instance);
+        desc.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+        return desc;
+    }
+
+    std::array<VkVertexInputAttributeDescription, 4> GetInstanceAttributeDescription() {
+        // A mat4 input takes one location per column
+        std::array<VkVertexInputAttributeDescription, 4> descs{};
+        for (uint32_t column = 0; column < descs.size(); column++) {
+            descs[column].binding = 1;
+            descs[column].location = 3 + column;
+            descs[column].offset = offsetof(BP_Instance, world) + column * sizeof(glm::vec4);
+            descs[column].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        }
+
+        return descs;
+    }
+
+    uint32_t GetVertexStride(VertexLayout layout) {
+        return layout == VertexLayout::COMPACT ? sizeof(CompactVertex) : sizeof(Vertex);
+    }
+
+    const char* GetVertexLayoutName(VertexLayout layout) {
+        return layout == VertexLayout::COMPACT ? "compact" : "full";
+    }
+
+    bool IsVertexLayoutSupported(VkPhysicalDevice physical_device, VertexLayout layout) {
+        for (const VkVertexInputAttributeDescription& attribute : GetVertexAttributeDescription(layout)) {
+            VkFormatProperties properties;
+            vkGetPhysicalDeviceFormatProperties(physical_device, attribute.format, &properties);
+            if ((properties.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    namespace {
+        uint16_t QuantizeUnorm16(float value) {
+            return static_cast<uint16_t>(glm::clamp(value, 0.0f, 1.0f) * 65535.0f + 0.5f);
+        }
+
+        uint8_t QuantizeUnorm8(float value) {
+            return static_cast<uint8_t>(glm::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
+    }
+
+    CompactVertex CompressVertex(const Vertex& vertex, const glm::vec3& bounds_min, const glm::vec3& extent) {
+        CompactVertex compact{};
+
+        // Flat axes have no extent, they all end up at bounds_min
+        for (int i = 0; i < 3; i++) {
+            compact.position[i] = extent[i] > 0.0f ? QuantizeUnorm16((vertex.position[i] - bounds_min[i]) / extent[i]) : 0;
+        }
+        compact.position[3] = 0;
+
+        for (int i = 0; i < 3; i++) {
+            compact.color[i] = QuantizeUnorm8(vertex.color[i]);
+        }
+        compact.color[3] = 255;
+
+        compact.texcoord[0] = static_cast<uint16_t>(glm::packHalf1x16(vertex.texcoord.x));
+        compact.texcoord[1] = static_cast<uint16_t>(glm::packHalf1x16(vertex.texcoord.y));
+
+        return compact;
+    }
+
+    glm::mat4 GetDequantizationMatrix(VertexLayout layout, const glm::vec3& bounds_min, const glm::vec3& bounds_max) {
+        if (layout != VertexLayout::COMPACT) {
+            return glm::mat4{ 1.0f };
+        }
+
+        // Flat axes are scaled by 1, their quantized value is always 0
+        glm::vec3 extent = bounds_max - bounds_min;
+        glm::vec3 scale{ extent.x > 0.0f ? extent.x : 1.0f, extent.y > 0.0f ? extent.y : 1.0f, extent.z > 0.0f ? extent.z : 1.0f };
+        return glm::scale(glm::translate(glm::mat4{ 1.0f }, bounds_min), scale);
+    }
+
 }
 
 namespace backpack {
-    Model3D LoadSingleModel3D(VkDevice device, VkPhysicalDevice phys_device, VkCommandPool cmd_pool, VkQueue device_queue, uint32_t frames_in_flight, const std::vector<backpack::Vertex>& vertices, const std::vector<uint32_t>& indices) {
-        VkDeviceSize vertices_size = sizeof(backpack::Vertex) * vertices.size();
-        VkDeviceSize indices_size = sizeof(uint32_t) * indices.size();
+    Model3D LoadSingleModel3D(GPUMemoryAllocator& allocator, VkDevice device, UploadManager& uploader, const std::vector<backpack::Vertex>& vertices, const std::vector<uint32_t>& indices, VertexLayout layout) {
+        glm::vec3 bounds_min, bounds_max;
+        ComputeBounds(vertices.data(), static_cast<uint32_t>(vertices.size()), bounds_min, bounds_max);
+        return LoadSingleModel3D(allocator, device, uploader, vertices.data(), static_cast<uint32_t>(vertices.size()), indices.data(), static_cast<uint32_t>(indices.size()), layout, bounds_min, bounds_max);
+    }
 
-        Model3D model{};
-        VkBuffer staging_buffer;
-        VkDeviceMemory staging_memory;
+    Model3D LoadSingleModel3D(GPUMemoryAllocator& allocator, VkDevice device, UploadManager& uploader, const Vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count,
+        VertexLayout layout, const glm::vec3& bounds_min, const glm::vec3& bounds_max) {
+        VkDeviceSize vertices_size = GetVertexStride(layout) * static_cast<VkDeviceSize>(vertex_count);
+        VkDeviceSize indices_size = sizeof(uint32_t) * static_cast<VkDeviceSize>(index_count);
 
-        model.index_count = indices.size();
+        Model3D model{};
 
-        // Create staging buffer
-        CreateBuffer(device, phys_device, vertices_size + indices_size,
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-            staging_buffer, staging_memory, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, nullptr);
+        model.index_count = index_count;
+        model.layout = layout;
+        model.bounds_min = bounds_min;
+        model.bounds_max = bounds_max;
+        model.dequantization = GetDequantizationMatrix(layout, bounds_min, bounds_max);
+        model.lods[0] = MeshLod{ 0, index_count, 0.0f };
+        model.lod_count = 1;
+
+        model.sphere_center = (bounds_min + bounds_max) * 0.5f;
+        float squared_radius = 0.0f;
+        for (uint32_t i = 0; i < vertex_count; i++) {
+            glm::vec3 offset = vertices[i].position - model.sphere_center;
+            squared_radius = glm::max(squared_radius, glm::dot(offset, offset));
+        }
+        model.sphere_radius = glm::sqrt(squared_radius);
 
-        // Create device buffer
-        CreateBuffer(device, phys_device, vertices_size + indices_size,
-            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            model.gpu_buffer, model.gpu_memory, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, nullptr);
+        // Staging range is reused once the copy finished
+        BP_StagingRegion staging = uploader.AllocateStaging(BP_UploadQueue::TRANSFER, vertices_size + indices_size);
+        if (!staging.mapped) {
+            LOG << "FAILURE\t Could not allocate staging memory for model";
+            return model;
+        }
 
-        // Map data and copy to GPU
-        void* data;
-        vkMapMemory(device, staging_memory, 0, vertices_size + indices_size, 0, &data);
-        memcpy(data, vertices.data(), static_cast<size_t>(vertices_size));
-        memcpy(static_cast<char*>(data) + vertices_size, indices.data(), static_cast<size_t>(indices_size));
-        vkUnmapMemory(device, staging_memory);
+        // Create device buffer, shared when it's written on a different queue family than it's drawn on.
+        // Storage usage lets the buffer be put in the bindless set for shaders that fetch vertices themselves
+        CreateBuffer(allocator, device, vertices_size + indices_size,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            model.gpu_buffer, model.gpu_allocation, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, uploader.GetSharingFamilies());
+
+        // Staging memory is mapped persistently, compact vertices are quantized into it without an intermediate copy
+        if (layout == VertexLayout::COMPACT) {
+            CompactVertex* compact = static_cast<CompactVertex*>(staging.mapped);
+            glm::vec3 extent = bounds_max - bounds_min;
+            for (uint32_t i = 0; i < vertex_count; i++) {
+                compact[i] = CompressVertex(vertices[i], bounds_min, extent);
+            }
+        }
+        else {
+            memcpy(staging.mapped, vertices, static_cast<size_t>(vertices_size));
+        }
+        memcpy(static_cast<char*>(staging.mapped) + vertices_size, indices, static_cast<size_t>(indices_size));
 
         model.index_offset = static_cast<uint32_t>(vertices_size);
 
-        // Do GPU copy operations
-        VkCommandBuffer cmd_buffer = BeginSingleTimeCommandBuffer(device, cmd_pool);
-
-        // Copy device memory
+        // Copy device memory, submitted together with the other uploads
+        VkCommandBuffer cmd_buffer = uploader.GetCommandBuffer(BP_UploadQueue::TRANSFER);
         VkBufferCopy copy_region{};
-        copy_region.srcOffset = 0;
+        copy_region.srcOffset = staging.offset;
         copy_region.dstOffset = 0;
         copy_region.size = vertices_size + indices_size;
-        vkCmdCopyBuffer(cmd_buffer, staging_buffer, model.gpu_buffer, 1, &copy_region);
-
-        EndSingleTimeCommandBuffer(device, device_queue, cmd_pool, cmd_buffer);
+        vkCmdCopyBuffer(cmd_buffer, staging.buffer, model.gpu_buffer, 1, &copy_region);
 
-        vkDestroyBuffer(device, staging_buffer, nullptr);
-        vkFreeMemory(device, staging_memory, nullptr);
+        model.upload_ticket = uploader.GetCurrentTicket(BP_UploadQueue::TRANSFER);
 
         //// Create UBO's
         //model.ubo_buffer.resize(frames_in_flight);
@@ -101,16 +218,42 @@ namespace backpack {
         return model;
     }
 
-    void DestroyModel(VkDevice device, Model3D* model) {
-        if (model->gpu_buffer != VK_NULL_HANDLE) {
-            vkDestroyBuffer(device, model->gpu_buffer, nullptr);
-            model->gpu_buffer = VK_NULL_HANDLE;
+    void SetModelLods(Model3D& model, const MeshLod* lods, uint32_t lod_count) {
+        if (lod_count > MAX_MESH_LODS) {
+            LOG << "WARNING\t Model has " << lod_count << " levels of detail, only the first " << MAX_MESH_LODS << " are used";
+            lod_count = MAX_MESH_LODS;
+        }
+        for (uint32_t i = 0; i < lod_count; i++) {
+            model.lods[i] = lods[i];
+        }
+        model.lod_count = lod_count > 0 ? lod_count : 1;
+    }
 
+    uint32_t SelectMeshLod(const Model3D& model, const glm::mat4& transform, float viewport_height, float pixel_error) {
+        if (model.lod_count <= 1) {
+            return 0;
         }
-        if (model->gpu_memory != VK_NULL_HANDLE) {
-            vkFreeMemory(device, model->gpu_memory, nullptr);
-            model->gpu_memory = VK_NULL_HANDLE;
+
+        // Close to or behind the camera the projection breaks down, draw the full mesh
+        glm::vec3 center = (model.bounds_min + model.bounds_max) * 0.5f;
+        float depth = (transform * glm::vec4{ center, 1.0f }).w;
+        if (depth <= 1e-4f) {
+            return 0;
         }
+
+        // Pixels one object space unit covers, the largest axis so rotations and non uniform scales don't pick a coarser level
+        float axis_scale = glm::max(glm::length(glm::vec2{ transform[0] }), glm::max(glm::length(glm::vec2{ transform[1] }), glm::length(glm::vec2{ transform[2] })));
+        float pixels_per_unit = axis_scale / depth * viewport_height * 0.5f;
+
+        uint32_t lod = 0;
+        while (lod + 1 < model.lod_count && model.lods[lod + 1].error * pixels_per_unit <= pixel_error) {
+            lod++;
+        }
+        return lod;
+    }
+
+    void DestroyModel(GPUMemoryAllocator& allocator, VkDevice device, Model3D* model) {
+        DestroyBuffer(allocator, device, model->gpu_buffer, model->gpu_allocation);
     }
 
     // Todo not packed at all yet
@@ -119,45 +262,48 @@ namespace backpack {
         std::vector<tinyobj::shape_t> shapes;
         std::vector<tinyobj::material_t> materials;
 
+        auto parse_start = std::chrono::high_resolution_clock::now();
+
         std::string err;
-        tinyobj::LoadObj(&attributes, &shapes, &materials, &err, paths[0].c_str());
+        bool loaded = tinyobj::LoadObj(&attributes, &shapes, &materials, &err, paths[0].c_str());
+        if (!err.empty()) {
+            LOG << "WARNING\t " << err;
+        }
 
         MeshGeometry geometry;
-        size_t vertex_index = 0;
+        if (!loaded) {
+            LOG << "FAILURE\t Couldn't load " << paths[0];
+            return geometry;
+        }
+
+        auto weld_start = std::chrono::high_resolution_clock::now();
 
-        // Only supports triangulated meshes
-        int unique_vertices_size = attributes.vertices.size() / 3;
-        geometry.vertices.resize(geometry.vertices.size() + unique_vertices_size);
-        std::vector<bool> vert_exists(unique_vertices_size, false);
+        // Hand the attribute arrays over without copying, only the corners are converted
+        ObjAttributes obj;
+        obj.positions = std::move(attributes.vertices);
+        obj.normals = std::move(attributes.normals);
+        obj.texcoords = std::move(attributes.texcoords);
 
+        size_t corner_count = 0;
+        for (auto& shape : shapes) {
+            corner_count += shape.mesh.indices.size();
+        }
+        obj.corners.reserve(corner_count);
         for (auto& shape : shapes) {
             for (auto& index : shape.mesh.indices) {
-                geometry.indices.push_back(index.vertex_index);
-
-                // Continue if the vertex already exists
-                if (vert_exists[index.vertex_index]) {
-                    continue;
-                }
-
-                Vertex vertex{};
-                vertex.position = {
-                     attributes.vertices[3 * index.vertex_index + 0],
-                     attributes.vertices[3 * index.vertex_index + 1],
-                     attributes.vertices[3 * index.vertex_index + 2]
-                };
-
-
-                vertex.texcoord = {
-                    attributes.texcoords[2 * index.texcoord_index + 0],
-                    1.0f - attributes.texcoords[2 * index.texcoord_index + 1]
-                };
-
-                geometry.vertices[index.vertex_index] = vertex;
-
-                vert_exists[index.vertex_index] = true;
+                obj.corners.push_back(ObjCorner{ index.vertex_index, index.normal_index, index.texcoord_index });
             }
         }
 
+        geometry = WeldObjCorners(obj);
+
+        auto weld_end = std::chrono::high_resolution_clock::now();
+        double parse_ms = std::chrono::duration<double, std::chrono::milliseconds::period>(weld_start - parse_start).count();
+        double weld_ms = std::chrono::duration<double, std::chrono::milliseconds::period>(weld_end - weld_start).count();
+        double ratio = geometry.vertices.empty() ? 0.0 : static_cast<double>(corner_count) / geometry.vertices.size();
+        LOG << "Loaded " << paths[0] << ": parsed in " << parse_ms << "ms, welded " << corner_count << " corners into "
+            << geometry.vertices.size() << " vertices (" << ratio << "x) in " << weld_ms << "ms";
+
         return geometry;
     }
 
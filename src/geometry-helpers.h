@@ -5,6 +5,9 @@
 #include <vector>
 #include <array>
 
+#include "vk_memory_allocator.h"
+#include "vk_upload_manager.h"
+
 const std::string VIKING_ROOM_M = "../model/viking_room.obj";
 const std::string VIKING_ROOM_T = "../model/viking_room.png";
 
@@ -18,11 +21,57 @@ struct ShaderStorageBuffer {
     glm::vec3 particles{};
 };
 
+// Pushed per draw, the indices are slots of the bindless set
 struct MeshPushConstants {
-    glm::vec4 data;
+    uint32_t texture_index;
+    // Uniforms and objects of the frame in the storage buffer array
+    uint32_t uniform_index;
+    uint32_t object_index;
+    uint32_t padding;
     glm::mat4 transform;
 };
 
+// Per instance vertex input of the instanced pipeline, one matrix column per attribute location
+struct BP_Instance {
+    glm::mat4 world;
+};
+
+// Per object input of the culling pass and the indirect vertex shader, std430 layout
+struct BP_GpuObject {
+    glm::mat4 world;
+    // Object space bounding sphere, center in xyz and radius in w
+    glm::vec4 sphere;
+    uint32_t mesh;
+    uint32_t padding[3];
+};
+
+struct BP_GpuMeshLod {
+    uint32_t first_index;
+    uint32_t index_count;
+    float error;
+    uint32_t padding;
+};
+
+// Levels of a mesh and the range of the draw command buffer its visible objects are written to
+struct BP_GpuMesh {
+    uint32_t lod_count;
+    uint32_t draw_offset;
+    uint32_t draw_capacity;
+    uint32_t padding;
+    // Must match backpack::MAX_MESH_LODS and cull.comp
+    BP_GpuMeshLod lods[8];
+};
+
+// std140 layout of the culling pass uniforms
+struct BP_CullingUniforms {
+    glm::mat4 view_projection;
+    glm::vec4 planes[6];
+    uint32_t object_count;
+    float viewport_height;
+    float pixel_error;
+    uint32_t padding;
+};
+
 struct BP_Particle {
     glm::vec2 position;
     glm::vec2 velocity;
@@ -37,6 +86,25 @@ namespace backpack {
         glm::vec2 texcoord;
     };
 
+    // Vertex formats the models can be uploaded in, both feed the same shader inputs
+    enum class VertexLayout {
+        // Vertex as is, 32 bit floats
+        FULL,
+        // CompactVertex, quantized at load time
+        COMPACT
+    };
+
+    /*
+    * 16 instead of 32 bytes per vertex. Positions are 16 bit normalized relative to the model bounds and scaled back by Model3D::dequantization,
+    * colors are 8 bit normalized and texcoords half floats.
+    */
+    struct CompactVertex {
+        // w is padding, three component 16 bit formats are rarely supported for vertex input
+        uint16_t position[4];
+        uint8_t color[4];
+        uint16_t texcoord[2];
+    };
+
     const std::vector<uint32_t> quad_indices{
         1, 0, 2, 1, 2, 3, 1
     };
@@ -65,19 +133,64 @@ namespace backpack {
     {{ -.5f, .5f, 0.0f }, {0.1f, 0.0f, 1.0f }}
     };
 
-    VkVertexInputBindingDescription GetVertexBindingDescription();
+    const uint32_t MAX_MESH_LODS = 8;
+
+    // Range of the index buffer that draws one level of detail, all levels share the vertices
+    struct MeshLod {
+        uint32_t first_index;
+        uint32_t index_count;
+        // Largest distance to the full detail surface, in object space units
+        float error;
+    };
+
+    VkVertexInputBindingDescription GetVertexBindingDescription(VertexLayout layout = VertexLayout::FULL);
+
+    std::array<VkVertexInputAttributeDescription, 3> GetVertexAttributeDescription(VertexLayout layout = VertexLayout::FULL);
+
+    // Second binding of the instanced pipeline, advances once per instance
+    VkVertexInputBindingDescription GetInstanceBindingDescription();
+
+    // BP_Instance::world as four vec4 attributes at locations 3 to 6
+    std::array<VkVertexInputAttributeDescription, 4> GetInstanceAttributeDescription();
 
-    std::array<VkVertexInputAttributeDescription, 3> GetVertexAttributeDescription();
+    uint32_t GetVertexStride(VertexLayout layout);
+
+    const char* GetVertexLayoutName(VertexLayout layout);
+
+    // Checks that every attribute format of the layout can be read as a vertex buffer
+    bool IsVertexLayoutSupported(VkPhysicalDevice physical_device, VertexLayout layout);
+
+    // Quantizes the vertex relative to the bounds, extent is bounds_max - bounds_min
+    CompactVertex CompressVertex(const Vertex& vertex, const glm::vec3& bounds_min, const glm::vec3& extent);
+
+    // Maps the [0, 1] positions of a compact vertex back into the bounds
+    glm::mat4 GetDequantizationMatrix(VertexLayout layout, const glm::vec3& bounds_min, const glm::vec3& bounds_max);
 
 }
 
 namespace backpack {
     struct Model3D {
         VkBuffer gpu_buffer;
-        VkDeviceMemory gpu_memory;
-        VkPipeline pipeline;
+        BP_Allocation gpu_allocation;
+        // Pipeline registry variant the model is drawn with, BP_PipelineVariant
+        uint32_t pipeline_variant;
         uint32_t index_offset;
         uint32_t index_count;
+        // The model is drawn once this upload completed
+        BP_UploadTicket upload_ticket;
+        // Object space bounding box
+        glm::vec3 bounds_min;
+        glm::vec3 bounds_max;
+        // Object space bounding sphere around the box center, tighter than the sphere around the box
+        glm::vec3 sphere_center;
+        float sphere_radius;
+        // Format of the vertices in gpu_buffer
+        VertexLayout layout;
+        // Applied before the model transform, identity for full vertices
+        glm::mat4 dequantization;
+        // Level 0 is the full mesh
+        std::array<MeshLod, MAX_MESH_LODS> lods;
+        uint32_t lod_count;
         //std::vector<VkBuffer> ubo_buffer;
         //std::vector<VkDeviceMemory> ubo_memory;
         //std::vector<void*> ubo_mapped_memory;
@@ -98,7 +211,10 @@ namespace backpack {
 
     struct MeshGeometry {
         std::vector<Vertex> vertices;
+        // Indices of all levels of detail, one after the other
         std::vector<uint32_t> indices;
+        // Empty when indices only hold the full mesh
+        std::vector<MeshLod> lods;
     };
 
     //size_t GetModelSize(uint32_t num_indices, uint32_t num_vertices) {
@@ -116,10 +232,27 @@ namespace backpack {
     //    //void* ptr = (size) new;
     //}
 
-    Model3D LoadSingleModel3D(VkDevice device, VkPhysicalDevice phys_device, VkCommandPool cmd_pool, VkQueue device_queue, uint32_t frames_in_flight, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+    // Records the upload on the transfer queue, the model can't be drawn before its upload ticket completed
+    Model3D LoadSingleModel3D(GPUMemoryAllocator& allocator, VkDevice device, UploadManager& uploader, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, VertexLayout layout = VertexLayout::FULL);
+
+    /*
+    * Writes straight from the pointers into staging memory, used with meshes mapped from the mesh cache.
+    * Compact vertices are quantized while they are written, relative to the given bounds.
+    */
+    Model3D LoadSingleModel3D(GPUMemoryAllocator& allocator, VkDevice device, UploadManager& uploader, const Vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count,
+        VertexLayout layout, const glm::vec3& bounds_min, const glm::vec3& bounds_max);
+
+    // Replaces the single level the model is loaded with
+    void SetModelLods(Model3D& model, const MeshLod* lods, uint32_t lod_count);
+
+    /*
+    * Picks the coarsest level whose error projects to at most pixel_error pixels. transform maps object space to clip space,
+    * the error is projected at the depth of the bounding box center.
+    */
+    uint32_t SelectMeshLod(const Model3D& model, const glm::mat4& transform, float viewport_height, float pixel_error);
 
     // Does not destroy uthe pipeline object
-    void DestroyModel(VkDevice device, Model3D* model);
+    void DestroyModel(GPUMemoryAllocator& allocator, VkDevice device, Model3D* model);
 
     class ModelLoader {
     public:
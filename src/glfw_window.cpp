@@ -54,10 +54,12 @@ void GLFWWindowImpl::GetWindowResolution(uint32_t& width, uint32_t& height)
 	height = static_cast<uint32_t>(h);
 }
 
+#ifdef WIN32
 void GLFWWindowImpl::GetWindowHandle(HWND& hwnd)
 {
 	hwnd = glfwGetWin32Window(window);
 }
+#endif // WIN32
 
 VkSurfaceKHR GLFWWindowImpl::CreateVulkanWindowSurface(VkInstance instance)
 {
@@ -75,8 +77,10 @@ GLFWwindow* GLFWWindowImpl::GLFWGetWindow()
 WindowData GLFWWindowImpl::GetWindowData()
 {
 	WindowData w_data{};
+#ifdef WIN32
 	GetWindowHandle(w_data.hwnd);
 	w_data.hinstance = GetModuleHandle(nullptr);
+#endif // WIN32
 	GetWindowResolution(w_data.window_width, w_data.window_height);
 	return w_data;
 }
@@ -1,16 +1,24 @@
 #pragma once
 #include <string>
 
+#ifdef WIN32
 #define VK_USE_PLATFORM_WIN32_KHR
+#endif // WIN32
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
+#ifdef WIN32
 #define GLFW_EXPOSE_NATIVE_WIN32
 #include <GLFW/glfw3native.h>
+#endif // WIN32
 
 #include "bp_window.h"
 #include <klein/klein.hpp>
 
+#ifdef WIN32
 class GLFWWindowImpl: public BP_Win_Window {
+#else
+class GLFWWindowImpl: public BP_Window {
+#endif // WIN32
 private:
 	GLFWwindow* window = nullptr;
 	
@@ -25,7 +33,9 @@ public:
 	void Destroy() override;
 	void GetWindowResolution(uint32_t& width, uint32_t& height) override;
 
+#ifdef WIN32
 	void GetWindowHandle(HWND& hwnd) override;
+#endif // WIN32
 	VkSurfaceKHR CreateVulkanWindowSurface(VkInstance instance) override;
 
 
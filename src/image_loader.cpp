@@ -14,7 +14,7 @@
 
 namespace fs = std::filesystem;
 
-size_t LoadTexture(const VkDevice& vulkan_device, const VkPhysicalDevice& selected_device, VkBuffer& buffer, VkDeviceMemory& device_memory, int& width, int& height, int& channels, uint32_t& mip_levels, std::string path)
+size_t LoadTexture(UploadManager& uploader, BP_UploadQueue queue, BP_StagingRegion& staging, int& width, int& height, int& channels, uint32_t& mip_levels, std::string path)
 {
 	fs::path img_path{ path };
     if (!fs::exists(img_path)) {
@@ -32,15 +32,16 @@ size_t LoadTexture(const VkDevice& vulkan_device, const VkPhysicalDevice& select
 
 	mip_levels = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height))) + 1);
 
-	// Create staging buffer
-	CreateBuffer(vulkan_device, selected_device, image_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, buffer, device_memory, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-	// Copy image data
-	void* data;
-	vkMapMemory(vulkan_device, device_memory, 0, image_size, 0, &data);
-	memcpy(data, stbi_im, image_size);
+	// Buffer to image copies need an offset that is a multiple of the texel size
+	staging = uploader.AllocateStaging(queue, image_size, STBI_rgb_alpha * 4);
+	if (!staging.mapped) {
+		LOG << "ERROR\t could not allocate texture staging memory";
+		stbi_image_free(stbi_im);
+		return 0;
+	}
 
-	vkUnmapMemory(vulkan_device, device_memory);
+	// Copy image data, the staging memory stays mapped
+	memcpy(staging.mapped, stbi_im, image_size);
 	stbi_image_free(stbi_im);
 
 	return image_size;
@@ -1,17 +1,196 @@
 #include "app.h"
 #include "logger.h"
+#include "obj_parser.h"
+#include "thread_pool.h"
 
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/vec4.hpp>
 #include <glm/mat4x4.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <string>
 
-int main() {
+// Both parsers turn the same text into floats, allow for the last bit rounding differently
+static bool NearlyEqual(float a, float b) {
+	return std::abs(a - b) <= 1e-6f * std::max({ 1.0f, std::abs(a), std::abs(b) });
+}
+
+static bool VerticesMatch(const backpack::Vertex& a, const backpack::Vertex& b) {
+	for (int i = 0; i < 3; i++) {
+		if (!NearlyEqual(a.position[i], b.position[i]) || !NearlyEqual(a.color[i], b.color[i])) {
+			return false;
+		}
+	}
+	return NearlyEqual(a.texcoord.x, b.texcoord.x) && NearlyEqual(a.texcoord.y, b.texcoord.y);
+}
+
+// Loads the OBJ with tinyobjloader and with the parallel parser a few times and logs the best time of each
+static int BenchmarkObjLoading(const std::string& path, uint32_t runs) {
+	using clock = std::chrono::high_resolution_clock;
+	double tinyobj_ms = 0.0, parallel_ms = 0.0;
+	backpack::MeshGeometry reference, parallel;
+	ThreadPool pool;
+
+	for (uint32_t i = 0; i < runs; i++) {
+		auto start = clock::now();
+		reference = backpack::ModelLoader{}.LoadModels({ path });
+		double ms = std::chrono::duration<double, std::chrono::milliseconds::period>(clock::now() - start).count();
+		tinyobj_ms = i == 0 ? ms : std::min(tinyobj_ms, ms);
+
+		start = clock::now();
+		parallel = backpack::LoadObjParallel(path, pool);
+		ms = std::chrono::duration<double, std::chrono::milliseconds::period>(clock::now() - start).count();
+		parallel_ms = i == 0 ? ms : std::min(parallel_ms, ms);
+	}
+
+	LOG << "OBJ benchmark " << path << ", best of " << runs << ": tinyobjloader " << tinyobj_ms << "ms, parallel " << parallel_ms
+		<< "ms on " << pool.GetThreadCount() + 1 << " threads, " << (parallel_ms > 0.0 ? tinyobj_ms / parallel_ms : 0.0) << "x";
+	if (reference.indices.size() != parallel.indices.size() || reference.vertices.size() != parallel.vertices.size()) {
+		LOG << "FAILURE\t Parallel parser output differs from tinyobjloader: " << parallel.indices.size() << " indices and " << parallel.vertices.size()
+			<< " vertices instead of " << reference.indices.size() << " and " << reference.vertices.size();
+		return 1;
+	}
+	auto index_mismatch = std::mismatch(reference.indices.begin(), reference.indices.end(), parallel.indices.begin());
+	if (index_mismatch.first != reference.indices.end()) {
+		LOG << "FAILURE\t Parallel parser output differs from tinyobjloader at index " << index_mismatch.first - reference.indices.begin();
+		return 1;
+	}
+	for (size_t i = 0; i < reference.vertices.size(); i++) {
+		if (!VerticesMatch(reference.vertices[i], parallel.vertices[i])) {
+			LOG << "FAILURE\t Parallel parser output differs from tinyobjloader at vertex " << i;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+* Usage: Krakatoa [--headless] [--frames N] [--size WxH] [--dump frame.ppm] [--instances N] [--cache-commands]
+*                 [--frames-in-flight N] [--present vsync|low-latency|throughput|paced] [--frame-limit FPS] [--watch-shaders]
+*                 [--texture-mix F] [--untextured] [--no-tune] [--vertex-layout full|compact]
+*        Krakatoa --bench-obj model.obj [--runs N]
+* Headless runs render a fixed amount of frames offscreen, for example on a software driver like lavapipe.
+* --instances fills the scene with N copies of the model, drawn as instances.
+* --cache-commands reuses recorded command buffers while the draw list stays the same.
+* --frames-in-flight sets how many frames the CPU records ahead, 1 to 4. --frame-limit is the rate of the paced policy.
+* --present picks the starting policy, P switches to the next one while the window is open.
+* --watch-shaders rebuilds the pipelines of .spv files that are recompiled while running.
+* --texture-mix and --untextured are baked into the fragment shader. --no-tune keeps the default culling workgroup size.
+* --vertex-layout uploads 32 bit float vertices or quantized ones, compact is the default.
+*/
+int main(int argc, char** argv) {
+	bool headless = false;
+	uint32_t frame_count = 100;
+	uint32_t width = 600, height = 600;
+	std::string dump_path;
+	std::string bench_obj_path;
+	uint32_t bench_runs = 3;
+	BP_RenderSettings settings;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--headless") {
+			headless = true;
+		}
+		else if (arg == "--frames" && i + 1 < argc) {
+			frame_count = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (arg == "--size" && i + 1 < argc) {
+			std::string size = argv[++i];
+			size_t split = size.find('x');
+			if (split != std::string::npos) {
+				width = static_cast<uint32_t>(std::stoul(size.substr(0, split)));
+				height = static_cast<uint32_t>(std::stoul(size.substr(split + 1)));
+			}
+		}
+		else if (arg == "--dump" && i + 1 < argc) {
+			dump_path = argv[++i];
+		}
+		else if (arg == "--bench-obj" && i + 1 < argc) {
+			bench_obj_path = argv[++i];
+		}
+		else if (arg == "--runs" && i + 1 < argc) {
+			bench_runs = std::max(1u, static_cast<uint32_t>(std::stoul(argv[++i])));
+		}
+		else if (arg == "--cache-commands") {
+			settings.cache_command_buffers = true;
+		}
+		else if (arg == "--watch-shaders") {
+			settings.watch_shaders = true;
+		}
+		else if (arg == "--texture-mix" && i + 1 < argc) {
+			settings.texture_mix = std::clamp(std::stof(argv[++i]), 0.0f, 1.0f);
+		}
+		else if (arg == "--untextured") {
+			settings.textured = false;
+		}
+		else if (arg == "--no-tune") {
+			settings.tune_workgroup_size = false;
+		}
+		else if (arg == "--instances" && i + 1 < argc) {
+			settings.instance_count = std::max(1u, static_cast<uint32_t>(std::stoul(argv[++i])));
+		}
+		else if (arg == "--frames-in-flight" && i + 1 < argc) {
+			settings.frames_in_flight = std::clamp(static_cast<uint32_t>(std::stoul(argv[++i])), 1u, MAX_FRAMES_IN_FLIGHT);
+		}
+		else if (arg == "--frame-limit" && i + 1 < argc) {
+			settings.frame_rate_limit = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (arg == "--present" && i + 1 < argc) {
+			std::string policy = argv[++i];
+			if (policy == "vsync") {
+				settings.present_policy = BP_PresentPolicy::VSYNC;
+			}
+			else if (policy == "low-latency") {
+				settings.present_policy = BP_PresentPolicy::LOW_LATENCY;
+			}
+			else if (policy == "throughput") {
+				settings.present_policy = BP_PresentPolicy::THROUGHPUT;
+			}
+			else if (policy == "paced") {
+				settings.present_policy = BP_PresentPolicy::PACED;
+			}
+			else {
+				LOG << "WARNING\t Unknown present policy " << policy;
+			}
+		}
+		else if (arg == "--vertex-layout" && i + 1 < argc) {
+			std::string layout = argv[++i];
+			if (layout == "full") {
+				settings.vertex_layout = backpack::VertexLayout::FULL;
+			}
+			else if (layout == "compact") {
+				settings.vertex_layout = backpack::VertexLayout::COMPACT;
+			}
+			else {
+				LOG << "WARNING\t Unknown vertex layout " << layout;
+			}
+		}
+	}
+
+	if (!bench_obj_path.empty()) {
+		return BenchmarkObjLoading(bench_obj_path, bench_runs);
+	}
 
 	GraphicsApplication app;
 
-	app.Initialize();
+	if (headless) {
+		if (!app.InitializeHeadless(width, height, settings)) {
+			return 1;
+		}
+		app.RunHeadless(frame_count);
+		if (!dump_path.empty()) {
+			app.SaveFrame(dump_path);
+		}
+		return 0;
+	}
+
+	if (!app.Initialize(settings)) {
+		return 1;
+	}
 
 	app.Run();
 
@@ -0,0 +1,108 @@
+#include "mapped_file.h"
+
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // WIN32
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+bool MappedFile::Open(const std::string& path) {
+    Close();
+
+#ifdef WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        CloseHandle(file);
+        return false;
+    }
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    file_handle_ = file;
+    mapping_handle_ = mapping;
+    data_ = static_cast<const uint8_t*>(view);
+    size_ = static_cast<size_t>(file_size.QuadPart);
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void* view = mmap(nullptr, static_cast<size_t>(file_stat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    // The file is read front to back once, so let the kernel read ahead
+    madvise(view, static_cast<size_t>(file_stat.st_size), MADV_SEQUENTIAL);
+
+    file_descriptor_ = fd;
+    data_ = static_cast<const uint8_t*>(view);
+    size_ = static_cast<size_t>(file_stat.st_size);
+#endif // WIN32
+
+    return true;
+}
+
+void MappedFile::Close() {
+    if (!data_) {
+        return;
+    }
+
+#ifdef WIN32
+    UnmapViewOfFile(data_);
+    CloseHandle(mapping_handle_);
+    CloseHandle(file_handle_);
+    mapping_handle_ = nullptr;
+    file_handle_ = nullptr;
+#else
+    munmap(const_cast<uint8_t*>(data_), size_);
+    close(file_descriptor_);
+    file_descriptor_ = -1;
+#endif // WIN32
+
+    data_ = nullptr;
+    size_ = 0;
+}
+
+const uint8_t* MappedFile::Data() const {
+    return data_;
+}
+
+size_t MappedFile::Size() const {
+    return size_;
+}
+
+bool MappedFile::IsOpen() const {
+    return data_ != nullptr;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+* Read-only memory mapping of a whole file. Pages are loaded by the OS when they are touched,
+* so reading through Data() doesn't go through an intermediate buffer.
+*/
+class MappedFile {
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+
+#ifdef WIN32
+    void* file_handle_ = nullptr;
+    void* mapping_handle_ = nullptr;
+#else
+    int file_descriptor_ = -1;
+#endif // WIN32
+
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Returns false when the file doesn't exist, is empty or can't be mapped
+    bool Open(const std::string& path);
+    void Close();
+
+    const uint8_t* Data() const;
+    size_t Size() const;
+    bool IsOpen() const;
+};
@@ -0,0 +1,191 @@
+#include "mesh_cache.h"
+#include "logger.h"
+
+#include <filesystem>
+#include <fstream>
+#include <limits>
+
+namespace fs = std::filesystem;
+
+namespace {
+    uint64_t HashFNV1a(uint64_t hash, const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 0x100000001B3ull;
+        }
+        return hash;
+    }
+
+    // Doesn't read the OBJ itself, reading it is what the cache avoids
+    bool HashSource(const std::string& source_path, uint64_t& hash) {
+        std::error_code error;
+        uint64_t size = fs::file_size(source_path, error);
+        if (error) {
+            return false;
+        }
+        auto write_time = fs::last_write_time(source_path, error).time_since_epoch().count();
+        if (error) {
+            return false;
+        }
+
+        hash = 0xCBF29CE484222325ull;
+        hash = HashFNV1a(hash, &size, sizeof(size));
+        hash = HashFNV1a(hash, &write_time, sizeof(write_time));
+        return true;
+    }
+
+    uint64_t AlignUp(uint64_t value, uint64_t alignment) {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+}
+
+namespace backpack {
+
+    std::string GetMeshCachePath(const std::string& source_path) {
+        return source_path + MESH_CACHE_EXTENSION;
+    }
+
+    void ComputeBounds(const Vertex* vertices, uint32_t vertex_count, glm::vec3& bounds_min, glm::vec3& bounds_max) {
+        if (vertex_count == 0) {
+            bounds_min = bounds_max = glm::vec3{ 0.0f };
+            return;
+        }
+
+        bounds_min = glm::vec3{ std::numeric_limits<float>::max() };
+        bounds_max = glm::vec3{ std::numeric_limits<float>::lowest() };
+        for (uint32_t i = 0; i < vertex_count; i++) {
+            bounds_min = glm::min(bounds_min, vertices[i].position);
+            bounds_max = glm::max(bounds_max, vertices[i].position);
+        }
+    }
+
+    bool WriteMeshCache(const std::string& cache_path, const std::string& source_path, const MeshGeometry& geometry, uint32_t flags) {
+        MeshCacheHeader header{};
+        header.magic = MESH_CACHE_MAGIC;
+        header.version = MESH_CACHE_VERSION;
+        header.flags = flags;
+        if (!HashSource(source_path, header.source_hash)) {
+            LOG << "FAILURE\t Couldn't read " << source_path << " to build its mesh cache";
+            return false;
+        }
+        header.vertex_stride = sizeof(Vertex);
+        header.vertex_count = static_cast<uint32_t>(geometry.vertices.size());
+        header.index_count = static_cast<uint32_t>(geometry.indices.size());
+
+        // Geometry without levels is written as a single level covering all indices
+        std::vector<MeshLod> lods = geometry.lods;
+        if (lods.empty()) {
+            lods.push_back(MeshLod{ 0, header.index_count, 0.0f });
+        }
+        header.lod_count = static_cast<uint32_t>(lods.size());
+
+        glm::vec3 bounds_min, bounds_max;
+        ComputeBounds(geometry.vertices.data(), header.vertex_count, bounds_min, bounds_max);
+        for (int i = 0; i < 3; i++) {
+            header.bounds_min[i] = bounds_min[i];
+            header.bounds_max[i] = bounds_max[i];
+        }
+
+        // Keep both arrays 16 byte aligned so they can be copied with wide loads
+        uint64_t vertices_size = sizeof(Vertex) * static_cast<uint64_t>(header.vertex_count);
+        header.vertex_offset = AlignUp(sizeof(MeshCacheHeader), 16);
+        header.index_offset = AlignUp(header.vertex_offset + vertices_size, 16);
+        uint64_t indices_size = sizeof(uint32_t) * static_cast<uint64_t>(header.index_count);
+        header.lod_offset = AlignUp(header.index_offset + indices_size, 16);
+
+        std::string temp_path = cache_path + ".tmp";
+        {
+            std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+            if (!file.is_open()) {
+                LOG << "FAILURE\t Couldn't open " << temp_path << " for writing";
+                return false;
+            }
+
+            const char zeros[16]{};
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(zeros, header.vertex_offset - sizeof(header));
+            file.write(reinterpret_cast<const char*>(geometry.vertices.data()), vertices_size);
+            file.write(zeros, header.index_offset - (header.vertex_offset + vertices_size));
+            file.write(reinterpret_cast<const char*>(geometry.indices.data()), indices_size);
+            file.write(zeros, header.lod_offset - (header.index_offset + indices_size));
+            file.write(reinterpret_cast<const char*>(lods.data()), sizeof(MeshLod) * static_cast<uint64_t>(header.lod_count));
+
+            if (!file.good()) {
+                LOG << "FAILURE\t Writing mesh cache " << temp_path << " failed";
+                file.close();
+                std::error_code remove_error;
+                fs::remove(temp_path, remove_error);
+                return false;
+            }
+        }
+
+        std::error_code error;
+        fs::rename(temp_path, cache_path, error);
+        if (error) {
+            LOG << "FAILURE\t Couldn't move mesh cache to " << cache_path << ": " << error.message();
+            fs::remove(temp_path, error);
+            return false;
+        }
+
+        LOG << "SUCCESS\t Wrote mesh cache " << cache_path;
+        return true;
+    }
+
+    bool OpenMeshCache(const std::string& cache_path, const std::string& source_path, MappedMesh& mesh, uint32_t flags) {
+        if (!mesh.file.Open(cache_path)) {
+            return false;
+        }
+
+        const uint8_t* data = mesh.file.Data();
+        size_t size = mesh.file.Size();
+        if (size < sizeof(MeshCacheHeader)) {
+            LOG << "WARNING\t Mesh cache " << cache_path << " is truncated, rebuilding";
+            mesh.file.Close();
+            return false;
+        }
+
+        const MeshCacheHeader* header = reinterpret_cast<const MeshCacheHeader*>(data);
+        uint64_t source_hash = 0;
+        bool source_found = HashSource(source_path, source_hash);
+        // Without the source the cache is the only copy of the mesh, so it's used as is
+        bool stale = source_found && header->source_hash != source_hash;
+        if (header->magic != MESH_CACHE_MAGIC || header->version != MESH_CACHE_VERSION || header->vertex_stride != sizeof(Vertex) || header->flags != flags || stale) {
+            LOG << "WARNING\t Mesh cache " << cache_path << " is out of date, rebuilding";
+            mesh.file.Close();
+            return false;
+        }
+
+        uint64_t vertices_end = header->vertex_offset + sizeof(Vertex) * static_cast<uint64_t>(header->vertex_count);
+        uint64_t indices_end = header->index_offset + sizeof(uint32_t) * static_cast<uint64_t>(header->index_count);
+        uint64_t lods_end = header->lod_offset + sizeof(MeshLod) * static_cast<uint64_t>(header->lod_count);
+        bool offsets_valid = header->vertex_offset <= size && header->index_offset <= size && header->lod_offset <= size;
+        if (!offsets_valid || vertices_end > size || indices_end > size || lods_end > size || header->lod_count == 0) {
+            LOG << "WARNING\t Mesh cache " << cache_path << " is truncated, rebuilding";
+            mesh.file.Close();
+            return false;
+        }
+
+        // The ranges go straight to the GPU, a damaged file must not turn into reads past the end of the buffers
+        const uint32_t* indices = reinterpret_cast<const uint32_t*>(data + header->index_offset);
+        const MeshLod* lods = reinterpret_cast<const MeshLod*>(data + header->lod_offset);
+        bool damaged = false;
+        for (uint32_t i = 0; i < header->lod_count && !damaged; i++) {
+            damaged = static_cast<uint64_t>(lods[i].first_index) + lods[i].index_count > header->index_count;
+        }
+        for (uint32_t i = 0; i < header->index_count && !damaged; i++) {
+            damaged = indices[i] >= header->vertex_count;
+        }
+        if (damaged) {
+            LOG << "WARNING\t Mesh cache " << cache_path << " is damaged, rebuilding";
+            mesh.file.Close();
+            return false;
+        }
+
+        mesh.header = header;
+        mesh.vertices = reinterpret_cast<const Vertex*>(data + header->vertex_offset);
+        mesh.indices = indices;
+        mesh.lods = lods;
+        return true;
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+
+#include "geometry-helpers.h"
+#include "mapped_file.h"
+
+namespace backpack {
+
+    const uint32_t MESH_CACHE_MAGIC = 0x484D5042; // "BPMH"
+    // Bump when the layout of the file or of Vertex changes
+    const uint32_t MESH_CACHE_VERSION = 4;
+    const char* const MESH_CACHE_EXTENSION = ".bpmesh";
+
+    // Set when the indices and vertices went through OptimizeMesh
+    const uint32_t MESH_CACHE_FLAG_OPTIMIZED = 1 << 0;
+    // Bits 8 to 15 hold the number of levels of detail that were requested
+    const uint32_t MESH_CACHE_LOD_SHIFT = 8;
+
+    /*
+    * Header at the start of a .bpmesh file, followed by the interleaved vertices, the indices of all levels and the level table.
+    * source_hash covers the size and write time of the OBJ, so the cache is rebuilt when the OBJ changes.
+    */
+    struct MeshCacheHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t source_hash;
+        uint32_t vertex_stride;
+        uint32_t vertex_count;
+        uint32_t index_count;
+        uint32_t flags;
+        uint32_t lod_count;
+        float bounds_min[3];
+        float bounds_max[3];
+        // From the start of the file
+        uint64_t vertex_offset;
+        uint64_t index_offset;
+        uint64_t lod_offset;
+    };
+
+    // Mesh data pointing straight into a mapped cache file, valid while the mesh is alive
+    struct MappedMesh {
+        MappedFile file;
+        const MeshCacheHeader* header = nullptr;
+        const Vertex* vertices = nullptr;
+        const uint32_t* indices = nullptr;
+        const MeshLod* lods = nullptr;
+    };
+
+    std::string GetMeshCachePath(const std::string& source_path);
+
+    // Writes to a temporary file first so an interrupted write never leaves a broken cache behind
+    bool WriteMeshCache(const std::string& cache_path, const std::string& source_path, const MeshGeometry& geometry, uint32_t flags = 0);
+
+    // Returns false when the cache is missing, truncated, damaged or was built from a different source, version or with different flags.
+    // Damaged means a level or an index points outside of the index or vertex arrays
+    bool OpenMeshCache(const std::string& cache_path, const std::string& source_path, MappedMesh& mesh, uint32_t flags = 0);
+
+    void ComputeBounds(const Vertex* vertices, uint32_t vertex_count, glm::vec3& bounds_min, glm::vec3& bounds_max);
+}
@@ -0,0 +1,314 @@
+#include "mesh_optimizer.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+
+namespace {
+    // Triangles using each vertex, stored as one flat array with offsets
+    struct TriangleAdjacency {
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> triangles;
+    };
+
+    TriangleAdjacency BuildAdjacency(const std::vector<uint32_t>& indices, uint32_t vertex_count) {
+        TriangleAdjacency adjacency;
+        adjacency.offsets.assign(vertex_count + 1, 0);
+        for (uint32_t index : indices) {
+            adjacency.offsets[index + 1]++;
+        }
+        std::partial_sum(adjacency.offsets.begin(), adjacency.offsets.end(), adjacency.offsets.begin());
+
+        std::vector<uint32_t> fill(adjacency.offsets.begin(), adjacency.offsets.end() - 1);
+        adjacency.triangles.resize(indices.size());
+        for (size_t i = 0; i < indices.size(); i++) {
+            adjacency.triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+
+        return adjacency;
+    }
+
+    // Misses of a FIFO cache over a range of triangles, the cache starts empty
+    uint32_t CountCacheMisses(const uint32_t* indices, size_t index_count, uint32_t vertex_count, uint32_t cache_size, std::vector<uint32_t>& timestamps, uint32_t& time) {
+        uint32_t misses = 0;
+        // Starting far enough ahead empties the cache without clearing the timestamps
+        time += cache_size + 1;
+        for (size_t i = 0; i < index_count; i++) {
+            uint32_t vertex = indices[i];
+            if (time - timestamps[vertex] > cache_size) {
+                timestamps[vertex] = time++;
+                misses++;
+            }
+        }
+        return misses;
+    }
+}
+
+namespace backpack {
+
+    VertexCacheStatistics AnalyzeVertexCache(const std::vector<uint32_t>& indices, uint32_t vertex_count, uint32_t cache_size) {
+        VertexCacheStatistics stats;
+        if (indices.empty()) {
+            return stats;
+        }
+
+        std::vector<uint32_t> timestamps(vertex_count, 0);
+        uint32_t time = 0;
+        uint32_t misses = CountCacheMisses(indices.data(), indices.size(), vertex_count, cache_size, timestamps, time);
+
+        std::vector<bool> used(vertex_count, false);
+        uint32_t unique_vertices = 0;
+        for (uint32_t index : indices) {
+            if (!used[index]) {
+                used[index] = true;
+                unique_vertices++;
+            }
+        }
+
+        stats.acmr = static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+        stats.atvr = static_cast<float>(misses) / static_cast<float>(unique_vertices);
+        return stats;
+    }
+
+    void OptimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertex_count, std::vector<uint32_t>& clusters, uint32_t cache_size) {
+        clusters.clear();
+        size_t triangle_count = indices.size() / 3;
+        if (triangle_count == 0) {
+            return;
+        }
+
+        TriangleAdjacency adjacency = BuildAdjacency(indices, vertex_count);
+
+        // Triangles that still have to be emitted per vertex
+        std::vector<uint32_t> live_triangles(vertex_count);
+        for (uint32_t v = 0; v < vertex_count; v++) {
+            live_triangles[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+        }
+
+        std::vector<uint32_t> cache_timestamps(vertex_count, 0);
+        std::vector<bool> emitted(triangle_count, false);
+        std::vector<uint32_t> dead_end;
+        dead_end.reserve(indices.size());
+        std::vector<uint32_t> candidates;
+
+        std::vector<uint32_t> result;
+        result.reserve(indices.size());
+
+        uint32_t time = cache_size + 1;
+        uint32_t cursor = 0;
+        int64_t fanning_vertex = indices[0];
+        clusters.push_back(0);
+
+        while (fanning_vertex >= 0) {
+            uint32_t fan = static_cast<uint32_t>(fanning_vertex);
+            candidates.clear();
+
+            // Emit every triangle around the fanning vertex
+            for (uint32_t a = adjacency.offsets[fan]; a < adjacency.offsets[fan + 1]; a++) {
+                uint32_t triangle = adjacency.triangles[a];
+                if (emitted[triangle]) {
+                    continue;
+                }
+                emitted[triangle] = true;
+
+                for (uint32_t corner = 0; corner < 3; corner++) {
+                    uint32_t vertex = indices[triangle * 3 + corner];
+                    result.push_back(vertex);
+                    dead_end.push_back(vertex);
+                    candidates.push_back(vertex);
+                    live_triangles[vertex]--;
+
+                    if (time - cache_timestamps[vertex] > cache_size) {
+                        cache_timestamps[vertex] = time++;
+                    }
+                }
+            }
+
+            // Next fan is the candidate that is still in cache and will stay there while its remaining triangles are emitted
+            int64_t best = -1;
+            int64_t best_priority = -1;
+            for (uint32_t vertex : candidates) {
+                if (live_triangles[vertex] == 0) {
+                    continue;
+                }
+
+                int64_t priority = 0;
+                uint32_t age = time - cache_timestamps[vertex];
+                if (age + 2 * live_triangles[vertex] <= cache_size) {
+                    priority = age;
+                }
+                if (priority > best_priority) {
+                    best = vertex;
+                    best_priority = priority;
+                }
+            }
+
+            if (best >= 0) {
+                fanning_vertex = best;
+                continue;
+            }
+
+            // Dead end, try the most recently used vertices first and then whatever is left in input order
+            while (!dead_end.empty() && best < 0) {
+                uint32_t vertex = dead_end.back();
+                dead_end.pop_back();
+                if (live_triangles[vertex] > 0) {
+                    best = vertex;
+                }
+            }
+            while (best < 0 && cursor < vertex_count) {
+                if (live_triangles[cursor] > 0) {
+                    best = cursor;
+                }
+                cursor++;
+            }
+
+            fanning_vertex = best;
+            if (best >= 0) {
+                clusters.push_back(static_cast<uint32_t>(result.size() / 3));
+            }
+        }
+
+        indices.swap(result);
+    }
+
+    void OptimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& clusters, float threshold, uint32_t cache_size) {
+        size_t triangle_count = indices.size() / 3;
+        if (triangle_count == 0 || clusters.empty()) {
+            return;
+        }
+
+        uint32_t vertex_count = static_cast<uint32_t>(vertices.size());
+        std::vector<uint32_t> timestamps(vertex_count, 0);
+        uint32_t time = 0;
+
+        // Split hard clusters at every point where the prefix is already about as cache efficient as the whole cluster
+        std::vector<uint32_t> soft_clusters;
+        for (size_t c = 0; c < clusters.size(); c++) {
+            uint32_t begin = clusters[c];
+            uint32_t end = c + 1 < clusters.size() ? clusters[c + 1] : static_cast<uint32_t>(triangle_count);
+
+            uint32_t cluster_misses = CountCacheMisses(&indices[begin * 3], (end - begin) * 3, vertex_count, cache_size, timestamps, time);
+            float cluster_acmr = static_cast<float>(cluster_misses) / static_cast<float>(end - begin);
+
+            soft_clusters.push_back(begin);
+            time += cache_size + 1;
+            uint32_t misses = 0;
+            uint32_t start = begin;
+            for (uint32_t triangle = begin; triangle < end; triangle++) {
+                for (uint32_t corner = 0; corner < 3; corner++) {
+                    uint32_t vertex = indices[triangle * 3 + corner];
+                    if (time - timestamps[vertex] > cache_size) {
+                        timestamps[vertex] = time++;
+                        misses++;
+                    }
+                }
+
+                float prefix_acmr = static_cast<float>(misses) / static_cast<float>(triangle + 1 - start);
+                if (triangle + 1 < end && prefix_acmr <= cluster_acmr * threshold) {
+                    // Restarting the cache is what a new cluster costs, the prefix can afford it
+                    soft_clusters.push_back(triangle + 1);
+                    start = triangle + 1;
+                    misses = 0;
+                    time += cache_size + 1;
+                }
+            }
+        }
+
+        // Area weighted centroid of the whole mesh
+        glm::vec3 mesh_centroid{ 0.0f };
+        float mesh_area = 0.0f;
+        for (size_t t = 0; t < triangle_count; t++) {
+            const glm::vec3& p0 = vertices[indices[t * 3 + 0]].position;
+            const glm::vec3& p1 = vertices[indices[t * 3 + 1]].position;
+            const glm::vec3& p2 = vertices[indices[t * 3 + 2]].position;
+            float area = glm::length(glm::cross(p1 - p0, p2 - p0));
+            mesh_centroid += (p0 + p1 + p2) * (area / 3.0f);
+            mesh_area += area;
+        }
+        mesh_centroid = mesh_area > 0.0f ? mesh_centroid / mesh_area : glm::vec3{ 0.0f };
+
+        // Clusters that face away from the center are the outer surface, drawing them first lets depth testing reject the inside
+        struct ClusterSortKey {
+            float key;
+            uint32_t cluster;
+        };
+        std::vector<ClusterSortKey> sort_keys(soft_clusters.size());
+        for (size_t c = 0; c < soft_clusters.size(); c++) {
+            uint32_t begin = soft_clusters[c];
+            uint32_t end = c + 1 < soft_clusters.size() ? soft_clusters[c + 1] : static_cast<uint32_t>(triangle_count);
+
+            glm::vec3 centroid{ 0.0f };
+            glm::vec3 normal{ 0.0f };
+            float area_sum = 0.0f;
+            for (uint32_t t = begin; t < end; t++) {
+                const glm::vec3& p0 = vertices[indices[t * 3 + 0]].position;
+                const glm::vec3& p1 = vertices[indices[t * 3 + 1]].position;
+                const glm::vec3& p2 = vertices[indices[t * 3 + 2]].position;
+                glm::vec3 face_normal = glm::cross(p1 - p0, p2 - p0);
+                float area = glm::length(face_normal);
+                centroid += (p0 + p1 + p2) * (area / 3.0f);
+                normal += face_normal;
+                area_sum += area;
+            }
+
+            centroid = area_sum > 0.0f ? centroid / area_sum : centroid;
+            float normal_length = glm::length(normal);
+            normal = normal_length > 0.0f ? normal / normal_length : normal;
+            sort_keys[c] = { glm::dot(centroid - mesh_centroid, normal), static_cast<uint32_t>(c) };
+        }
+
+        std::stable_sort(sort_keys.begin(), sort_keys.end(), [](const ClusterSortKey& a, const ClusterSortKey& b) {
+            return a.key > b.key;
+        });
+
+        std::vector<uint32_t> result;
+        result.reserve(indices.size());
+        for (const ClusterSortKey& sort_key : sort_keys) {
+            uint32_t begin = soft_clusters[sort_key.cluster];
+            uint32_t end = sort_key.cluster + 1 < soft_clusters.size() ? soft_clusters[sort_key.cluster + 1] : static_cast<uint32_t>(triangle_count);
+            result.insert(result.end(), indices.begin() + begin * 3, indices.begin() + end * 3);
+        }
+
+        indices.swap(result);
+    }
+
+    void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+        const uint32_t UNUSED = UINT32_MAX;
+        std::vector<uint32_t> remap(vertices.size(), UNUSED);
+        std::vector<Vertex> result;
+        result.reserve(vertices.size());
+
+        for (uint32_t& index : indices) {
+            if (remap[index] == UNUSED) {
+                remap[index] = static_cast<uint32_t>(result.size());
+                result.push_back(vertices[index]);
+            }
+            index = remap[index];
+        }
+
+        vertices.swap(result);
+    }
+
+    void OptimizeMesh(MeshGeometry& geometry, const std::string& name) {
+        auto start_time = std::chrono::high_resolution_clock::now();
+        uint32_t vertex_count = static_cast<uint32_t>(geometry.vertices.size());
+        VertexCacheStatistics before = AnalyzeVertexCache(geometry.indices, vertex_count);
+
+        std::vector<uint32_t> clusters;
+        OptimizeVertexCache(geometry.indices, vertex_count, clusters);
+        VertexCacheStatistics after_cache = AnalyzeVertexCache(geometry.indices, vertex_count);
+
+        OptimizeOverdraw(geometry.indices, geometry.vertices, clusters);
+        VertexCacheStatistics after_overdraw = AnalyzeVertexCache(geometry.indices, vertex_count);
+
+        // Fetch order doesn't change which vertices hit the cache, only where they are in memory
+        OptimizeVertexFetch(geometry.vertices, geometry.indices);
+
+        auto end_time = std::chrono::high_resolution_clock::now();
+        LOG << "Optimized " << name << " in " << std::chrono::duration<double, std::chrono::milliseconds::period>(end_time - start_time).count() << "ms: "
+            << "ACMR " << before.acmr << " -> " << after_cache.acmr << " (cache) -> " << after_overdraw.acmr << " (overdraw), "
+            << "ATVR " << before.atvr << " -> " << after_cache.atvr << " -> " << after_overdraw.atvr << ", " << clusters.size() << " clusters";
+    }
+}
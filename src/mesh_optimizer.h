@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+
+#include "geometry-helpers.h"
+
+namespace backpack {
+
+    // Cache size the optimizations and the report assume, close to the post-transform cache of current GPUs
+    const uint32_t VERTEX_CACHE_SIZE = 16;
+
+    struct VertexCacheStatistics {
+        // Average cache miss ratio, transformed vertices per triangle. 0.5 is the optimum for large grids, 3 the worst case
+        float acmr = 0.0f;
+        // Average transform to vertex ratio, transformed vertices per unique vertex. 1 is the optimum
+        float atvr = 0.0f;
+    };
+
+    // Simulates a FIFO post-transform cache over the index buffer
+    VertexCacheStatistics AnalyzeVertexCache(const std::vector<uint32_t>& indices, uint32_t vertex_count, uint32_t cache_size = VERTEX_CACHE_SIZE);
+
+    /*
+    * Reorders triangles for the post-transform vertex cache with Tipsify (Sander et al. 2007).
+    * clusters receives the first triangle of every run that had to restart from a dead end, these are the hard boundaries for OptimizeOverdraw.
+    */
+    void OptimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertex_count, std::vector<uint32_t>& clusters, uint32_t cache_size = VERTEX_CACHE_SIZE);
+
+    /*
+    * Splits the Tipsify clusters further where the cache efficiency allows it, then draws outward facing clusters first
+    * so they occlude the rest. threshold is how much worse than Tipsify the ACMR may get, 1.05 allows 5%.
+    */
+    void OptimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& clusters, float threshold = 1.05f, uint32_t cache_size = VERTEX_CACHE_SIZE);
+
+    // Orders vertices by first use so vertex fetches walk through memory, drops vertices no triangle references
+    void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+    // Runs the cache, overdraw and fetch optimizations in order and logs the ACMR and ATVR before and after
+    void OptimizeMesh(MeshGeometry& geometry, const std::string& name);
+}
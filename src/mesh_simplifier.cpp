@@ -0,0 +1,324 @@
+#include "mesh_simplifier.h"
+#include "mesh_optimizer.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+
+namespace {
+    // Sum of squared distances to the planes of the surrounding triangles, weighted by their area
+    struct Quadric {
+        double a2 = 0.0, b2 = 0.0, c2 = 0.0;
+        double ab = 0.0, ac = 0.0, bc = 0.0;
+        double ad = 0.0, bd = 0.0, cd = 0.0;
+        double d2 = 0.0;
+        double weight = 0.0;
+    };
+
+    void AddPlane(Quadric& quadric, const glm::dvec3& normal, double distance, double weight) {
+        quadric.a2 += weight * normal.x * normal.x;
+        quadric.b2 += weight * normal.y * normal.y;
+        quadric.c2 += weight * normal.z * normal.z;
+        quadric.ab += weight * normal.x * normal.y;
+        quadric.ac += weight * normal.x * normal.z;
+        quadric.bc += weight * normal.y * normal.z;
+        quadric.ad += weight * normal.x * distance;
+        quadric.bd += weight * normal.y * distance;
+        quadric.cd += weight * normal.z * distance;
+        quadric.d2 += weight * distance * distance;
+        quadric.weight += weight;
+    }
+
+    void AddQuadric(Quadric& quadric, const Quadric& other) {
+        quadric.a2 += other.a2;
+        quadric.b2 += other.b2;
+        quadric.c2 += other.c2;
+        quadric.ab += other.ab;
+        quadric.ac += other.ac;
+        quadric.bc += other.bc;
+        quadric.ad += other.ad;
+        quadric.bd += other.bd;
+        quadric.cd += other.cd;
+        quadric.d2 += other.d2;
+        quadric.weight += other.weight;
+    }
+
+    // Area weighted mean of the squared plane distances
+    double EvaluateQuadric(const Quadric& quadric, const glm::vec3& position) {
+        if (quadric.weight <= 0.0) {
+            return 0.0;
+        }
+
+        double x = position.x, y = position.y, z = position.z;
+        double error = quadric.a2 * x * x + quadric.b2 * y * y + quadric.c2 * z * z
+            + 2.0 * (quadric.ab * x * y + quadric.ac * x * z + quadric.bc * y * z)
+            + 2.0 * (quadric.ad * x + quadric.bd * y + quadric.cd * z)
+            + quadric.d2;
+        return std::max(error, 0.0) / quadric.weight;
+    }
+
+    struct Collapse {
+        uint32_t from;
+        uint32_t to;
+        float error;
+    };
+
+    /*
+    * Vertices that may not move. Several vertices at one position are a seam between attributes, moving one of them tears the mesh open.
+    * Edges used by one triangle are the border of the mesh, edges used by more than two are non manifold, both keep their shape.
+    */
+    std::vector<uint8_t> FindLockedVertices(const std::vector<backpack::Vertex>& vertices, const std::vector<uint32_t>& indices) {
+        uint32_t vertex_count = static_cast<uint32_t>(vertices.size());
+        std::vector<uint8_t> locked(vertex_count, 0);
+
+        // Vertices sorted by position put the ones sharing a position next to each other
+        std::vector<uint32_t> order(vertex_count);
+        std::iota(order.begin(), order.end(), 0);
+        auto position_less = [&vertices](uint32_t a, uint32_t b) {
+            const glm::vec3& pa = vertices[a].position;
+            const glm::vec3& pb = vertices[b].position;
+            if (pa.x != pb.x) return pa.x < pb.x;
+            if (pa.y != pb.y) return pa.y < pb.y;
+            return pa.z < pb.z;
+        };
+        std::sort(order.begin(), order.end(), position_less);
+
+        // Edges are compared by position, otherwise every seam edge would look like a border
+        std::vector<uint32_t> position_id(vertex_count, 0);
+        for (uint32_t i = 0, first = 0; i < vertex_count; i++) {
+            if (i > 0 && position_less(order[i - 1], order[i])) {
+                first = i;
+            }
+            position_id[order[i]] = order[first];
+            if (first != i) {
+                locked[order[first]] = 1;
+                locked[order[i]] = 1;
+            }
+        }
+
+        std::vector<uint64_t> edges;
+        edges.reserve(indices.size());
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            for (int e = 0; e < 3; e++) {
+                uint32_t a = position_id[indices[i + e]];
+                uint32_t b = position_id[indices[i + (e + 1) % 3]];
+                edges.push_back(static_cast<uint64_t>(std::min(a, b)) << 32 | std::max(a, b));
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+
+        for (size_t i = 0; i < edges.size();) {
+            size_t run = i + 1;
+            while (run < edges.size() && edges[run] == edges[i]) {
+                run++;
+            }
+            if (run - i != 2) {
+                locked[static_cast<uint32_t>(edges[i] >> 32)] = 1;
+                locked[static_cast<uint32_t>(edges[i])] = 1;
+            }
+            i = run;
+        }
+
+        // Locks on the first vertex of a position apply to all vertices at that position
+        for (uint32_t i = 0; i < vertex_count; i++) {
+            locked[i] |= locked[position_id[i]];
+        }
+
+        return locked;
+    }
+
+    // Collapsing from onto to must not turn any remaining triangle around from upside down
+    bool CollapseFlipsTriangle(const std::vector<backpack::Vertex>& vertices, const std::vector<uint32_t>& indices, const std::vector<uint32_t>& offsets, const std::vector<uint32_t>& triangles, uint32_t from, uint32_t to) {
+        const glm::vec3& target = vertices[to].position;
+        for (uint32_t i = offsets[from]; i < offsets[from + 1]; i++) {
+            const uint32_t* triangle = &indices[triangles[i] * 3];
+            if (triangle[0] == to || triangle[1] == to || triangle[2] == to) {
+                // Degenerates and is removed
+                continue;
+            }
+
+            glm::vec3 p0 = vertices[triangle[0]].position;
+            glm::vec3 p1 = vertices[triangle[1]].position;
+            glm::vec3 p2 = vertices[triangle[2]].position;
+            glm::vec3 normal_before = glm::cross(p1 - p0, p2 - p0);
+
+            if (triangle[0] == from) p0 = target;
+            if (triangle[1] == from) p1 = target;
+            if (triangle[2] == from) p2 = target;
+            glm::vec3 normal_after = glm::cross(p1 - p0, p2 - p0);
+
+            if (glm::dot(normal_before, normal_after) <= 0.0f) {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+namespace backpack {
+
+    std::vector<uint32_t> SimplifyMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, uint32_t target_index_count, float max_error, float& result_error) {
+        result_error = 0.0f;
+        std::vector<uint32_t> result = indices;
+        uint32_t vertex_count = static_cast<uint32_t>(vertices.size());
+        if (result.size() <= target_index_count || vertex_count == 0) {
+            return result;
+        }
+
+        glm::vec3 bounds_min{ vertices[result[0]].position }, bounds_max{ bounds_min };
+        for (uint32_t index : result) {
+            bounds_min = glm::min(bounds_min, vertices[index].position);
+            bounds_max = glm::max(bounds_max, vertices[index].position);
+        }
+        double error_limit = max_error * glm::length(bounds_max - bounds_min);
+        double squared_error_limit = error_limit * error_limit;
+
+        std::vector<uint8_t> locked = FindLockedVertices(vertices, result);
+
+        std::vector<Quadric> quadrics(vertex_count);
+        for (size_t i = 0; i < result.size(); i += 3) {
+            glm::dvec3 p0{ vertices[result[i]].position };
+            glm::dvec3 p1{ vertices[result[i + 1]].position };
+            glm::dvec3 p2{ vertices[result[i + 2]].position };
+            glm::dvec3 cross = glm::cross(p1 - p0, p2 - p0);
+            double length = glm::length(cross);
+            if (length == 0.0) {
+                continue;
+            }
+
+            glm::dvec3 normal = cross / length;
+            double distance = -glm::dot(normal, p0);
+            // Twice the area, the factor cancels out in the weighted mean
+            for (int corner = 0; corner < 3; corner++) {
+                AddPlane(quadrics[result[i + corner]], normal, distance, length);
+            }
+        }
+
+        std::vector<uint32_t> remap(vertex_count);
+        std::iota(remap.begin(), remap.end(), 0);
+        std::vector<uint8_t> touched(vertex_count, 0);
+        std::vector<uint32_t> offsets, triangles;
+        std::vector<Collapse> collapses;
+        double largest_error = 0.0;
+        uint32_t target_triangle_count = target_index_count / 3;
+
+        // Every pass collapses the cheapest edges that don't share triangles, then rebuilds the index buffer
+        while (result.size() > target_index_count) {
+            uint32_t triangle_count = static_cast<uint32_t>(result.size() / 3);
+
+            offsets.assign(vertex_count + 1, 0);
+            for (uint32_t index : result) {
+                offsets[index + 1]++;
+            }
+            std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+            std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+            triangles.resize(result.size());
+            for (size_t i = 0; i < result.size(); i++) {
+                triangles[fill[result[i]]++] = static_cast<uint32_t>(i / 3);
+            }
+
+            collapses.clear();
+            for (size_t i = 0; i < result.size(); i += 3) {
+                for (int e = 0; e < 3; e++) {
+                    uint32_t a = result[i + e];
+                    uint32_t b = result[i + (e + 1) % 3];
+                    if (!locked[a]) {
+                        collapses.push_back(Collapse{ a, b, static_cast<float>(EvaluateQuadric(quadrics[a], vertices[b].position)) });
+                    }
+                    if (!locked[b]) {
+                        collapses.push_back(Collapse{ b, a, static_cast<float>(EvaluateQuadric(quadrics[b], vertices[a].position)) });
+                    }
+                }
+            }
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+            // A collapse removes about two triangles, so this lands close to the target instead of far below it
+            uint32_t collapse_goal = (triangle_count - target_triangle_count) / 2 + 1;
+            uint32_t collapsed = 0;
+            for (const Collapse& collapse : collapses) {
+                if (collapse.error > squared_error_limit || collapsed >= collapse_goal) {
+                    break;
+                }
+                // Triangles around a vertex that was touched this pass changed, so their flip test would be stale
+                if (touched[collapse.from] || remap[collapse.to] != collapse.to) {
+                    continue;
+                }
+                if (CollapseFlipsTriangle(vertices, result, offsets, triangles, collapse.from, collapse.to)) {
+                    continue;
+                }
+
+                remap[collapse.from] = collapse.to;
+                AddQuadric(quadrics[collapse.to], quadrics[collapse.from]);
+                largest_error = std::max(largest_error, static_cast<double>(collapse.error));
+                collapsed++;
+
+                touched[collapse.to] = 1;
+                for (uint32_t i = offsets[collapse.from]; i < offsets[collapse.from + 1]; i++) {
+                    const uint32_t* triangle = &result[triangles[i] * 3];
+                    touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = 1;
+                }
+            }
+
+            if (collapsed == 0) {
+                break;
+            }
+
+            size_t write = 0;
+            for (size_t i = 0; i < result.size(); i += 3) {
+                uint32_t a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+                if (a != b && b != c && a != c) {
+                    result[write++] = a;
+                    result[write++] = b;
+                    result[write++] = c;
+                }
+            }
+            result.resize(write);
+
+            std::iota(remap.begin(), remap.end(), 0);
+            std::fill(touched.begin(), touched.end(), 0);
+        }
+
+        result_error = static_cast<float>(std::sqrt(largest_error));
+        return result;
+    }
+
+    void GenerateMeshLods(MeshGeometry& geometry, uint32_t lod_count, const std::string& name) {
+        auto start_time = std::chrono::high_resolution_clock::now();
+        uint32_t vertex_count = static_cast<uint32_t>(geometry.vertices.size());
+
+        geometry.lods.clear();
+        geometry.lods.push_back(MeshLod{ 0, static_cast<uint32_t>(geometry.indices.size()), 0.0f });
+
+        // Every level is simplified from the one before, which is cheaper than starting from the full mesh each time
+        std::vector<uint32_t> previous = geometry.indices;
+        float error = 0.0f;
+        for (uint32_t level = 1; level < lod_count && level < MAX_MESH_LODS; level++) {
+            uint32_t target_index_count = static_cast<uint32_t>(previous.size() / 6 * 3);
+            float level_error = 0.0f;
+            std::vector<uint32_t> lod = SimplifyMesh(geometry.vertices, previous, target_index_count, MESH_LOD_MAX_ERROR, level_error);
+
+            // A level that barely shrinks costs memory without saving vertex work
+            if (lod.empty() || lod.size() > previous.size() * 9 / 10) {
+                break;
+            }
+
+            std::vector<uint32_t> clusters;
+            OptimizeVertexCache(lod, vertex_count, clusters);
+
+            // Errors of the levels add up, each one is measured against the level it was simplified from
+            error += level_error;
+            geometry.lods.push_back(MeshLod{ static_cast<uint32_t>(geometry.indices.size()), static_cast<uint32_t>(lod.size()), error });
+            geometry.indices.insert(geometry.indices.end(), lod.begin(), lod.end());
+            previous = std::move(lod);
+        }
+
+        auto end_time = std::chrono::high_resolution_clock::now();
+        LOG << "Generated " << geometry.lods.size() << " levels of detail for " << name << " in "
+            << std::chrono::duration<double, std::chrono::milliseconds::period>(end_time - start_time).count() << "ms";
+        for (size_t i = 0; i < geometry.lods.size(); i++) {
+            LOG << "\t LOD " << i << ": " << geometry.lods[i].index_count / 3 << " triangles, error " << geometry.lods[i].error;
+        }
+    }
+}
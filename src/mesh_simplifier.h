@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "geometry-helpers.h"
+
+namespace backpack {
+
+    // Largest error a single level may add, relative to the diagonal of the mesh bounds
+    const float MESH_LOD_MAX_ERROR = 0.02f;
+
+    /*
+    * Collapses edges in order of their quadric error (Garland and Heckbert 1997) until the index count reaches the target
+    * or the next collapse would exceed max_error, relative to the diagonal of the mesh bounds.
+    * Vertices only ever collapse onto existing vertices, so the result indexes the same vertex array. Boundary and seam vertices stay in place.
+    * result_error receives the largest error of the collapses, in object space units.
+    */
+    std::vector<uint32_t> SimplifyMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, uint32_t target_index_count, float max_error, float& result_error);
+
+    /*
+    * Appends up to lod_count - 1 simplified levels to the indices, each halving the triangles of the level before.
+    * Stops early when a level can't remove enough triangles within MESH_LOD_MAX_ERROR.
+    */
+    void GenerateMeshLods(MeshGeometry& geometry, uint32_t lod_count, const std::string& name);
+}
@@ -0,0 +1,381 @@
+#include "obj_parser.h"
+#include "logger.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+
+namespace {
+    /*
+    * Negative OBJ indices count back from the last attribute defined so far, which a chunk only knows relative to its own start.
+    * They are stored offset by RELATIVE_BASE and resolved once the attribute counts of the previous chunks are known.
+    */
+    const int32_t RELATIVE_BASE = INT32_MIN / 2;
+    const int32_t RELATIVE_LIMIT = RELATIVE_BASE / 2;
+
+    struct ObjChunk {
+        const char* begin;
+        const char* end;
+        backpack::ObjAttributes attributes;
+        bool has_relative = false;
+        bool valid = true;
+    };
+
+    inline const char* SkipSpaces(const char* p, const char* end) {
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        return p;
+    }
+
+    inline const char* SkipLine(const char* p, const char* end) {
+        while (p < end && *p != '\n') {
+            p++;
+        }
+        return p < end ? p + 1 : end;
+    }
+
+    inline bool ParseFloats(const char*& p, const char* end, float* values, int count) {
+        for (int i = 0; i < count; i++) {
+            p = SkipSpaces(p, end);
+            // from_chars doesn't accept a leading plus
+            if (p < end && *p == '+') {
+                p++;
+            }
+            auto result = std::from_chars(p, end, values[i]);
+            if (result.ec != std::errc()) {
+                return false;
+            }
+            p = result.ptr;
+        }
+        return true;
+    }
+
+    // Converts a 1 based or negative OBJ index, attribute_count is the amount of attributes this chunk defined so far
+    inline int32_t ResolveIndex(int32_t raw, int32_t attribute_count, bool& has_relative) {
+        if (raw > 0) {
+            return raw - 1;
+        }
+        has_relative = true;
+        return RELATIVE_BASE + attribute_count + raw;
+    }
+
+    // Parses v, v/t, v//n or v/t/n
+    inline bool ParseCorner(const char*& p, const char* end, ObjChunk& chunk, backpack::ObjCorner& corner) {
+        backpack::ObjAttributes& attributes = chunk.attributes;
+        int32_t raw = 0;
+
+        auto result = std::from_chars(p, end, raw);
+        if (result.ec != std::errc() || raw == 0) {
+            return false;
+        }
+        p = result.ptr;
+        corner.position = ResolveIndex(raw, static_cast<int32_t>(attributes.positions.size() / 3), chunk.has_relative);
+        corner.texcoord = -1;
+        corner.normal = -1;
+
+        if (p >= end || *p != '/') {
+            return true;
+        }
+        p++;
+
+        if (p < end && *p != '/') {
+            result = std::from_chars(p, end, raw);
+            if (result.ec != std::errc() || raw == 0) {
+                return false;
+            }
+            p = result.ptr;
+            corner.texcoord = ResolveIndex(raw, static_cast<int32_t>(attributes.texcoords.size() / 2), chunk.has_relative);
+        }
+
+        if (p >= end || *p != '/') {
+            return true;
+        }
+        p++;
+
+        result = std::from_chars(p, end, raw);
+        if (result.ec != std::errc() || raw == 0) {
+            return false;
+        }
+        p = result.ptr;
+        corner.normal = ResolveIndex(raw, static_cast<int32_t>(attributes.normals.size() / 3), chunk.has_relative);
+        return true;
+    }
+
+    void ParseChunk(ObjChunk& chunk) {
+        backpack::ObjAttributes& attributes = chunk.attributes;
+        std::vector<backpack::ObjCorner> polygon;
+        polygon.reserve(8);
+
+        const char* p = chunk.begin;
+        const char* end = chunk.end;
+        while (p < end) {
+            p = SkipSpaces(p, end);
+            if (p >= end) {
+                break;
+            }
+
+            char c0 = *p;
+            char c1 = p + 1 < end ? p[1] : '\n';
+            if (c0 == 'v' && (c1 == ' ' || c1 == '\t')) {
+                float position[3];
+                p += 1;
+                if (!ParseFloats(p, end, position, 3)) {
+                    chunk.valid = false;
+                    return;
+                }
+                attributes.positions.insert(attributes.positions.end(), position, position + 3);
+            }
+            else if (c0 == 'v' && c1 == 't') {
+                float texcoord[2];
+                p += 2;
+                if (!ParseFloats(p, end, texcoord, 2)) {
+                    chunk.valid = false;
+                    return;
+                }
+                attributes.texcoords.insert(attributes.texcoords.end(), texcoord, texcoord + 2);
+            }
+            else if (c0 == 'v' && c1 == 'n') {
+                float normal[3];
+                p += 2;
+                if (!ParseFloats(p, end, normal, 3)) {
+                    chunk.valid = false;
+                    return;
+                }
+                attributes.normals.insert(attributes.normals.end(), normal, normal + 3);
+            }
+            else if (c0 == 'f' && (c1 == ' ' || c1 == '\t')) {
+                p += 1;
+                polygon.clear();
+                while (true) {
+                    p = SkipSpaces(p, end);
+                    if (p >= end || *p == '\n' || *p == '\r' || *p == '#') {
+                        break;
+                    }
+
+                    backpack::ObjCorner corner;
+                    if (!ParseCorner(p, end, chunk, corner)) {
+                        chunk.valid = false;
+                        return;
+                    }
+                    polygon.push_back(corner);
+                }
+
+                // Triangulate as a fan, the same way tinyobjloader does
+                for (size_t i = 2; i < polygon.size(); i++) {
+                    attributes.corners.push_back(polygon[0]);
+                    attributes.corners.push_back(polygon[i - 1]);
+                    attributes.corners.push_back(polygon[i]);
+                }
+            }
+
+            // Also skips the rest of attribute lines, like vertex colors or a third texcoord component
+            p = SkipLine(p, end);
+        }
+    }
+
+    inline void ResolveRelative(int32_t& index, int32_t offset) {
+        if (index < RELATIVE_LIMIT) {
+            index = offset + (index - RELATIVE_BASE);
+        }
+    }
+
+    /*
+    * Flat open addressing map from a corner to the welded vertex index.
+    * Keys and values live in one array with linear probing, sized up front so it never rehashes.
+    */
+    class VertexIndexMap {
+        struct Slot {
+            backpack::ObjCorner corner;
+            uint32_t vertex;
+        };
+
+        static const uint32_t EMPTY = UINT32_MAX;
+
+        std::vector<Slot> slots_;
+        size_t mask_ = 0;
+
+        static size_t Hash(const backpack::ObjCorner& corner) {
+            // Mix each component so neighbouring indices don't end up in neighbouring slots
+            uint64_t hash = static_cast<uint32_t>(corner.position) * 0x9E3779B97F4A7C15ull;
+            hash ^= static_cast<uint32_t>(corner.normal) * 0xC2B2AE3D27D4EB4Full;
+            hash ^= static_cast<uint32_t>(corner.texcoord) * 0x165667B19E3779F9ull;
+            hash ^= hash >> 32;
+            return static_cast<size_t>(hash);
+        }
+
+    public:
+        explicit VertexIndexMap(size_t max_entries) {
+            // Keep the load factor at or below 0.5
+            size_t capacity = 16;
+            while (capacity < max_entries * 2) {
+                capacity <<= 1;
+            }
+            slots_.resize(capacity, Slot{ { 0, 0, 0 }, EMPTY });
+            mask_ = capacity - 1;
+        }
+
+        // Returns the stored vertex, or inserts new_vertex and returns it when the corner is new
+        uint32_t FindOrInsert(const backpack::ObjCorner& corner, uint32_t new_vertex) {
+            size_t slot_index = Hash(corner) & mask_;
+            while (true) {
+                Slot& slot = slots_[slot_index];
+                if (slot.vertex == EMPTY) {
+                    slot = Slot{ corner, new_vertex };
+                    return new_vertex;
+                }
+                if (slot.corner.position == corner.position && slot.corner.normal == corner.normal && slot.corner.texcoord == corner.texcoord) {
+                    return slot.vertex;
+                }
+                slot_index = (slot_index + 1) & mask_;
+            }
+        }
+    };
+}
+
+namespace backpack {
+
+    bool ParseObjParallel(const std::string& path, ThreadPool& pool, ObjAttributes& attributes) {
+        MappedFile file;
+        if (!file.Open(path)) {
+            LOG << "FAILURE\t Couldn't open " << path;
+            return false;
+        }
+
+        const char* data = reinterpret_cast<const char*>(file.Data());
+        const char* data_end = data + file.Size();
+
+        // A few chunks per thread so a chunk with many faces doesn't hold up the rest, but not so small that merging dominates
+        const size_t min_chunk_size = 1024 * 1024;
+        size_t chunk_count = std::max<size_t>(1, std::min<size_t>((pool.GetThreadCount() + 1) * 4, file.Size() / min_chunk_size));
+
+        std::vector<ObjChunk> chunks;
+        chunks.reserve(chunk_count);
+        const char* chunk_begin = data;
+        for (size_t i = 1; i <= chunk_count && chunk_begin < data_end; i++) {
+            const char* chunk_end = i == chunk_count ? data_end : SkipLine(data + file.Size() * i / chunk_count, data_end);
+            chunk_end = std::max(chunk_end, chunk_begin);
+            chunks.push_back(ObjChunk{ chunk_begin, chunk_end });
+            chunk_begin = chunk_end;
+        }
+
+        pool.ParallelFor(static_cast<uint32_t>(chunks.size()), [&chunks](uint32_t i) {
+            ParseChunk(chunks[i]);
+        });
+
+        // Offsets of every chunk in the merged arrays, in elements
+        struct ChunkOffsets {
+            size_t positions, normals, texcoords, corners;
+        };
+        std::vector<ChunkOffsets> offsets(chunks.size());
+        ChunkOffsets total{};
+        for (size_t i = 0; i < chunks.size(); i++) {
+            if (!chunks[i].valid) {
+                LOG << "FAILURE\t Couldn't parse " << path << ", malformed line in chunk " << i;
+                return false;
+            }
+
+            offsets[i] = total;
+            total.positions += chunks[i].attributes.positions.size();
+            total.normals += chunks[i].attributes.normals.size();
+            total.texcoords += chunks[i].attributes.texcoords.size();
+            total.corners += chunks[i].attributes.corners.size();
+        }
+
+        attributes.positions.resize(total.positions);
+        attributes.normals.resize(total.normals);
+        attributes.texcoords.resize(total.texcoords);
+        attributes.corners.resize(total.corners);
+
+        // Chunks copy into disjoint ranges, so the merge runs on the pool as well
+        pool.ParallelFor(static_cast<uint32_t>(chunks.size()), [&chunks, &offsets, &attributes](uint32_t i) {
+            ObjAttributes& chunk = chunks[i].attributes;
+            const ChunkOffsets& offset = offsets[i];
+            std::copy(chunk.positions.begin(), chunk.positions.end(), attributes.positions.begin() + offset.positions);
+            std::copy(chunk.normals.begin(), chunk.normals.end(), attributes.normals.begin() + offset.normals);
+            std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), attributes.texcoords.begin() + offset.texcoords);
+
+            ObjCorner* corners = attributes.corners.data() + offset.corners;
+            std::copy(chunk.corners.begin(), chunk.corners.end(), corners);
+            if (chunks[i].has_relative) {
+                for (size_t c = 0; c < chunk.corners.size(); c++) {
+                    ResolveRelative(corners[c].position, static_cast<int32_t>(offset.positions / 3));
+                    ResolveRelative(corners[c].normal, static_cast<int32_t>(offset.normals / 3));
+                    ResolveRelative(corners[c].texcoord, static_cast<int32_t>(offset.texcoords / 2));
+                }
+            }
+
+            chunk = ObjAttributes{};
+        });
+
+        return true;
+    }
+
+    MeshGeometry WeldObjCorners(const ObjAttributes& attributes) {
+        MeshGeometry geometry;
+        size_t corner_count = attributes.corners.size();
+        int32_t position_count = static_cast<int32_t>(attributes.positions.size() / 3);
+        int32_t normal_count = static_cast<int32_t>(attributes.normals.size() / 3);
+        int32_t texcoord_count = static_cast<int32_t>(attributes.texcoords.size() / 2);
+
+        // Reserve for the worst case of no shared vertices
+        geometry.indices.resize(corner_count);
+        geometry.vertices.reserve(corner_count);
+
+        VertexIndexMap vertex_map(corner_count);
+        for (size_t i = 0; i < corner_count; i++) {
+            const ObjCorner& corner = attributes.corners[i];
+            bool in_range = corner.position >= 0 && corner.position < position_count
+                && corner.normal >= -1 && corner.normal < normal_count
+                && corner.texcoord >= -1 && corner.texcoord < texcoord_count;
+            if (!in_range) {
+                LOG << "FAILURE\t OBJ face references an attribute that doesn't exist";
+                return MeshGeometry{};
+            }
+
+            uint32_t next_vertex = static_cast<uint32_t>(geometry.vertices.size());
+            uint32_t vertex_index = vertex_map.FindOrInsert(corner, next_vertex);
+            geometry.indices[i] = vertex_index;
+
+            if (vertex_index != next_vertex) {
+                continue;
+            }
+
+            Vertex& vertex = geometry.vertices.emplace_back();
+            const float* position = &attributes.positions[3 * static_cast<size_t>(corner.position)];
+            vertex.position = { position[0], position[1], position[2] };
+            vertex.color = glm::vec3{ 0.0f };
+
+            vertex.texcoord = glm::vec2{ 0.0f };
+            if (corner.texcoord >= 0) {
+                const float* texcoord = &attributes.texcoords[2 * static_cast<size_t>(corner.texcoord)];
+                vertex.texcoord = { texcoord[0], 1.0f - texcoord[1] };
+            }
+        }
+
+        return geometry;
+    }
+
+    MeshGeometry LoadObjParallel(const std::string& path, ThreadPool& pool) {
+        auto parse_start = std::chrono::high_resolution_clock::now();
+
+        ObjAttributes attributes;
+        if (!ParseObjParallel(path, pool, attributes)) {
+            return MeshGeometry{};
+        }
+
+        auto weld_start = std::chrono::high_resolution_clock::now();
+        MeshGeometry geometry = WeldObjCorners(attributes);
+        auto weld_end = std::chrono::high_resolution_clock::now();
+
+        double parse_ms = std::chrono::duration<double, std::chrono::milliseconds::period>(weld_start - parse_start).count();
+        double weld_ms = std::chrono::duration<double, std::chrono::milliseconds::period>(weld_end - weld_start).count();
+        double ratio = geometry.vertices.empty() ? 0.0 : static_cast<double>(attributes.corners.size()) / geometry.vertices.size();
+        LOG << "Loaded " << path << " on " << pool.GetThreadCount() + 1 << " threads: parsed in " << parse_ms << "ms, welded "
+            << attributes.corners.size() << " corners into " << geometry.vertices.size() << " vertices (" << ratio << "x) in " << weld_ms << "ms";
+
+        return geometry;
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "geometry-helpers.h"
+
+class ThreadPool;
+
+namespace backpack {
+
+    // Corner of a triangle, 0 based indices into the attribute arrays and -1 when the attribute is missing
+    struct ObjCorner {
+        int32_t position;
+        int32_t normal;
+        int32_t texcoord;
+    };
+
+    // Attribute arrays as they appear in the file, faces are triangulated as fans
+    struct ObjAttributes {
+        std::vector<float> positions;
+        std::vector<float> normals;
+        std::vector<float> texcoords;
+        std::vector<ObjCorner> corners;
+    };
+
+    /*
+    * Splits the file in line aligned chunks that are parsed on the pool, then merges the chunks in file order.
+    * Supports v, vt, vn and f with negative indices, everything else is skipped.
+    */
+    bool ParseObjParallel(const std::string& path, ThreadPool& pool, ObjAttributes& attributes);
+
+    // Merges corners with the same position, normal and texcoord into one vertex, normals only take part in the merge until a shader reads them
+    MeshGeometry WeldObjCorners(const ObjAttributes& attributes);
+
+    MeshGeometry LoadObjParallel(const std::string& path, ThreadPool& pool);
+}
@@ -0,0 +1,148 @@
+#include "render_queue.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+BP_RenderQueueStatistics& BP_RenderQueueStatistics::operator+=(const BP_RenderQueueStatistics& other) {
+    draws += other.draws;
+    binds += other.binds;
+    binds_saved += other.binds_saved;
+    return *this;
+}
+
+uint64_t RenderQueue::MakeSortKey(uint32_t pipeline, uint32_t material, uint32_t descriptor_set, uint32_t mesh, float depth) {
+    uint64_t depth_bits = static_cast<uint64_t>(std::min(std::max(depth, 0.0f), 1.0f) * 65535.0f);
+    return (static_cast<uint64_t>(pipeline & 0xFF) << 56)
+        | (static_cast<uint64_t>(material & 0xFFF) << 44)
+        | (static_cast<uint64_t>(descriptor_set & 0xFFF) << 32)
+        | (static_cast<uint64_t>(mesh & 0xFFFF) << 16)
+        | depth_bits;
+}
+
+void RenderQueue::Clear() {
+    items_.clear();
+    sorted_.clear();
+}
+
+void RenderQueue::Push(const BP_RenderItem& item) {
+    sorted_.push_back(SortEntry{ item.key, static_cast<uint32_t>(items_.size()) });
+    items_.push_back(item);
+}
+
+void RenderQueue::Sort() {
+    size_t count = sorted_.size();
+    if (count < 2) {
+        return;
+    }
+
+    scratch_.resize(count);
+    for (uint32_t shift = 0; shift < 64; shift += 8) {
+        std::array<uint32_t, 256> histogram{};
+        for (const SortEntry& entry : sorted_) {
+            histogram[(entry.key >> shift) & 0xFF]++;
+        }
+
+        // Every key has the same digit, the pass wouldn't move anything
+        if (histogram[(sorted_[0].key >> shift) & 0xFF] == count) {
+            continue;
+        }
+
+        uint32_t offset = 0;
+        for (uint32_t& bucket : histogram) {
+            uint32_t bucket_count = bucket;
+            bucket = offset;
+            offset += bucket_count;
+        }
+
+        // Stable, so the order of the lower digits survives
+        for (const SortEntry& entry : sorted_) {
+            scratch_[histogram[(entry.key >> shift) & 0xFF]++] = entry;
+        }
+        sorted_.swap(scratch_);
+    }
+}
+
+uint32_t RenderQueue::GetCount() const {
+    return static_cast<uint32_t>(sorted_.size());
+}
+
+BP_RenderQueueStatistics RenderQueue::Record(VkCommandBuffer cmd_buffer, VkPipelineLayout layout, VkDescriptorSet descriptor_set, const VkExtent2D& extent, uint32_t begin, uint32_t end) const {
+    BP_RenderQueueStatistics statistics{};
+    if (begin >= end) {
+        return statistics;
+    }
+
+    // The viewport and scissor are dynamic in every pipeline, so they survive pipeline changes
+    VkViewport viewport{};
+    viewport.x = 0;
+    viewport.y = 0;
+    viewport.width = static_cast<float>(extent.width);
+    viewport.height = static_cast<float>(extent.height);
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(cmd_buffer, 0, 1, &viewport);
+
+    VkRect2D scissor{};
+    scissor.offset = VkOffset2D{ 0, 0 };
+    scissor.extent = extent;
+    vkCmdSetScissor(cmd_buffer, 0, 1, &scissor);
+
+    // Every draw finds its resources in the same set, so it stays bound across pipelines of the same layout like the push constants
+    vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &descriptor_set, 0, nullptr);
+    statistics.binds += 3;
+
+    VkPipeline bound_pipeline = VK_NULL_HANDLE;
+    VkBuffer bound_vertex_buffers[2]{ VK_NULL_HANDLE, VK_NULL_HANDLE };
+    VkBuffer bound_index_buffer = VK_NULL_HANDLE;
+    VkDeviceSize bound_index_offset = 0;
+    const MeshPushConstants* pushed_constants = nullptr;
+
+    for (uint32_t i = begin; i < end; i++) {
+        const BP_RenderItem& item = items_[sorted_[i].item];
+
+        if (item.pipeline != bound_pipeline) {
+            vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, item.pipeline);
+            bound_pipeline = item.pipeline;
+            statistics.binds++;
+        }
+
+        bool vertex_buffers_bound = true;
+        for (uint32_t binding = 0; binding < item.vertex_buffer_count; binding++) {
+            vertex_buffers_bound = vertex_buffers_bound && bound_vertex_buffers[binding] == item.vertex_buffers[binding];
+        }
+        if (!vertex_buffers_bound) {
+            VkDeviceSize offsets[2]{ 0, 0 };
+            vkCmdBindVertexBuffers(cmd_buffer, 0, item.vertex_buffer_count, item.vertex_buffers, offsets);
+            for (uint32_t binding = 0; binding < item.vertex_buffer_count; binding++) {
+                bound_vertex_buffers[binding] = item.vertex_buffers[binding];
+            }
+            statistics.binds++;
+        }
+
+        if (item.index_buffer != bound_index_buffer || item.index_offset != bound_index_offset) {
+            vkCmdBindIndexBuffer(cmd_buffer, item.index_buffer, item.index_offset, VK_INDEX_TYPE_UINT32);
+            bound_index_buffer = item.index_buffer;
+            bound_index_offset = item.index_offset;
+            statistics.binds++;
+        }
+
+        if (pushed_constants == nullptr || memcmp(pushed_constants, &item.push_constants, sizeof(MeshPushConstants)) != 0) {
+            vkCmdPushConstants(cmd_buffer, layout, RENDER_QUEUE_PUSH_CONSTANT_STAGES, 0, sizeof(MeshPushConstants), &item.push_constants);
+            pushed_constants = &item.push_constants;
+            statistics.binds++;
+        }
+
+        if (item.indirect_buffer != VK_NULL_HANDLE) {
+            vkCmdDrawIndexedIndirectCount(cmd_buffer, item.indirect_buffer, item.indirect_offset, item.count_buffer, item.count_offset,
+                item.max_draw_count, sizeof(VkDrawIndexedIndirectCommand));
+        }
+        else {
+            vkCmdDrawIndexed(cmd_buffer, item.index_count, item.instance_count, item.first_index, 0, item.first_instance);
+        }
+        statistics.draws++;
+    }
+
+    statistics.binds_saved = statistics.draws * RENDER_QUEUE_BINDS_PER_DRAW - statistics.binds;
+    return statistics;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "geometry-helpers.h"
+
+// State commands a draw records when it sets everything itself: pipeline, viewport, scissor, descriptor set, vertex buffers, index buffer and push constants
+const uint32_t RENDER_QUEUE_BINDS_PER_DRAW = 7;
+// Push constants are read by the vertex and fragment stage
+const VkShaderStageFlags RENDER_QUEUE_PUSH_CONSTANT_STAGES = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+// Everything one draw needs, the queue only records the state that differs from the draw before it
+struct BP_RenderItem {
+    uint64_t key;
+    VkPipeline pipeline;
+    // The second buffer is the instance binding of instanced pipelines
+    VkBuffer vertex_buffers[2];
+    uint32_t vertex_buffer_count;
+    VkBuffer index_buffer;
+    VkDeviceSize index_offset;
+    MeshPushConstants push_constants;
+    uint32_t index_count;
+    uint32_t instance_count;
+    uint32_t first_index;
+    uint32_t first_instance;
+    // Drawn with vkCmdDrawIndexedIndirectCount instead when set, the direct parameters are ignored
+    VkBuffer indirect_buffer;
+    VkDeviceSize indirect_offset;
+    VkBuffer count_buffer;
+    VkDeviceSize count_offset;
+    uint32_t max_draw_count;
+};
+
+struct BP_RenderQueueStatistics {
+    uint64_t draws = 0;
+    // State commands recorded, and how many more setting all state for every draw would have recorded
+    uint64_t binds = 0;
+    uint64_t binds_saved = 0;
+
+    BP_RenderQueueStatistics& operator+=(const BP_RenderQueueStatistics& other);
+};
+
+/*
+* Draws of one frame, sorted by a key that puts the most expensive state changes in the highest bits.
+* Draws that share a pipeline, material, descriptor set and mesh end up next to each other, so recording them binds each state once.
+*/
+class RenderQueue {
+public:
+    /*
+    * Pipeline, material and descriptor set are small ids the caller assigns, 8, 12 and 12 bits. The mesh takes 16 bits.
+    * depth in [0, 1] orders the draws of one mesh front to back.
+    */
+    static uint64_t MakeSortKey(uint32_t pipeline, uint32_t material, uint32_t descriptor_set, uint32_t mesh, float depth);
+
+    void Clear();
+    void Push(const BP_RenderItem& item);
+
+    // Least significant digit radix sort on 8 bit digits, digits all keys share are skipped
+    void Sort();
+
+    uint32_t GetCount() const;
+
+    /*
+    * Records the sorted draws [begin, end) into a command buffer that has no state bound yet, descriptor_set is bound once for all of them.
+    * All pipelines must use layout and set the viewport and scissor dynamically. Only reads the queue, so ranges can be recorded from several threads.
+    */
+    BP_RenderQueueStatistics Record(VkCommandBuffer cmd_buffer, VkPipelineLayout layout, VkDescriptorSet descriptor_set, const VkExtent2D& extent, uint32_t begin, uint32_t end) const;
+
+private:
+    struct SortEntry {
+        uint64_t key;
+        uint32_t item;
+    };
+
+    std::vector<BP_RenderItem> items_;
+    std::vector<SortEntry> sorted_;
+    std::vector<SortEntry> scratch_;
+};
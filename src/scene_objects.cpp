@@ -1 +1,121 @@
 #include "scene_objects.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+uint32_t Scene::AddNode(uint32_t parent, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+{
+	uint32_t node = static_cast<uint32_t>(parents_.size());
+	parents_.push_back(parent < node ? parent : SCENE_NO_PARENT);
+	positions_.push_back(position);
+	rotations_.push_back(rotation);
+	scales_.push_back(scale);
+	worlds_.push_back(glm::mat4{ 1.0f });
+	dirty_.push_back(1);
+	world_versions_.push_back(version_);
+	first_dirty_ = std::min(first_dirty_, node);
+	return node;
+}
+
+uint32_t Scene::AddObject(uint32_t node, uint32_t model)
+{
+	object_nodes_.push_back(node);
+	object_models_.push_back(model);
+	// The buffers don't hold the matrix of the new object yet
+	version_++;
+	world_versions_[node] = version_;
+	return static_cast<uint32_t>(object_nodes_.size() - 1);
+}
+
+void Scene::SetPosition(uint32_t node, const glm::vec3& position)
+{
+	positions_[node] = position;
+	dirty_[node] = 1;
+	first_dirty_ = std::min(first_dirty_, node);
+}
+
+void Scene::SetRotation(uint32_t node, const glm::quat& rotation)
+{
+	rotations_[node] = rotation;
+	dirty_[node] = 1;
+	first_dirty_ = std::min(first_dirty_, node);
+}
+
+void Scene::SetScale(uint32_t node, const glm::vec3& scale)
+{
+	scales_[node] = scale;
+	dirty_[node] = 1;
+	first_dirty_ = std::min(first_dirty_, node);
+}
+
+uint32_t Scene::UpdateWorldTransforms()
+{
+	uint32_t node_count = static_cast<uint32_t>(parents_.size());
+	if (first_dirty_ >= node_count) {
+		return 0;
+	}
+
+	version_++;
+	uint32_t updated = 0;
+	for (uint32_t i = first_dirty_; i < node_count; i++) {
+		uint32_t parent = parents_[i];
+		// Parents are updated first, so a dirty parent already passed its flag down
+		if (parent != SCENE_NO_PARENT && dirty_[parent]) {
+			dirty_[i] = 1;
+		}
+		if (!dirty_[i]) {
+			continue;
+		}
+
+		glm::mat4 local = glm::translate(glm::mat4{ 1.0f }, positions_[i]) * glm::mat4_cast(rotations_[i]) * glm::scale(glm::mat4{ 1.0f }, scales_[i]);
+		worlds_[i] = parent != SCENE_NO_PARENT ? worlds_[parent] * local : local;
+		world_versions_[i] = version_;
+		updated++;
+	}
+
+	// Cleared after the pass, the children of a node read its flag during it
+	std::fill(dirty_.begin() + first_dirty_, dirty_.end(), 0);
+	first_dirty_ = UINT32_MAX;
+	return updated;
+}
+
+uint32_t Scene::WriteObjectWorlds(void* destination, size_t stride, uint64_t& synced_version) const
+{
+	if (synced_version >= version_) {
+		return 0;
+	}
+
+	uint8_t* bytes = static_cast<uint8_t*>(destination);
+	uint32_t written = 0;
+	for (size_t i = 0; i < object_nodes_.size(); i++) {
+		uint32_t node = object_nodes_[i];
+		if (world_versions_[node] > synced_version) {
+			memcpy(bytes + i * stride, &worlds_[node], sizeof(glm::mat4));
+			written++;
+		}
+	}
+	synced_version = version_;
+	return written;
+}
+
+const glm::mat4& Scene::GetObjectWorld(uint32_t object) const
+{
+	return worlds_[object_nodes_[object]];
+}
+
+uint32_t Scene::GetObjectModel(uint32_t object) const
+{
+	return object_models_[object];
+}
+
+uint32_t Scene::GetObjectCount() const
+{
+	return static_cast<uint32_t>(object_nodes_.size());
+}
+
+uint32_t Scene::GetNodeCount() const
+{
+	return static_cast<uint32_t>(parents_.size());
+}
@@ -1,11 +1,61 @@
 #pragma once
+#include <cstdint>
 #include <vector>
-#include <glm/fwd.hpp>
-#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
 
-struct Scene
+const uint32_t SCENE_NO_PARENT = UINT32_MAX;
+
+/*
+* Hierarchy of transforms, one contiguous array per component. A node is always stored after its parent,
+* so one pass over the arrays updates the world matrices and only the subtrees below changed nodes are recomputed.
+* Objects are the nodes that are drawn, in the order the renderer indexes its per object buffers.
+*/
+class Scene
 {
-	std::vector<glm::mat4> object_transforms;
-	VkBuffer object_transforms_ubo;
-	VkDeviceMemory scene_memory; // scene_data + object_transforms
+public:
+	// The parent must already exist, returns the index of the new node
+	uint32_t AddNode(uint32_t parent = SCENE_NO_PARENT, const glm::vec3& position = glm::vec3{ 0.0f },
+		const glm::quat& rotation = glm::quat{ 1.0f, 0.0f, 0.0f, 0.0f }, const glm::vec3& scale = glm::vec3{ 1.0f });
+	// Draws the model with the world matrix of the node, returns the index of the object
+	uint32_t AddObject(uint32_t node, uint32_t model);
+
+	// Local transform relative to the parent, marks the node and everything below it for the next update
+	void SetPosition(uint32_t node, const glm::vec3& position);
+	void SetRotation(uint32_t node, const glm::quat& rotation);
+	void SetScale(uint32_t node, const glm::vec3& scale);
+
+	// Recomputes the world matrices of the dirty nodes and their descendants, returns how many were recomputed
+	uint32_t UpdateWorldTransforms();
+
+	/*
+	* Writes the world matrices of the objects that changed since synced_version, one every stride bytes from destination, and advances synced_version.
+	* Every buffer that holds the matrices keeps its own version, so each per-frame buffer catches up on the updates it missed. Returns how many were written.
+	*/
+	uint32_t WriteObjectWorlds(void* destination, size_t stride, uint64_t& synced_version) const;
+
+	const glm::mat4& GetObjectWorld(uint32_t object) const;
+	uint32_t GetObjectModel(uint32_t object) const;
+	uint32_t GetObjectCount() const;
+	uint32_t GetNodeCount() const;
+
+private:
+	// Per node
+	std::vector<uint32_t> parents_;
+	std::vector<glm::vec3> positions_;
+	std::vector<glm::quat> rotations_;
+	std::vector<glm::vec3> scales_;
+	std::vector<glm::mat4> worlds_;
+	std::vector<uint8_t> dirty_;
+	// Version of the update that last changed the world matrix
+	std::vector<uint64_t> world_versions_;
+
+	// Per object
+	std::vector<uint32_t> object_nodes_;
+	std::vector<uint32_t> object_models_;
+
+	// Buffers start at version 0, so they receive every matrix on their first write
+	uint64_t version_ = 1;
+	// Nodes before the first dirty one can't change, the update starts there
+	uint32_t first_dirty_ = UINT32_MAX;
 };
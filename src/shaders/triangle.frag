@@ -1,6 +1,22 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
-layout(binding = 1) uniform sampler2D tex_sampler;
+// Every texture of the renderer, the draw picks its own through the push constants
+layout(set = 0, binding = 0) uniform sampler2D textures[];
+
+layout(push_constant) uniform constants{
+    uint texture_index;
+    uint uniform_index;
+    uint object_index;
+    uint padding;
+    mat4 transform;
+} push_constants;
+
+// Specialized per pipeline variant, ids must match FRAGMENT_CONSTANT_* in vulkan_graphics.h
+// Weight of the vertex color against the texture
+layout(constant_id = 0) const float TEXTURE_MIX = 0.5f;
+// Without the texture only the vertex color is written and the sampler is never read
+layout(constant_id = 1) const bool USE_TEXTURE = true;
 
 // Input variables from the vertex shader
 layout(location = 0) in vec3 vert_color;
@@ -10,5 +26,10 @@ layout(location = 1) in vec2 vert_texcoord;
 layout(location = 0) out vec4 out_color;
 
 void main (){
-    out_color = vec4(mix(texture(tex_sampler, vert_texcoord), vec4(vert_color, 1.0f), 0.5f));
+    if (USE_TEXTURE) {
+        out_color = vec4(mix(texture(textures[push_constants.texture_index], vert_texcoord), vec4(vert_color, 1.0f), TEXTURE_MIX));
+    }
+    else {
+        out_color = vec4(vert_color, 1.0f);
+    }
 }
\ No newline at end of file
@@ -6,14 +6,11 @@ layout(location = 2) in vec2 in_texcoord;
 layout(location = 0) out vec3 vert_color;
 layout(location = 1) out vec2 vert_texcoord;
 
-layout(binding = 0) uniform UniformBufferObject{
-    mat4 model;
-    mat4 view;
-    mat4 projection;
-} ubo;
-
 layout(push_constant) uniform constants{
-    vec4 data;
+    uint texture_index;
+    uint uniform_index;
+    uint object_index;
+    uint padding;
     mat4 transform;
 } push_constants;
 
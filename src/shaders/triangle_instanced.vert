@@ -0,0 +1,32 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(location = 0) in vec3 in_position;
+layout(location = 1) in vec3 in_color;
+layout(location = 2) in vec2 in_texcoord;
+// Per instance, takes locations 3 to 6
+layout(location = 3) in mat4 in_world;
+layout(location = 0) out vec3 vert_color;
+layout(location = 1) out vec2 vert_texcoord;
+
+// Every storage buffer of the renderer, the push constants pick the ones of the draw
+layout(std430, set = 0, binding = 1) readonly buffer FrameUniforms {
+    mat4 view;
+    mat4 projection;
+    mat4 view_projection;
+} frame_uniforms[];
+
+// transform holds the dequantization of the mesh
+layout(push_constant) uniform constants{
+    uint texture_index;
+    uint uniform_index;
+    uint object_index;
+    uint padding;
+    mat4 transform;
+} push_constants;
+
+void main(){
+    gl_Position = frame_uniforms[push_constants.uniform_index].view_projection * in_world * push_constants.transform * vec4(in_position, 1.0);
+    vert_color = in_color;
+    vert_texcoord = in_texcoord;
+}
\ No newline at end of file
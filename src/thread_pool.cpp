@@ -0,0 +1,106 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+ThreadPool::ThreadPool(uint32_t thread_count) {
+    if (thread_count == 0) {
+        uint32_t hardware_threads = std::thread::hardware_concurrency();
+        thread_count = hardware_threads > 1 ? hardware_threads - 1 : 1;
+    }
+
+    workers_.reserve(thread_count);
+    for (uint32_t i = 0; i < thread_count; i++) {
+        workers_.emplace_back(&ThreadPool::WorkerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    task_available_.notify_all();
+
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+void ThreadPool::WorkerLoop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            task_available_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+
+            // Queued tasks still run when stopping, someone may be waiting on them
+            if (tasks_.empty()) {
+                return;
+            }
+
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+
+        task();
+    }
+}
+
+std::future<void> ThreadPool::Submit(std::function<void()> task) {
+    auto packaged = std::make_shared<std::packaged_task<void()>>(std::move(task));
+    std::future<void> future = packaged->get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.emplace_back([packaged]() { (*packaged)(); });
+    }
+    task_available_.notify_one();
+
+    return future;
+}
+
+void ThreadPool::ParallelFor(uint32_t count, const std::function<void(uint32_t)>& function) {
+    if (count == 0) {
+        return;
+    }
+
+    // Indices are handed out one at a time, so uneven work still spreads over all threads
+    struct SharedState {
+        std::atomic<uint32_t> next_index{ 0 };
+        std::atomic<uint32_t> finished{ 0 };
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+    auto state = std::make_shared<SharedState>();
+
+    auto run = [state, count, &function]() {
+        uint32_t index;
+        while ((index = state->next_index.fetch_add(1)) < count) {
+            function(index);
+            if (state->finished.fetch_add(1) + 1 == count) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->done.notify_all();
+            }
+        }
+    };
+
+    // Helpers that start after all indices were taken return right away
+    uint32_t helper_count = std::min<uint32_t>(static_cast<uint32_t>(workers_.size()), count - 1);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (uint32_t i = 0; i < helper_count; i++) {
+            tasks_.emplace_back(run);
+        }
+    }
+    task_available_.notify_all();
+
+    run();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [&state, count]() { return state->finished.load() == count; });
+}
+
+uint32_t ThreadPool::GetThreadCount() const {
+    return static_cast<uint32_t>(workers_.size());
+}
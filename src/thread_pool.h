@@ -0,0 +1,41 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+* Fixed set of worker threads that run tasks from one shared queue.
+* ParallelFor lets the calling thread work on the range as well, so it never idles while waiting.
+*/
+class ThreadPool {
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable task_available_;
+    bool stopping_ = false;
+
+private:
+    void WorkerLoop();
+
+public:
+    // Zero uses one thread less than the hardware has, the calling thread is the last one
+    explicit ThreadPool(uint32_t thread_count = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    std::future<void> Submit(std::function<void()> task);
+
+    // Calls function for every index in [0, count) and returns once all calls finished
+    void ParallelFor(uint32_t count, const std::function<void(uint32_t)>& function);
+
+    // Worker threads, not counting the thread calling ParallelFor
+    uint32_t GetThreadCount() const;
+};
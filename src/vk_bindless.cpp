@@ -0,0 +1,214 @@
+#include "vk_bindless.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <array>
+
+bool IsBindlessSupported(VkPhysicalDevice device) {
+    VkPhysicalDeviceVulkan12Features vulkan12_features{};
+    vulkan12_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    VkPhysicalDeviceFeatures2 features{};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &vulkan12_features;
+    vkGetPhysicalDeviceFeatures2(device, &features);
+
+    // The index comes from push constants, so it is dynamically uniform and no non uniform indexing is needed
+    return features.features.shaderSampledImageArrayDynamicIndexing && features.features.shaderStorageBufferArrayDynamicIndexing &&
+        vulkan12_features.runtimeDescriptorArray && vulkan12_features.descriptorBindingPartiallyBound &&
+        vulkan12_features.descriptorBindingUpdateUnusedWhilePending && vulkan12_features.descriptorBindingSampledImageUpdateAfterBind &&
+        vulkan12_features.descriptorBindingStorageBufferUpdateAfterBind;
+}
+
+void EnableBindlessFeatures(VkPhysicalDeviceFeatures& features, VkPhysicalDeviceVulkan12Features& vulkan12_features) {
+    features.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+    features.shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
+    vulkan12_features.runtimeDescriptorArray = VK_TRUE;
+    vulkan12_features.descriptorBindingPartiallyBound = VK_TRUE;
+    vulkan12_features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    vulkan12_features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    vulkan12_features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+}
+
+bool BindlessDescriptors::Initialize(VkPhysicalDevice physical_device, VkDevice device) {
+    device_ = device;
+
+    VkPhysicalDeviceVulkan12Properties vulkan12_properties{};
+    vulkan12_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &vulkan12_properties;
+    vkGetPhysicalDeviceProperties2(physical_device, &properties);
+    texture_capacity_ = std::min({ MAX_BINDLESS_TEXTURES, vulkan12_properties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+        vulkan12_properties.maxPerStageDescriptorUpdateAfterBindSamplers, vulkan12_properties.maxDescriptorSetUpdateAfterBindSampledImages });
+    buffer_capacity_ = std::min({ MAX_BINDLESS_BUFFERS, vulkan12_properties.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+        vulkan12_properties.maxDescriptorSetUpdateAfterBindStorageBuffers });
+
+    // Textures are sampled by the fragment shader, buffers hold the frame uniforms and objects the vertex shaders read
+    std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+    bindings[0].binding = BINDLESS_TEXTURE_BINDING;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[0].descriptorCount = texture_capacity_;
+    bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    bindings[1].binding = BINDLESS_BUFFER_BINDING;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[1].descriptorCount = buffer_capacity_;
+    bindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+    VkDescriptorBindingFlags flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+    std::array<VkDescriptorBindingFlags, 2> binding_flags{ flags, flags };
+    VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info{};
+    flags_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    flags_info.bindingCount = static_cast<uint32_t>(binding_flags.size());
+    flags_info.pBindingFlags = binding_flags.data();
+
+    VkDescriptorSetLayoutCreateInfo layout_info{};
+    layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_info.pNext = &flags_info;
+    layout_info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layout_info.bindingCount = static_cast<uint32_t>(bindings.size());
+    layout_info.pBindings = bindings.data();
+
+    VkResult res = vkCreateDescriptorSetLayout(device_, &layout_info, nullptr, &layout_);
+    if (res != VK_SUCCESS) {
+        LOG << "FAILURE\t Couldn't create bindless descriptor set layout, error:" << res;
+        return false;
+    }
+
+    std::array<VkDescriptorPoolSize, 2> pool_sizes{};
+    pool_sizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    pool_sizes[0].descriptorCount = texture_capacity_;
+    pool_sizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    pool_sizes[1].descriptorCount = buffer_capacity_;
+
+    VkDescriptorPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    pool_info.maxSets = 1;
+    pool_info.poolSizeCount = static_cast<uint32_t>(pool_sizes.size());
+    pool_info.pPoolSizes = pool_sizes.data();
+
+    res = vkCreateDescriptorPool(device_, &pool_info, nullptr, &pool_);
+    if (res != VK_SUCCESS) {
+        LOG << "FAILURE\t Couldn't create bindless descriptor pool, error:" << res;
+        return false;
+    }
+
+    VkDescriptorSetAllocateInfo allocate_info{};
+    allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocate_info.descriptorPool = pool_;
+    allocate_info.descriptorSetCount = 1;
+    allocate_info.pSetLayouts = &layout_;
+
+    res = vkAllocateDescriptorSets(device_, &allocate_info, &set_);
+    if (res != VK_SUCCESS) {
+        LOG << "FAILURE\t Couldn't allocate bindless descriptor set, error:" << res;
+        return false;
+    }
+
+    LOG << "SUCCESS\t Created bindless descriptor set for " << texture_capacity_ << " textures and " << buffer_capacity_ << " storage buffers";
+    return true;
+}
+
+void BindlessDescriptors::Destroy() {
+    // The set is freed with its pool
+    if (pool_ != VK_NULL_HANDLE) {
+        vkDestroyDescriptorPool(device_, pool_, nullptr);
+        pool_ = VK_NULL_HANDLE;
+        set_ = VK_NULL_HANDLE;
+    }
+    if (layout_ != VK_NULL_HANDLE) {
+        vkDestroyDescriptorSetLayout(device_, layout_, nullptr);
+        layout_ = VK_NULL_HANDLE;
+    }
+    texture_count_ = 0;
+    buffer_count_ = 0;
+    free_textures_.clear();
+    free_buffers_.clear();
+}
+
+uint32_t BindlessDescriptors::AllocateSlot(uint32_t& count, uint32_t capacity, std::vector<uint32_t>& free_slots, const char* name) {
+    if (!free_slots.empty()) {
+        uint32_t slot = free_slots.back();
+        free_slots.pop_back();
+        return slot;
+    }
+    if (count == capacity) {
+        LOG << "FAILURE\t All " << capacity << " bindless " << name << " slots are in use";
+        return INVALID_BINDLESS_INDEX;
+    }
+    return count++;
+}
+
+uint32_t BindlessDescriptors::AddTexture(VkImageView image_view, VkSampler sampler, VkImageLayout layout) {
+    uint32_t slot = AllocateSlot(texture_count_, texture_capacity_, free_textures_, "texture");
+    if (slot == INVALID_BINDLESS_INDEX) {
+        return slot;
+    }
+
+    VkDescriptorImageInfo image_info{};
+    image_info.imageLayout = layout;
+    image_info.imageView = image_view;
+    image_info.sampler = sampler;
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = set_;
+    write.dstBinding = BINDLESS_TEXTURE_BINDING;
+    write.dstArrayElement = slot;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.descriptorCount = 1;
+    write.pImageInfo = &image_info;
+    vkUpdateDescriptorSets(device_, 1, &write, 0, nullptr);
+    return slot;
+}
+
+uint32_t BindlessDescriptors::AddStorageBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+    uint32_t slot = AllocateSlot(buffer_count_, buffer_capacity_, free_buffers_, "storage buffer");
+    if (slot == INVALID_BINDLESS_INDEX) {
+        return slot;
+    }
+
+    VkDescriptorBufferInfo buffer_info{};
+    buffer_info.buffer = buffer;
+    buffer_info.offset = offset;
+    buffer_info.range = range;
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = set_;
+    write.dstBinding = BINDLESS_BUFFER_BINDING;
+    write.dstArrayElement = slot;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.descriptorCount = 1;
+    write.pBufferInfo = &buffer_info;
+    vkUpdateDescriptorSets(device_, 1, &write, 0, nullptr);
+    return slot;
+}
+
+void BindlessDescriptors::RemoveTexture(uint32_t index, FrameClock& frame_clock) {
+    if (index >= texture_count_) {
+        return;
+    }
+    frame_clock.ReleaseAfterSubmittedFrames([this, index]() { free_textures_.push_back(index); });
+}
+
+void BindlessDescriptors::RemoveStorageBuffer(uint32_t index, FrameClock& frame_clock) {
+    if (index >= buffer_count_) {
+        return;
+    }
+    frame_clock.ReleaseAfterSubmittedFrames([this, index]() { free_buffers_.push_back(index); });
+}
+
+VkDescriptorSetLayout BindlessDescriptors::GetLayout() const {
+    return layout_;
+}
+
+VkDescriptorSet BindlessDescriptors::GetSet() const {
+    return set_;
+}
+
+void BindlessDescriptors::LogStatistics() const {
+    LOG << "Bindless descriptors: " << texture_count_ - free_textures_.size() << " of " << texture_capacity_ << " textures and "
+        << buffer_count_ - free_buffers_.size() << " of " << buffer_capacity_ << " storage buffers in use";
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <cstdint>
+#include <vector>
+
+#include "vk_frame_clock.h"
+
+// Bindings of the bindless set, must match the shaders
+const uint32_t BINDLESS_TEXTURE_BINDING = 0;
+const uint32_t BINDLESS_BUFFER_BINDING = 1;
+// Array sizes when the device allows them
+const uint32_t MAX_BINDLESS_TEXTURES = 4096;
+const uint32_t MAX_BINDLESS_BUFFERS = 4096;
+const uint32_t INVALID_BINDLESS_INDEX = UINT32_MAX;
+
+// Descriptor indexing features the bindless set needs, core since Vulkan 1.2
+bool IsBindlessSupported(VkPhysicalDevice device);
+// Turns the features IsBindlessSupported checked on for the device creation
+void EnableBindlessFeatures(VkPhysicalDeviceFeatures& features, VkPhysicalDeviceVulkan12Features& vulkan12_features);
+
+/*
+* One descriptor set with an array of every texture and every storage buffer of the renderer. It is bound once
+* per command buffer, draws pick their resources with the indices in their push constants instead of binding sets.
+* The arrays are update after bind and partially bound: slots are written while the set is bound by frames in
+* flight and slots that were never written are fine as long as no shader reads them.
+* Add and Remove are called from the render thread.
+*/
+class BindlessDescriptors {
+    VkDevice device_ = VK_NULL_HANDLE;
+    VkDescriptorSetLayout layout_ = VK_NULL_HANDLE;
+    VkDescriptorPool pool_ = VK_NULL_HANDLE;
+    VkDescriptorSet set_ = VK_NULL_HANDLE;
+
+    uint32_t texture_capacity_ = 0;
+    uint32_t buffer_capacity_ = 0;
+    // Slots handed out so far, removed slots are reused before new ones
+    uint32_t texture_count_ = 0;
+    uint32_t buffer_count_ = 0;
+    std::vector<uint32_t> free_textures_;
+    std::vector<uint32_t> free_buffers_;
+
+private:
+    uint32_t AllocateSlot(uint32_t& count, uint32_t capacity, std::vector<uint32_t>& free_slots, const char* name);
+
+public:
+    // Creates the layout, the pool and the set, with arrays clamped to the update after bind limits of the device
+    bool Initialize(VkPhysicalDevice physical_device, VkDevice device);
+    void Destroy();
+
+    // Returns the slot the shaders read the texture from, INVALID_BINDLESS_INDEX when the array is full
+    uint32_t AddTexture(VkImageView image_view, VkSampler sampler, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    uint32_t AddStorageBuffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+
+    // The slot is handed out again once the frames submitted so far finished, they may still read it
+    void RemoveTexture(uint32_t index, FrameClock& frame_clock);
+    void RemoveStorageBuffer(uint32_t index, FrameClock& frame_clock);
+
+    VkDescriptorSetLayout GetLayout() const;
+    VkDescriptorSet GetSet() const;
+
+    void LogStatistics() const;
+};
@@ -0,0 +1,113 @@
+#include "vk_frame_clock.h"
+#include "logger.h"
+
+bool FrameClock::Initialize(VkDevice device) {
+    device_ = device;
+
+    VkSemaphoreTypeCreateInfo type_info{};
+    type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    type_info.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphore_info{};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphore_info.pNext = &type_info;
+
+    VkResult res = vkCreateSemaphore(device_, &semaphore_info, nullptr, &timeline_);
+    if (res != VK_SUCCESS) {
+        LOG << "FAILURE\t Could not create frame timeline semaphore, error: " << res;
+        return false;
+    }
+
+    next_frame_ = 1;
+    completed_frame_ = 0;
+    return true;
+}
+
+void FrameClock::Destroy() {
+    // Everything submitted has to be done before the semaphore goes away
+    WaitForFrame(GetSubmittedFrame());
+    CollectReleases();
+    vkDestroySemaphore(device_, timeline_, nullptr);
+    timeline_ = VK_NULL_HANDLE;
+}
+
+uint64_t FrameClock::BeginFrameSubmission() const {
+    return next_frame_;
+}
+
+void FrameClock::CommitFrameSubmission() {
+    next_frame_++;
+}
+
+uint64_t FrameClock::GetSubmittedFrame() const {
+    return next_frame_ - 1;
+}
+
+void FrameClock::StoreCompletedFrame(uint64_t frame) {
+    // Several threads may read the semaphore, keep the highest value any of them saw
+    uint64_t completed = completed_frame_.load();
+    while (completed < frame && !completed_frame_.compare_exchange_weak(completed, frame)) {
+    }
+}
+
+uint64_t FrameClock::GetCompletedFrame() {
+    uint64_t frame = 0;
+    vkGetSemaphoreCounterValue(device_, timeline_, &frame);
+    StoreCompletedFrame(frame);
+    return completed_frame_;
+}
+
+bool FrameClock::IsFrameComplete(uint64_t frame) {
+    return frame <= completed_frame_ || frame <= GetCompletedFrame();
+}
+
+bool FrameClock::WaitForFrame(uint64_t frame, uint64_t timeout) {
+    if (frame <= completed_frame_) {
+        return true;
+    }
+    if (frame > GetSubmittedFrame()) {
+        // Would never signal
+        LOG << "FAILURE\t Waiting for frame " << frame << " that was not submitted, last submitted " << GetSubmittedFrame();
+        return false;
+    }
+
+    VkSemaphoreWaitInfo wait_info{};
+    wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    wait_info.semaphoreCount = 1;
+    wait_info.pSemaphores = &timeline_;
+    wait_info.pValues = &frame;
+    VkResult res = vkWaitSemaphores(device_, &wait_info, timeout);
+    if (res != VK_SUCCESS) {
+        return false;
+    }
+
+    StoreCompletedFrame(frame);
+    return true;
+}
+
+void FrameClock::GetFrameWait(uint64_t frame, std::vector<VkSemaphore>& semaphores, std::vector<uint64_t>& values) const {
+    if (frame == 0) {
+        return;
+    }
+
+    semaphores.push_back(timeline_);
+    values.push_back(frame);
+}
+
+VkSemaphore FrameClock::GetSemaphore() const {
+    return timeline_;
+}
+
+void FrameClock::ReleaseAfterSubmittedFrames(std::function<void()> release) {
+    releases_.push_back(DeferredRelease{ GetSubmittedFrame(), std::move(release) });
+}
+
+void FrameClock::CollectReleases() {
+    while (!releases_.empty() && IsFrameComplete(releases_.front().frame)) {
+        // Popped first, so a release may defer new work
+        std::function<void()> release = std::move(releases_.front().release);
+        releases_.pop_front();
+        release();
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <vector>
+
+/*
+* Timeline semaphore every frame submission signals with the number of the frame, the first frame is 1.
+* Replaces the per-frame fences: the CPU waits on or queries any frame through it, and other submissions
+* wait for a frame on the GPU by adding the semaphore and the frame number to their waits.
+* Frames are submitted from one thread, queries and waits are safe from any thread.
+* Objects the GPU may still use are handed to the clock and released once the frames that used them finished.
+*/
+class FrameClock {
+    struct DeferredRelease {
+        uint64_t frame;
+        std::function<void()> release;
+    };
+
+    VkDevice device_ = VK_NULL_HANDLE;
+    VkSemaphore timeline_ = VK_NULL_HANDLE;
+
+    // Frame the next submission signals
+    std::atomic<uint64_t> next_frame_{ 1 };
+    // Last value read from the semaphore, it only goes up
+    std::atomic<uint64_t> completed_frame_{ 0 };
+
+    // In the order they were added, so the frames only go up
+    std::deque<DeferredRelease> releases_;
+
+private:
+    void StoreCompletedFrame(uint64_t frame);
+
+public:
+    bool Initialize(VkDevice device);
+    void Destroy();
+
+    // Number the next frame signals, take it right before submitting the frame and add it to the signal values
+    uint64_t BeginFrameSubmission() const;
+    // Counts the frame as submitted once vkQueueSubmit accepted it. A failed submit is never committed,
+    // so nothing waits for a value that won't be signaled
+    void CommitFrameSubmission();
+
+    // Last frame that was handed to a submission, 0 before the first
+    uint64_t GetSubmittedFrame() const;
+
+    // Reads the semaphore, every frame up to the returned one finished on the GPU
+    uint64_t GetCompletedFrame();
+
+    // Uses the cached value first and only asks the driver when that is too old
+    bool IsFrameComplete(uint64_t frame);
+
+    // Blocks until the frame finished, returns false on timeout or when the frame was never submitted
+    bool WaitForFrame(uint64_t frame, uint64_t timeout = UINT64_MAX);
+
+    // Adds a GPU wait for the frame to a submission that uses VkTimelineSemaphoreSubmitInfo
+    void GetFrameWait(uint64_t frame, std::vector<VkSemaphore>& semaphores, std::vector<uint64_t>& values) const;
+
+    VkSemaphore GetSemaphore() const;
+
+    // Runs release once every frame submitted so far finished. Only from the thread that submits frames
+    void ReleaseAfterSubmittedFrames(std::function<void()> release);
+
+    // Runs the releases whose frames finished, call once per frame
+    void CollectReleases();
+};
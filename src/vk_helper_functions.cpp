@@ -19,7 +19,7 @@ uint32_t FindMemoryTypes(VkPhysicalDevice selected_device, uint32_t type_filter,
     return 0;
 }
 
-void CreateBuffer(VkDevice vulkan_device, VkPhysicalDevice selected_device, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& memory, VkMemoryPropertyFlags memory_properties, VkAllocationCallbacks* p_allocate_info)
+void CreateBuffer(GPUMemoryAllocator& allocator, VkDevice vulkan_device, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, BP_Allocation& allocation, VkMemoryPropertyFlags memory_properties, const std::vector<uint32_t>& sharing_families)
 {
     VkBufferCreateInfo create_info{};
     create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -27,47 +27,46 @@ void CreateBuffer(VkDevice vulkan_device, VkPhysicalDevice selected_device, VkDe
     create_info.usage = usage;
     create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+    // Written on the transfer queue and read on the graphics queue without ownership transfers
+    if (sharing_families.size() > 1) {
+        create_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        create_info.queueFamilyIndexCount = static_cast<uint32_t>(sharing_families.size());
+        create_info.pQueueFamilyIndices = sharing_families.data();
+    }
+
     VkResult res = vkCreateBuffer(vulkan_device, &create_info, nullptr, &buffer);
     if (res != VK_SUCCESS) {
-        LOG << "FAILURE\t Failed creating vertex buffer, error: " << res;
+        LOG << "FAILURE\t Failed creating buffer, error: " << res;
+        return;
     }
 
-    // Get memory requirements
-    VkMemoryRequirements mem_requirements{};
-    vkGetBufferMemoryRequirements(vulkan_device, buffer, &mem_requirements);
+    AllocateGPUMemory(allocator, vulkan_device, buffer, allocation, memory_properties);
+    if (allocation.memory == VK_NULL_HANDLE) {
+        return;
+    }
 
-    // Allocate memory for the buffer
-    VkMemoryAllocateInfo alloc_info{};
-    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    alloc_info.allocationSize = mem_requirements.size;
-    alloc_info.memoryTypeIndex = FindMemoryTypes(selected_device, mem_requirements.memoryTypeBits, memory_properties);
+    vkBindBufferMemory(vulkan_device, buffer, allocation.memory, allocation.offset);
+}
 
-    res = vkAllocateMemory(vulkan_device, &alloc_info, p_allocate_info, &memory);
-    if (res != VK_SUCCESS) {
-        LOG << "FAILURE\t Failed to allocate buffer memory";
-        return;
+void DestroyBuffer(GPUMemoryAllocator& allocator, VkDevice vulkan_device, VkBuffer& buffer, BP_Allocation& allocation)
+{
+    if (buffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(vulkan_device, buffer, nullptr);
+        buffer = VK_NULL_HANDLE;
     }
 
-    // Maybe make offset a parameter later for multiple buffer allocation in the same memory space
-    vkBindBufferMemory(vulkan_device, buffer, memory, 0);
+    allocator.Free(allocation);
 }
 
-void AllocateGPUMemory(VkDevice vulkan_device, VkPhysicalDevice selected_device, VkBuffer buffer, VkDeviceSize size, VkDeviceMemory& memory, VkMemoryPropertyFlags memory_properties, VkAllocationCallbacks* p_allocate_info)
+void AllocateGPUMemory(GPUMemoryAllocator& allocator, VkDevice vulkan_device, VkBuffer buffer, BP_Allocation& allocation, VkMemoryPropertyFlags memory_properties)
 {
-    // Get memory requirements
     VkMemoryRequirements mem_requirements{};
     vkGetBufferMemoryRequirements(vulkan_device, buffer, &mem_requirements);
 
-    // Allocate memory for the buffer
-    VkMemoryAllocateInfo alloc_info{};
-    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    alloc_info.allocationSize = mem_requirements.size;
-    alloc_info.memoryTypeIndex = FindMemoryTypes(selected_device, mem_requirements.memoryTypeBits, memory_properties);
-
-    VkResult res = vkAllocateMemory(vulkan_device, &alloc_info, p_allocate_info, &memory);
-    if (res != VK_SUCCESS) {
+    // Buffers are always linear resources
+    allocation = allocator.Allocate(mem_requirements, memory_properties, true);
+    if (allocation.memory == VK_NULL_HANDLE) {
         LOG << "FAILURE\t Failed to allocate buffer memory";
-        return;
     }
 }
 
@@ -150,17 +149,17 @@ void CmdGenerateMipmaps(VkCommandBuffer cmd_buffer, VkPhysicalDevice physical_de
         1, &img_barrier);
 }
 
-void CmdCopyBuffer(VkCommandBuffer cmd_buffer, VkBuffer src, VkBuffer dst, VkDeviceSize size)
+void CmdCopyBuffer(VkCommandBuffer cmd_buffer, VkBuffer src, VkBuffer dst, VkDeviceSize size, VkDeviceSize src_offset)
 {
     VkBufferCopy copy_region{};
-    copy_region.srcOffset = 0;
+    copy_region.srcOffset = src_offset;
     copy_region.dstOffset = 0;
     copy_region.size = size;
 
     vkCmdCopyBuffer(cmd_buffer, src, dst, 1, &copy_region);
 }
 
-void CreateImage(uint32_t width, uint32_t height, uint32_t mip_levels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags memory_property_flags, VkDevice& vulkan_device, VkPhysicalDevice& selected_device, VkImage& image, VkDeviceMemory& memory, VkSampleCountFlagBits num_samples)
+void CreateImage(GPUMemoryAllocator& allocator, uint32_t width, uint32_t height, uint32_t mip_levels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags memory_property_flags, VkDevice vulkan_device, VkImage& image, BP_Allocation& allocation, VkSampleCountFlagBits num_samples, const std::vector<uint32_t>& sharing_families)
 {
     VkImageCreateInfo image_create{};
     image_create.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -181,28 +180,41 @@ void CreateImage(uint32_t width, uint32_t height, uint32_t mip_levels, VkFormat
     }
 
     image_create.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (sharing_families.size() > 1) {
+        image_create.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        image_create.queueFamilyIndexCount = static_cast<uint32_t>(sharing_families.size());
+        image_create.pQueueFamilyIndices = sharing_families.data();
+    }
     image_create.samples = num_samples;
     image_create.flags = 0;
 
     VkResult res = vkCreateImage(vulkan_device, &image_create, nullptr, &image);
     if (res != VK_SUCCESS) {
         LOG << "ERROR\t Failed to create image, error " << res;
+        return;
     }
 
     VkMemoryRequirements mem_requirements{};
     vkGetImageMemoryRequirements(vulkan_device, image, &mem_requirements);
 
-    VkMemoryAllocateInfo allocate_info{};
-    allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocate_info.allocationSize = mem_requirements.size;
-    allocate_info.memoryTypeIndex = FindMemoryTypes(selected_device, mem_requirements.memoryTypeBits, memory_property_flags);
+    // Optimal tiling images must not share a granularity page with buffers or linear images
+    allocation = allocator.Allocate(mem_requirements, memory_property_flags, tiling == VK_IMAGE_TILING_LINEAR);
+    if (allocation.memory == VK_NULL_HANDLE) {
+        LOG << "ERROR\t Failed allocating image memory";
+        return;
+    }
 
-    res = vkAllocateMemory(vulkan_device, &allocate_info, nullptr, &memory);
-    if (res != VK_SUCCESS) {
-        LOG << "ERROR\t Failed allocating image memory " << res;
+    vkBindImageMemory(vulkan_device, image, allocation.memory, allocation.offset);
+}
+
+void DestroyImage(GPUMemoryAllocator& allocator, VkDevice vulkan_device, VkImage& image, BP_Allocation& allocation)
+{
+    if (image != VK_NULL_HANDLE) {
+        vkDestroyImage(vulkan_device, image, nullptr);
+        image = VK_NULL_HANDLE;
     }
 
-    vkBindImageMemory(vulkan_device, image, memory, 0);
+    allocator.Free(allocation);
 }
 
 void CmdTransitionImageLayout(VkCommandBuffer cmd_buffer, VkImage image, VkFormat format, VkImageLayout old_layout, VkImageLayout new_layout, uint32_t mip_levels)
@@ -286,10 +298,10 @@ void CmdTransitionImageLayout(VkCommandBuffer cmd_buffer, VkImage image, VkForma
     );
 }
 
-void CmdCopyBufferToImage(VkCommandBuffer cmd_buffer, VkBuffer src, VkImage dst, uint32_t width, uint32_t height)
+void CmdCopyBufferToImage(VkCommandBuffer cmd_buffer, VkBuffer src, VkImage dst, uint32_t width, uint32_t height, VkDeviceSize src_offset)
 {
     VkBufferImageCopy region{};
-    region.bufferOffset = 0;
+    region.bufferOffset = src_offset;
     region.bufferRowLength = 0;
     region.bufferImageHeight = 0;
     
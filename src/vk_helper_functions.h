@@ -3,10 +3,14 @@
 #include "vulkan/vulkan.hpp"
 #include <optional>
 
+#include "vk_memory_allocator.h"
+
 // Specifies queue support for a queue family
 struct QueueFamilyIndices {
     std::optional<uint32_t> graphics_index;
     std::optional<uint32_t> present_index;
+    // Family that only supports transfers, usually backed by a DMA engine. Optional
+    std::optional<uint32_t> transfer_index;
 
     bool IsComplete() {
         bool success = graphics_index.has_value();
@@ -24,6 +28,8 @@ struct SwapChainDetails {
 struct DeviceQueues {
     VkQueue graphics_queue;
     VkQueue present_queue;
+    // Same as graphics_queue when there's no dedicated transfer family
+    VkQueue transfer_queue;
 };
 
 struct BP_SwapchainInfo {
@@ -39,26 +45,34 @@ struct BP_Texture {
     uint32_t mip_levels;
     VkImage image;
     VkImageView image_view;
-    VkDeviceMemory memory;
+    BP_Allocation allocation;
     VkFormat format;
 };
 
 uint32_t FindMemoryTypes(VkPhysicalDevice selected_device, uint32_t type_filter, VkMemoryPropertyFlags properties);
 
-void CreateBuffer(VkDevice vulkan_device, VkPhysicalDevice selected_device, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& memory, VkMemoryPropertyFlags memory_properties, VkAllocationCallbacks* p_allocate_info = nullptr);
+// Creates the buffer and binds it to memory sub-allocated from the allocator
+// The buffer is shared concurrently when more than one queue family is passed
+void CreateBuffer(GPUMemoryAllocator& allocator, VkDevice vulkan_device, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, BP_Allocation& allocation, VkMemoryPropertyFlags memory_properties, const std::vector<uint32_t>& sharing_families = {});
+
+void DestroyBuffer(GPUMemoryAllocator& allocator, VkDevice vulkan_device, VkBuffer& buffer, BP_Allocation& allocation);
+
+void CmdCopyBuffer(VkCommandBuffer cmd_buffer, VkBuffer src, VkBuffer dst, VkDeviceSize size, VkDeviceSize src_offset = 0);
 
-void CmdCopyBuffer(VkCommandBuffer cmd_buffer, VkBuffer src, VkBuffer dst, VkDeviceSize size);
+// Creates the image and binds it to memory sub-allocated from the allocator
+void CreateImage(GPUMemoryAllocator& allocator, uint32_t width, uint32_t height, uint32_t mip_levels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags memory_property_flags, VkDevice vulkan_device, VkImage& image, BP_Allocation& allocation, VkSampleCountFlagBits num_samples = VK_SAMPLE_COUNT_1_BIT, const std::vector<uint32_t>& sharing_families = {});
 
-void CreateImage(uint32_t width, uint32_t height, uint32_t mip_levels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags memory_property_flags, VkDevice& vulkan_device, VkPhysicalDevice& selected_device, VkImage& image, VkDeviceMemory& memory, VkSampleCountFlagBits num_samples = VK_SAMPLE_COUNT_1_BIT);
+void DestroyImage(GPUMemoryAllocator& allocator, VkDevice vulkan_device, VkImage& image, BP_Allocation& allocation);
 
 void CmdTransitionImageLayout(VkCommandBuffer cmd_buffer, VkImage image, VkFormat format, VkImageLayout old_layout, VkImageLayout new_layout, uint32_t mip_levels);
 
-void CmdCopyBufferToImage(VkCommandBuffer cmd_buffer, VkBuffer src, VkImage dst, uint32_t width, uint32_t height);
+void CmdCopyBufferToImage(VkCommandBuffer cmd_buffer, VkBuffer src, VkImage dst, uint32_t width, uint32_t height, VkDeviceSize src_offset = 0);
 
 VkCommandBuffer BeginSingleTimeCommandBuffer(VkDevice vulkan_device, VkCommandPool cmd_pool);
 void EndSingleTimeCommandBuffer(VkDevice vulkan_device, VkQueue graphics_queue, VkCommandPool cmd_pool, const VkCommandBuffer& cmd_buffer);
 
-void AllocateGPUMemory(VkDevice vulkan_device, VkPhysicalDevice selected_device, VkBuffer buffer, VkDeviceSize size, VkDeviceMemory& memory, VkMemoryPropertyFlags memory_properties, VkAllocationCallbacks* p_allocate_info);
+// Sub-allocates memory for the buffer, binding it is up to the caller
+void AllocateGPUMemory(GPUMemoryAllocator& allocator, VkDevice vulkan_device, VkBuffer buffer, BP_Allocation& allocation, VkMemoryPropertyFlags memory_properties);
 
 bool FormatHasStencilComponent(VkFormat format);
 
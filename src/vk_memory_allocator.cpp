@@ -0,0 +1,361 @@
+#include "vk_memory_allocator.h"
+#include "vk_helper_functions.h"
+#include "logger.h"
+
+#include <set>
+
+namespace {
+    VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+
+    // Checks if the end of resource A and the start of resource B are on the same page, see "Buffer-Image Granularity" in the spec
+    bool OnSamePage(VkDeviceSize a_offset, VkDeviceSize a_size, VkDeviceSize b_offset, VkDeviceSize page_size) {
+        VkDeviceSize a_end_page = (a_offset + a_size - 1) & ~(page_size - 1);
+        VkDeviceSize b_start_page = b_offset & ~(page_size - 1);
+        return a_end_page == b_start_page;
+    }
+}
+
+void GPUMemoryAllocator::Initialize(VkDevice device, VkPhysicalDevice physical_device, VkDeviceSize block_size) {
+    device_ = device;
+    physical_device_ = physical_device;
+    block_size_ = block_size;
+
+    VkPhysicalDeviceProperties device_properties;
+    vkGetPhysicalDeviceProperties(physical_device_, &device_properties);
+    buffer_image_granularity_ = device_properties.limits.bufferImageGranularity;
+    max_allocation_count_ = device_properties.limits.maxMemoryAllocationCount;
+
+    vkGetPhysicalDeviceMemoryProperties(physical_device_, &memory_properties_);
+
+    LOG << "SUCCESS\t Initialized GPU memory allocator, block size " << block_size_ << " granularity " << buffer_image_granularity_;
+}
+
+void GPUMemoryAllocator::Destroy() {
+    for (uint32_t i = 0; i < blocks_.size(); i++) {
+        if (blocks_[i].memory == VK_NULL_HANDLE) {
+            continue;
+        }
+
+        if (!blocks_[i].used_ranges.empty()) {
+            LOG << "WARNING\t Memory block " << i << " destroyed with " << blocks_[i].used_ranges.size() << " live allocations";
+        }
+        DestroyBlock(i);
+    }
+
+    blocks_.clear();
+}
+
+bool GPUMemoryAllocator::CreateBlock(uint32_t memory_type, VkDeviceSize size, BP_AllocationStrategy strategy, bool dedicated, uint32_t& block_index) {
+    if (vk_allocation_count_ >= max_allocation_count_) {
+        LOG << "FAILURE\t maxMemoryAllocationCount of " << max_allocation_count_ << " reached";
+        return false;
+    }
+
+    VkMemoryAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.allocationSize = size;
+    alloc_info.memoryTypeIndex = memory_type;
+
+    MemoryBlock block{};
+    VkResult res = vkAllocateMemory(device_, &alloc_info, nullptr, &block.memory);
+    if (res != VK_SUCCESS) {
+        LOG << "FAILURE\t Failed to allocate memory block of " << size << " bytes, error: " << res;
+        return false;
+    }
+
+    block.size = size;
+    block.memory_type = memory_type;
+    block.strategy = strategy;
+    block.dedicated = dedicated;
+    block.free_ranges.push_back({ 0, size });
+
+    // Map host visible blocks once, every allocation in it gets a pointer into this mapping
+    if (memory_properties_.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        res = vkMapMemory(device_, block.memory, 0, VK_WHOLE_SIZE, 0, &block.mapped);
+        if (res != VK_SUCCESS) {
+            LOG << "FAILURE\t Failed to map memory block, error: " << res;
+        }
+    }
+
+    vk_allocation_count_++;
+
+    // Reuse the slot of a destroyed block
+    for (block_index = 0; block_index < blocks_.size(); block_index++) {
+        if (blocks_[block_index].memory == VK_NULL_HANDLE) {
+            blocks_[block_index] = std::move(block);
+            return true;
+        }
+    }
+
+    blocks_.push_back(std::move(block));
+    return true;
+}
+
+void GPUMemoryAllocator::DestroyBlock(uint32_t block_index) {
+    MemoryBlock& block = blocks_[block_index];
+    if (block.mapped) {
+        vkUnmapMemory(device_, block.memory);
+    }
+
+    vkFreeMemory(device_, block.memory, nullptr);
+    vk_allocation_count_--;
+
+    block = MemoryBlock{};
+}
+
+bool GPUMemoryAllocator::HasGranularityConflict(const MemoryBlock& block, VkDeviceSize offset, VkDeviceSize size, bool linear_resource) {
+    if (buffer_image_granularity_ <= 1) {
+        return false;
+    }
+
+    // Resource ending before this range
+    auto next = block.used_ranges.lower_bound(offset);
+    if (next != block.used_ranges.begin()) {
+        auto previous = std::prev(next);
+        if (previous->second.linear_resource != linear_resource && OnSamePage(previous->first, previous->second.size, offset, buffer_image_granularity_)) {
+            return true;
+        }
+    }
+
+    // Resource starting after this range
+    if (next != block.used_ranges.end()) {
+        if (next->second.linear_resource != linear_resource && OnSamePage(offset, size, next->first, buffer_image_granularity_)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool GPUMemoryAllocator::AllocateFromFreeList(MemoryBlock& block, const VkMemoryRequirements& requirements, bool linear_resource, VkDeviceSize& offset) {
+    for (size_t i = 0; i < block.free_ranges.size(); i++) {
+        MemoryRange range = block.free_ranges[i];
+        VkDeviceSize range_end = range.offset + range.size;
+
+        offset = AlignUp(range.offset, requirements.alignment);
+
+        // Move to the next page when the neighbour is a different kind of resource
+        if (HasGranularityConflict(block, offset, requirements.size, linear_resource)) {
+            offset = AlignUp(offset, buffer_image_granularity_);
+        }
+
+        if (offset + requirements.size > range_end || HasGranularityConflict(block, offset, requirements.size, linear_resource)) {
+            continue;
+        }
+
+        // Split the free range in the padding before and the remainder after the allocation
+        block.free_ranges.erase(block.free_ranges.begin() + i);
+        if (offset + requirements.size < range_end) {
+            block.free_ranges.insert(block.free_ranges.begin() + i, { offset + requirements.size, range_end - (offset + requirements.size) });
+        }
+        if (offset > range.offset) {
+            block.free_ranges.insert(block.free_ranges.begin() + i, { range.offset, offset - range.offset });
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+bool GPUMemoryAllocator::AllocateLinear(MemoryBlock& block, const VkMemoryRequirements& requirements, bool linear_resource, VkDeviceSize& offset) {
+    offset = AlignUp(block.linear_head, requirements.alignment);
+
+    // The previous allocation is the last one in the block
+    if (!block.used_ranges.empty()) {
+        auto last = std::prev(block.used_ranges.end());
+        if (last->second.linear_resource != linear_resource && OnSamePage(last->first, last->second.size, offset, buffer_image_granularity_)) {
+            offset = AlignUp(offset, buffer_image_granularity_);
+        }
+    }
+
+    if (offset + requirements.size > block.size) {
+        return false;
+    }
+
+    block.linear_head = offset + requirements.size;
+    return true;
+}
+
+BP_Allocation GPUMemoryAllocator::Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear_resource, BP_AllocationStrategy strategy) {
+    BP_Allocation allocation{};
+    uint32_t memory_type = FindMemoryTypes(physical_device_, requirements.memoryTypeBits, properties);
+
+    // Large resources get their own block so they don't fragment the shared blocks
+    bool dedicated = requirements.size > block_size_ / 2;
+
+    uint32_t block_index = 0;
+    VkDeviceSize offset = 0;
+    bool found = false;
+
+    if (!dedicated) {
+        for (block_index = 0; block_index < blocks_.size(); block_index++) {
+            MemoryBlock& block = blocks_[block_index];
+            if (block.memory == VK_NULL_HANDLE || block.dedicated || block.memory_type != memory_type || block.strategy != strategy) {
+                continue;
+            }
+
+            found = strategy == BP_AllocationStrategy::LINEAR ?
+                AllocateLinear(block, requirements, linear_resource, offset) :
+                AllocateFromFreeList(block, requirements, linear_resource, offset);
+            if (found) {
+                break;
+            }
+        }
+    }
+
+    // No block with enough space, create a new one
+    if (!found) {
+        VkDeviceSize size = dedicated ? requirements.size : block_size_;
+        if (!CreateBlock(memory_type, size, strategy, dedicated, block_index)) {
+            return allocation;
+        }
+
+        MemoryBlock& block = blocks_[block_index];
+        found = strategy == BP_AllocationStrategy::LINEAR ?
+            AllocateLinear(block, requirements, linear_resource, offset) :
+            AllocateFromFreeList(block, requirements, linear_resource, offset);
+        if (!found) {
+            LOG << "FAILURE\t Allocation of " << requirements.size << " bytes doesn't fit in a new block";
+            return allocation;
+        }
+    }
+
+    MemoryBlock& block = blocks_[block_index];
+    block.used_ranges[offset] = { requirements.size, linear_resource };
+    block.used_bytes += requirements.size;
+
+    allocation.memory = block.memory;
+    allocation.offset = offset;
+    allocation.size = requirements.size;
+    allocation.memory_type = memory_type;
+    allocation.block_index = block_index;
+    allocation.mapped = block.mapped ? static_cast<char*>(block.mapped) + offset : nullptr;
+
+    BP_MemoryStatistics stats = GetStatistics();
+    if (stats.used_bytes > peak_used_bytes_) {
+        peak_used_bytes_ = stats.used_bytes;
+    }
+
+    return allocation;
+}
+
+void GPUMemoryAllocator::Free(BP_Allocation& allocation) {
+    if (allocation.memory == VK_NULL_HANDLE) {
+        return;
+    }
+
+    MemoryBlock& block = blocks_[allocation.block_index];
+    auto used = block.used_ranges.find(allocation.offset);
+    if (block.memory != allocation.memory || used == block.used_ranges.end()) {
+        LOG << "FAILURE\t Freeing allocation that isn't owned by this allocator";
+        return;
+    }
+
+    block.used_bytes -= used->second.size;
+    block.used_ranges.erase(used);
+
+    if (block.strategy == BP_AllocationStrategy::LINEAR) {
+        // Linear blocks are only reused once everything in them is freed
+        if (block.used_ranges.empty()) {
+            block.linear_head = 0;
+        }
+    }
+    else {
+        // Insert the range back into the sorted free list and merge it with its neighbours
+        MemoryRange range{ allocation.offset, allocation.size };
+        auto it = block.free_ranges.begin();
+        while (it != block.free_ranges.end() && it->offset < range.offset) {
+            it++;
+        }
+        it = block.free_ranges.insert(it, range);
+
+        auto next = std::next(it);
+        if (next != block.free_ranges.end() && it->offset + it->size == next->offset) {
+            it->size += next->size;
+            block.free_ranges.erase(next);
+        }
+
+        if (it != block.free_ranges.begin()) {
+            auto previous = std::prev(it);
+            if (previous->offset + previous->size == it->offset) {
+                previous->size += it->size;
+                block.free_ranges.erase(it);
+            }
+        }
+    }
+
+    if (block.dedicated && block.used_ranges.empty()) {
+        DestroyBlock(allocation.block_index);
+    }
+
+    allocation = BP_Allocation{};
+}
+
+void GPUMemoryAllocator::ReleaseEmptyBlocks() {
+    std::set<uint32_t> kept_types;
+    for (uint32_t i = 0; i < blocks_.size(); i++) {
+        MemoryBlock& block = blocks_[i];
+        if (block.memory == VK_NULL_HANDLE || !block.used_ranges.empty()) {
+            continue;
+        }
+
+        // Keep one empty block per type around to avoid allocating again right away
+        if (kept_types.insert(block.memory_type).second) {
+            continue;
+        }
+
+        DestroyBlock(i);
+    }
+}
+
+BP_MemoryStatistics GPUMemoryAllocator::GetStatistics() {
+    BP_MemoryStatistics stats{};
+    for (const MemoryBlock& block : blocks_) {
+        if (block.memory == VK_NULL_HANDLE) {
+            continue;
+        }
+
+        stats.block_count++;
+        stats.allocation_count += static_cast<uint32_t>(block.used_ranges.size());
+        stats.reserved_bytes += block.size;
+        stats.used_bytes += block.used_bytes;
+    }
+
+    stats.peak_used_bytes = peak_used_bytes_;
+    return stats;
+}
+
+BP_MemoryStatistics GPUMemoryAllocator::GetStatistics(uint32_t memory_type) {
+    BP_MemoryStatistics stats{};
+    for (const MemoryBlock& block : blocks_) {
+        if (block.memory == VK_NULL_HANDLE || block.memory_type != memory_type) {
+            continue;
+        }
+
+        stats.block_count++;
+        stats.allocation_count += static_cast<uint32_t>(block.used_ranges.size());
+        stats.reserved_bytes += block.size;
+        stats.used_bytes += block.used_bytes;
+    }
+
+    return stats;
+}
+
+void GPUMemoryAllocator::LogStatistics() {
+    BP_MemoryStatistics total = GetStatistics();
+    LOG << "GPU memory: " << total.allocation_count << " allocations in " << total.block_count << " blocks, "
+        << total.used_bytes << "/" << total.reserved_bytes << " bytes used, peak " << total.peak_used_bytes;
+
+    for (uint32_t i = 0; i < memory_properties_.memoryTypeCount; i++) {
+        BP_MemoryStatistics stats = GetStatistics(i);
+        if (stats.block_count == 0) {
+            continue;
+        }
+
+        LOG << "\t memory type " << i << ": " << stats.allocation_count << " allocations in " << stats.block_count << " blocks, "
+            << stats.used_bytes << "/" << stats.reserved_bytes << " bytes used";
+    }
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <map>
+#include <vector>
+
+// How allocations are placed inside a memory block
+enum class BP_AllocationStrategy {
+    // First fit in a list of free ranges, freed ranges are merged with their neighbours
+    FREE_LIST,
+    // Bump allocation, the block is reset once every allocation in it has been freed
+    LINEAR
+};
+
+// A range inside one of the VkDeviceMemory blocks of the allocator
+struct BP_Allocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    // Points to offset inside the block when the memory is host visible, blocks are mapped persistently
+    void* mapped = nullptr;
+    uint32_t memory_type = 0;
+    uint32_t block_index = 0;
+};
+
+struct BP_MemoryStatistics {
+    uint32_t block_count = 0;
+    uint32_t allocation_count = 0;
+    VkDeviceSize reserved_bytes = 0;
+    VkDeviceSize used_bytes = 0;
+    VkDeviceSize peak_used_bytes = 0;
+};
+
+/*
+* Sub-allocates resources from large VkDeviceMemory blocks so only a handful of vkAllocateMemory calls are made.
+* Blocks are keyed by the memory type FindMemoryTypes returns for the requested properties.
+* Offsets respect the alignment of the resource and bufferImageGranularity between linear and optimal resources.
+*/
+class GPUMemoryAllocator {
+    struct MemoryRange {
+        VkDeviceSize offset;
+        VkDeviceSize size;
+    };
+
+    struct UsedRange {
+        VkDeviceSize size;
+        // Buffers and linear images, optimal images are non-linear
+        bool linear_resource;
+    };
+
+    struct MemoryBlock {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        void* mapped = nullptr;
+        uint32_t memory_type = 0;
+        BP_AllocationStrategy strategy = BP_AllocationStrategy::FREE_LIST;
+        // Only holds one resource, freed when that resource is freed
+        bool dedicated = false;
+
+        // Sorted on offset
+        std::vector<MemoryRange> free_ranges;
+        std::map<VkDeviceSize, UsedRange> used_ranges;
+
+        VkDeviceSize linear_head = 0;
+        VkDeviceSize used_bytes = 0;
+    };
+
+    VkDevice device_ = VK_NULL_HANDLE;
+    VkPhysicalDevice physical_device_ = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties memory_properties_{};
+    VkDeviceSize buffer_image_granularity_ = 1;
+    uint32_t max_allocation_count_ = 0;
+    VkDeviceSize block_size_ = 64 * 1024 * 1024;
+
+    // Destroyed blocks leave an empty slot so block indices of live allocations stay valid
+    std::vector<MemoryBlock> blocks_;
+    uint32_t vk_allocation_count_ = 0;
+    VkDeviceSize peak_used_bytes_ = 0;
+
+private:
+    bool CreateBlock(uint32_t memory_type, VkDeviceSize size, BP_AllocationStrategy strategy, bool dedicated, uint32_t& block_index);
+    void DestroyBlock(uint32_t block_index);
+
+    bool AllocateFromFreeList(MemoryBlock& block, const VkMemoryRequirements& requirements, bool linear_resource, VkDeviceSize& offset);
+    bool AllocateLinear(MemoryBlock& block, const VkMemoryRequirements& requirements, bool linear_resource, VkDeviceSize& offset);
+
+    // Returns true when a conflicting neighbour shares a bufferImageGranularity page with the range
+    bool HasGranularityConflict(const MemoryBlock& block, VkDeviceSize offset, VkDeviceSize size, bool linear_resource);
+
+public:
+    void Initialize(VkDevice device, VkPhysicalDevice physical_device, VkDeviceSize block_size = 64 * 1024 * 1024);
+    void Destroy();
+
+    // Returns an allocation with a null memory handle when it failed
+    BP_Allocation Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear_resource, BP_AllocationStrategy strategy = BP_AllocationStrategy::FREE_LIST);
+    void Free(BP_Allocation& allocation);
+
+    // Frees blocks without allocations, except for one block per memory type
+    void ReleaseEmptyBlocks();
+
+    BP_MemoryStatistics GetStatistics();
+    BP_MemoryStatistics GetStatistics(uint32_t memory_type);
+    void LogStatistics();
+};
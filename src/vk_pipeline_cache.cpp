@@ -0,0 +1,207 @@
+#include "vk_pipeline_cache.h"
+#include "mapped_file.h"
+#include "logger.h"
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+    uint64_t HashFNV1a(const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        uint64_t hash = 0xCBF29CE484222325ull;
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 0x100000001B3ull;
+        }
+        return hash;
+    }
+}
+
+bool PipelineCache::Initialize(VkDevice device, VkPhysicalDevice physical_device, const std::string& path) {
+    device_ = device;
+    path_ = path;
+
+    // The driver UUID is only reported through the 1.1 properties
+    VkPhysicalDeviceIDProperties id_properties{};
+    id_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &id_properties;
+    vkGetPhysicalDeviceProperties2(physical_device, &properties);
+
+    device_header_.magic = PIPELINE_CACHE_MAGIC;
+    device_header_.version = PIPELINE_CACHE_VERSION;
+    device_header_.vendor_id = properties.properties.vendorID;
+    device_header_.device_id = properties.properties.deviceID;
+    device_header_.driver_version = properties.properties.driverVersion;
+    memcpy(device_header_.driver_uuid, id_properties.driverUUID, VK_UUID_SIZE);
+    memcpy(device_header_.pipeline_cache_uuid, properties.properties.pipelineCacheUUID, VK_UUID_SIZE);
+
+    MappedFile file;
+    const void* initial_data = nullptr;
+    size_t initial_size = 0;
+    if (!path_.empty() && file.Open(path_)) {
+        if (ValidateFile(file.Data(), file.Size())) {
+            initial_data = file.Data() + sizeof(BP_PipelineCacheFileHeader);
+            initial_size = file.Size() - sizeof(BP_PipelineCacheFileHeader);
+        }
+        else {
+            LOG << "WARNING\t Pipeline cache " << path_ << " was written by another device or driver or is damaged, starting cold";
+        }
+    }
+
+    VkPipelineCacheCreateInfo cache_info{};
+    cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cache_info.initialDataSize = initial_size;
+    cache_info.pInitialData = initial_data;
+
+    VkResult res = vkCreatePipelineCache(device_, &cache_info, nullptr, &cache_);
+    if (res != VK_SUCCESS && initial_size > 0) {
+        // Data the driver refuses despite the matching header, an empty cache still works
+        LOG << "WARNING\t Driver rejected the pipeline cache data, error: " << res;
+        cache_info.initialDataSize = 0;
+        cache_info.pInitialData = nullptr;
+        initial_size = 0;
+        res = vkCreatePipelineCache(device_, &cache_info, nullptr, &cache_);
+    }
+    if (res != VK_SUCCESS) {
+        LOG << "FAILURE\t Could not create pipeline cache, error: " << res;
+        cache_ = VK_NULL_HANDLE;
+        return false;
+    }
+
+    warm_ = initial_size > 0;
+    if (warm_) {
+        LOG << "SUCCESS\t Created pipeline cache, warm with " << initial_size << " bytes from " << path_;
+    }
+    else {
+        LOG << "SUCCESS\t Created pipeline cache, cold";
+    }
+    return true;
+}
+
+bool PipelineCache::ValidateFile(const uint8_t* data, size_t size) const {
+    if (size < sizeof(BP_PipelineCacheFileHeader)) {
+        return false;
+    }
+
+    BP_PipelineCacheFileHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != device_header_.magic || header.version != device_header_.version
+        || header.vendor_id != device_header_.vendor_id || header.device_id != device_header_.device_id
+        || header.driver_version != device_header_.driver_version
+        || memcmp(header.driver_uuid, device_header_.driver_uuid, VK_UUID_SIZE) != 0
+        || memcmp(header.pipeline_cache_uuid, device_header_.pipeline_cache_uuid, VK_UUID_SIZE) != 0) {
+        return false;
+    }
+
+    const uint8_t* cache_data = data + sizeof(BP_PipelineCacheFileHeader);
+    if (header.data_size != size - sizeof(BP_PipelineCacheFileHeader) || header.data_hash != HashFNV1a(cache_data, header.data_size)) {
+        return false;
+    }
+
+    // The data starts with the header of the driver, checked as well in case the file header was copied between machines
+    VkPipelineCacheHeaderVersionOne vulkan_header;
+    if (header.data_size < sizeof(vulkan_header)) {
+        return false;
+    }
+    memcpy(&vulkan_header, cache_data, sizeof(vulkan_header));
+    return vulkan_header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+        && vulkan_header.vendorID == device_header_.vendor_id && vulkan_header.deviceID == device_header_.device_id
+        && memcmp(vulkan_header.pipelineCacheUUID, device_header_.pipeline_cache_uuid, VK_UUID_SIZE) == 0;
+}
+
+void PipelineCache::Destroy() {
+    if (cache_ == VK_NULL_HANDLE) {
+        return;
+    }
+
+    Save();
+    vkDestroyPipelineCache(device_, cache_, nullptr);
+    cache_ = VK_NULL_HANDLE;
+}
+
+bool PipelineCache::Save() {
+    if (cache_ == VK_NULL_HANDLE || path_.empty()) {
+        return false;
+    }
+
+    size_t size = 0;
+    VkResult res = vkGetPipelineCacheData(device_, cache_, &size, nullptr);
+    std::vector<uint8_t> data(size);
+    if (res == VK_SUCCESS && size > 0) {
+        res = vkGetPipelineCacheData(device_, cache_, &size, data.data());
+    }
+    if (res != VK_SUCCESS || size == 0) {
+        LOG << "FAILURE\t Couldn't read pipeline cache data, error: " << res;
+        return false;
+    }
+
+    BP_PipelineCacheFileHeader header = device_header_;
+    header.data_size = size;
+    header.data_hash = HashFNV1a(data.data(), size);
+
+    std::string temp_path = path_ + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            LOG << "FAILURE\t Couldn't open " << temp_path << " for writing";
+            return false;
+        }
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(data.data()), size);
+        if (!file.good()) {
+            LOG << "FAILURE\t Writing pipeline cache " << temp_path << " failed";
+            file.close();
+            std::error_code remove_error;
+            fs::remove(temp_path, remove_error);
+            return false;
+        }
+    }
+
+    // Replaces the old file in one step, readers see either the old or the new cache
+    std::error_code error;
+    fs::rename(temp_path, path_, error);
+    if (error) {
+        LOG << "FAILURE\t Couldn't move pipeline cache to " << path_ << ": " << error.message();
+        fs::remove(temp_path, error);
+        return false;
+    }
+
+    LOG << "SUCCESS\t Wrote pipeline cache " << path_ << ", " << size << " bytes";
+    return true;
+}
+
+VkResult PipelineCache::CreateGraphicsPipeline(const VkGraphicsPipelineCreateInfo& create_info, VkPipeline& pipeline) {
+    auto start_time = std::chrono::high_resolution_clock::now();
+    VkResult res = vkCreateGraphicsPipelines(device_, cache_, 1, &create_info, nullptr, &pipeline);
+    creation_us_ += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start_time).count();
+    pipeline_count_++;
+    return res;
+}
+
+VkResult PipelineCache::CreateComputePipeline(const VkComputePipelineCreateInfo& create_info, VkPipeline& pipeline) {
+    auto start_time = std::chrono::high_resolution_clock::now();
+    VkResult res = vkCreateComputePipelines(device_, cache_, 1, &create_info, nullptr, &pipeline);
+    creation_us_ += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start_time).count();
+    pipeline_count_++;
+    return res;
+}
+
+VkPipelineCache PipelineCache::GetHandle() const {
+    return cache_;
+}
+
+bool PipelineCache::IsWarm() const {
+    return warm_;
+}
+
+void PipelineCache::LogStatistics() const {
+    LOG << "Pipeline creation, " << (warm_ ? "warm" : "cold") << " start: " << pipeline_count_ << " pipelines in " << creation_us_ / 1000.0 << "ms";
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+const uint32_t PIPELINE_CACHE_MAGIC = 0x43504250; // "BPPC"
+// Bump when the layout of the file header changes
+const uint32_t PIPELINE_CACHE_VERSION = 1;
+const char* const PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+
+/*
+* Header in front of the blob vkGetPipelineCacheData returns. A driver only accepts data from the same device
+* and driver, so the file is ignored when any of the ids differ instead of handing the driver foreign data.
+*/
+struct BP_PipelineCacheFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint32_t driver_version;
+    uint8_t driver_uuid[VK_UUID_SIZE];
+    uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+    uint64_t data_size;
+    // FNV-1a of the data, catches files that were cut off or damaged
+    uint64_t data_hash;
+};
+
+/*
+* VkPipelineCache that is loaded from disk at startup and written back on shutdown, so pipelines compiled
+* in one run are only looked up in the next one. Every pipeline of the renderer is created through it,
+* which also times the creation to compare cold and warm starts.
+*/
+class PipelineCache {
+    VkDevice device_ = VK_NULL_HANDLE;
+    VkPipelineCache cache_ = VK_NULL_HANDLE;
+    std::string path_;
+    BP_PipelineCacheFileHeader device_header_{};
+
+    // Started from valid data of an earlier run
+    bool warm_ = false;
+    // Pipelines are created from worker threads as well
+    std::atomic<uint32_t> pipeline_count_{ 0 };
+    std::atomic<uint64_t> creation_us_{ 0 };
+
+private:
+    // Checks the file header and the header Vulkan puts at the start of the data against the device
+    bool ValidateFile(const uint8_t* data, size_t size) const;
+
+public:
+    // An empty path keeps the cache in memory only
+    bool Initialize(VkDevice device, VkPhysicalDevice physical_device, const std::string& path = PIPELINE_CACHE_PATH);
+    // Saves the cache and destroys it
+    void Destroy();
+
+    // Writes to a temporary file first so an interrupted write never leaves a broken cache behind
+    bool Save();
+
+    // Safe from any thread, VkPipelineCache is internally synchronized
+    VkResult CreateGraphicsPipeline(const VkGraphicsPipelineCreateInfo& create_info, VkPipeline& pipeline);
+    VkResult CreateComputePipeline(const VkComputePipelineCreateInfo& create_info, VkPipeline& pipeline);
+
+    VkPipelineCache GetHandle() const;
+    bool IsWarm() const;
+    void LogStatistics() const;
+};
@@ -0,0 +1,357 @@
+#include "vk_pipeline_registry.h"
+#include "logger.h"
+
+#include <chrono>
+#include <vector>
+
+namespace {
+    const uint64_t FNV_OFFSET_BASIS = 0xCBF29CE484222325ull;
+
+    uint64_t HashFNV1a(uint64_t hash, const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 0x100000001B3ull;
+        }
+        return hash;
+    }
+
+    template<typename T>
+    uint64_t HashValue(uint64_t hash, const T& value) {
+        return HashFNV1a(hash, &value, sizeof(T));
+    }
+
+    // Only the entries in use, the rest of the arrays may hold anything
+    uint64_t HashConstants(uint64_t hash, const BP_SpecializationConstants& constants) {
+        hash = HashValue(hash, constants.count);
+        hash = HashFNV1a(hash, constants.ids.data(), constants.count * sizeof(uint32_t));
+        return HashFNV1a(hash, constants.values.data(), constants.count * sizeof(uint32_t));
+    }
+}
+
+uint64_t GetPipelineKey(const BP_PipelineDescription& description) {
+    // Field by field, the padding of the structs is never hashed. The strings include their terminator so paths can't run together
+    uint64_t hash = FNV_OFFSET_BASIS;
+    hash = HashFNV1a(hash, description.vertex_shader.c_str(), description.vertex_shader.size() + 1);
+    hash = HashFNV1a(hash, description.fragment_shader.c_str(), description.fragment_shader.size() + 1);
+    hash = HashValue(hash, description.vertex_layout);
+    hash = HashValue(hash, description.instanced);
+    hash = HashValue(hash, description.render_pass);
+    hash = HashValue(hash, description.layout);
+    hash = HashValue(hash, description.state.cull_mode);
+    hash = HashValue(hash, description.state.depth_test);
+    hash = HashValue(hash, description.state.depth_write);
+    hash = HashValue(hash, description.state.blend);
+    hash = HashValue(hash, description.state.samples);
+    hash = HashConstants(hash, description.vertex_constants);
+    hash = HashConstants(hash, description.fragment_constants);
+    return hash;
+}
+
+void PipelineRegistry::Initialize(VkDevice device, PipelineCache* cache, VulkanShaderLoader* shader_loader, ThreadPool* thread_pool) {
+    device_ = device;
+    cache_ = cache;
+    shader_loader_ = shader_loader;
+    thread_pool_ = thread_pool;
+}
+
+void PipelineRegistry::Destroy() {
+    for (Variant& variant : variants_) {
+        if (variant.compiled.valid()) {
+            variant.compiled.wait();
+        }
+        if (variant.rebuilt.valid()) {
+            variant.rebuilt.wait();
+        }
+        if (variant.pipeline != VK_NULL_HANDLE) {
+            vkDestroyPipeline(device_, variant.pipeline, nullptr);
+        }
+        if (variant.rebuilt_pipeline != VK_NULL_HANDLE) {
+            vkDestroyPipeline(device_, variant.rebuilt_pipeline, nullptr);
+        }
+    }
+    variants_.clear();
+    variant_index_.clear();
+
+    for (VkShaderModule module : retired_modules_) {
+        vkDestroyShaderModule(device_, module, nullptr);
+    }
+    retired_modules_.clear();
+}
+
+BP_PipelineVariant PipelineRegistry::Request(const BP_PipelineDescription& description) {
+    uint64_t key = GetPipelineKey(description);
+    auto found = variant_index_.find(key);
+    if (found != variant_index_.end()) {
+        return found->second;
+    }
+
+    BP_PipelineVariant variant_id = static_cast<BP_PipelineVariant>(variants_.size());
+    Variant& variant = variants_.emplace_back();
+    variant.description = description;
+    variant.key = key;
+    variant_index_.emplace(key, variant_id);
+
+    Variant* target = &variant;
+    variant.compiled = thread_pool_->Submit([this, target]() {
+        auto start_time = std::chrono::high_resolution_clock::now();
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        VkResult res = CompileVariant(target->description, pipeline);
+        target->compile_ms = std::chrono::duration<double, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start_time).count();
+
+        if (res == VK_SUCCESS) {
+            target->pipeline = pipeline;
+            target->status.store(BP_PipelineStatus::READY);
+            LOG << "SUCCESS\t Compiled pipeline variant " << std::hex << target->key << std::dec << " (" << target->description.vertex_shader
+                << ") in " << target->compile_ms << "ms";
+        }
+        else {
+            target->status.store(BP_PipelineStatus::FAILED);
+            LOG << "FAILURE\t Couldn't compile pipeline variant " << std::hex << target->key << std::dec << " (" << target->description.vertex_shader
+                << "), error: " << res;
+        }
+    });
+    return variant_id;
+}
+
+bool PipelineRegistry::Wait(BP_PipelineVariant variant) {
+    if (variant >= variants_.size()) {
+        return false;
+    }
+
+    variants_[variant].compiled.wait();
+    return variants_[variant].status.load() == BP_PipelineStatus::READY;
+}
+
+BP_PipelineStatus PipelineRegistry::GetStatus(BP_PipelineVariant variant) const {
+    if (variant >= variants_.size()) {
+        return BP_PipelineStatus::FAILED;
+    }
+    return variants_[variant].status.load();
+}
+
+VkPipeline PipelineRegistry::GetPipeline(BP_PipelineVariant variant, VkPipeline fallback) const {
+    if (GetStatus(variant) != BP_PipelineStatus::READY) {
+        return fallback;
+    }
+    return variants_[variant].pipeline;
+}
+
+uint32_t PipelineRegistry::RebuildShaderUsers(const std::string& shader_path) {
+    uint32_t users = 0;
+    for (Variant& variant : variants_) {
+        if (variant.description.vertex_shader == shader_path || variant.description.fragment_shader == shader_path) {
+            variant.rebuild_requested = true;
+            users++;
+        }
+    }
+    return users;
+}
+
+uint32_t PipelineRegistry::Update(FrameClock& frame_clock) {
+    // Taken before the rebuilds below start, compilations running now may have picked up a retired module
+    std::vector<VkShaderModule> retired = shader_loader_->TakeRetiredModules();
+    retired_modules_.insert(retired_modules_.end(), retired.begin(), retired.end());
+
+    uint32_t swapped = 0;
+    bool any_compiling = false;
+    for (Variant& variant : variants_) {
+        if (variant.rebuilt.valid() && variant.rebuilt.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            variant.rebuilt.get();
+            if (variant.rebuild_result == VK_SUCCESS) {
+                // Frames in flight may still draw with the old pipeline
+                VkPipeline replaced = variant.pipeline;
+                if (replaced != VK_NULL_HANDLE) {
+                    VkDevice device = device_;
+                    frame_clock.ReleaseAfterSubmittedFrames([device, replaced]() {
+                        vkDestroyPipeline(device, replaced, nullptr);
+                    });
+                }
+                // A variant that failed before works from now on
+                variant.pipeline = variant.rebuilt_pipeline;
+                variant.status.store(BP_PipelineStatus::READY);
+                rebuild_count_++;
+                swapped++;
+                LOG << "SUCCESS\t Rebuilt pipeline variant " << std::hex << variant.key << std::dec << " (" << variant.description.vertex_shader << ")";
+            }
+            else {
+                LOG << "FAILURE\t Couldn't rebuild pipeline variant " << std::hex << variant.key << std::dec << ", keeping the previous pipeline, error: "
+                    << variant.rebuild_result;
+            }
+            variant.rebuilt_pipeline = VK_NULL_HANDLE;
+        }
+
+        bool compiling = variant.compiled.valid() && variant.compiled.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+        if (variant.rebuild_requested && !compiling && !variant.rebuilt.valid()) {
+            variant.rebuild_requested = false;
+            Variant* target = &variant;
+            variant.rebuilt = thread_pool_->Submit([this, target]() {
+                target->rebuild_result = CompileVariant(target->description, target->rebuilt_pipeline);
+            });
+        }
+        any_compiling = any_compiling || compiling || variant.rebuilt.valid();
+    }
+
+    if (!any_compiling) {
+        for (VkShaderModule module : retired_modules_) {
+            vkDestroyShaderModule(device_, module, nullptr);
+        }
+        retired_modules_.clear();
+    }
+    return swapped;
+}
+
+uint32_t PipelineRegistry::GetVariantCount() const {
+    return static_cast<uint32_t>(variants_.size());
+}
+
+void PipelineRegistry::LogStatistics() const {
+    uint32_t ready = 0, failed = 0;
+    double compile_ms = 0.0;
+    for (const Variant& variant : variants_) {
+        BP_PipelineStatus status = variant.status.load();
+        ready += status == BP_PipelineStatus::READY ? 1 : 0;
+        failed += status == BP_PipelineStatus::FAILED ? 1 : 0;
+        compile_ms += status != BP_PipelineStatus::PENDING ? variant.compile_ms : 0.0;
+    }
+    LOG << "Pipeline registry: " << variants_.size() << " variants, " << ready << " ready and " << failed << " failed, "
+        << compile_ms << "ms compiling on worker threads, " << rebuild_count_ << " rebuilt after shader changes";
+}
+
+VkResult PipelineRegistry::CompileVariant(const BP_PipelineDescription& description, VkPipeline& pipeline) const {
+    // Shared modules, variants with the same shaders only map and create them once
+    VkShaderModule vertex_shader = shader_loader_->GetShaderModule(description.vertex_shader, device_);
+    VkShaderModule fragment_shader = shader_loader_->GetShaderModule(description.fragment_shader, device_);
+    if (vertex_shader == VK_NULL_HANDLE || fragment_shader == VK_NULL_HANDLE) {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    std::array<VkSpecializationMapEntry, MAX_SPECIALIZATION_CONSTANTS> vertex_entries, fragment_entries;
+    VkSpecializationInfo vertex_specialization, fragment_specialization;
+
+    // Initialize shader stages
+    VkPipelineShaderStageCreateInfo vertex_pipeline{};
+    vertex_pipeline.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    vertex_pipeline.stage = VK_SHADER_STAGE_VERTEX_BIT;
+    vertex_pipeline.module = vertex_shader;
+    vertex_pipeline.pName = "main";
+    vertex_pipeline.pSpecializationInfo = description.vertex_constants.GetInfo(vertex_entries, vertex_specialization);
+
+    VkPipelineShaderStageCreateInfo fragment_pipeline{};
+    fragment_pipeline.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    fragment_pipeline.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    fragment_pipeline.module = fragment_shader;
+    fragment_pipeline.pName = "main";
+    fragment_pipeline.pSpecializationInfo = description.fragment_constants.GetInfo(fragment_entries, fragment_specialization);
+
+    VkPipelineShaderStageCreateInfo shader_stages[]{ vertex_pipeline, fragment_pipeline };
+
+    // Create Vertex input pipeline state, instanced variants read the transforms of the instances from a second binding
+    std::vector<VkVertexInputBindingDescription> bindings{ backpack::GetVertexBindingDescription(description.vertex_layout) };
+    auto attribute_desc_array = backpack::GetVertexAttributeDescription(description.vertex_layout);
+    std::vector<VkVertexInputAttributeDescription> attributes(attribute_desc_array.begin(), attribute_desc_array.end());
+    if (description.instanced) {
+        auto instance_attribute_desc_array = backpack::GetInstanceAttributeDescription();
+        bindings.push_back(backpack::GetInstanceBindingDescription());
+        attributes.insert(attributes.end(), instance_attribute_desc_array.begin(), instance_attribute_desc_array.end());
+    }
+
+    VkPipelineVertexInputStateCreateInfo vertex_input_pipeline_state{};
+    vertex_input_pipeline_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertex_input_pipeline_state.pVertexBindingDescriptions = bindings.data();
+    vertex_input_pipeline_state.pVertexAttributeDescriptions = attributes.data();
+    vertex_input_pipeline_state.vertexBindingDescriptionCount = static_cast<uint32_t>(bindings.size());
+    vertex_input_pipeline_state.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributes.size());
+
+    // Add dynamic states to the pipeline
+    // Viewport and scissor allow changing these settings at render time
+    VkDynamicState dynamic_states[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+    VkPipelineDynamicStateCreateInfo dynamic_pipeline_state{};
+    dynamic_pipeline_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamic_pipeline_state.pDynamicStates = &dynamic_states[0];
+    dynamic_pipeline_state.dynamicStateCount = 2;
+
+    // Define how the vertex data should be interpreted
+    VkPipelineInputAssemblyStateCreateInfo input_assembly_state{};
+    input_assembly_state.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    input_assembly_state.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    input_assembly_state.primitiveRestartEnable = VK_FALSE;
+
+    // Viewport and scissor are dynamic, only their count is part of the pipeline
+    VkPipelineViewportStateCreateInfo viewport_state{};
+    viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewport_state.viewportCount = 1;
+    viewport_state.scissorCount = 1;
+
+    // Create rasterize state
+    VkPipelineRasterizationStateCreateInfo rasterizer_state{};
+    rasterizer_state.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer_state.depthClampEnable = VK_FALSE; // Clamps fragments outside the near-and-far plane to them. Requires enabling a GPU feature.
+    rasterizer_state.rasterizerDiscardEnable = VK_FALSE; // Discards geometry
+    rasterizer_state.polygonMode = VK_POLYGON_MODE_FILL; // Using any mode other than fill requires enabling a GPU feature.
+    rasterizer_state.lineWidth = 1.0f;
+    rasterizer_state.cullMode = description.state.cull_mode;
+    rasterizer_state.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rasterizer_state.depthBiasConstantFactor = 0.0f;
+    rasterizer_state.depthBiasClamp = 0.0f;
+
+    // Create Multisampling state
+    VkPipelineMultisampleStateCreateInfo multisampling_state{};
+    multisampling_state.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling_state.sampleShadingEnable = VK_TRUE; // Enable sample shading in the pipeline
+    multisampling_state.minSampleShading = .2f; // Min fraction for sample shading; closer to one is smooth
+    multisampling_state.rasterizationSamples = description.state.samples;
+    multisampling_state.pSampleMask = nullptr;
+    multisampling_state.alphaToCoverageEnable = VK_FALSE;
+    multisampling_state.alphaToOneEnable = VK_FALSE;
+
+    // Framebuffer color blending attachment
+    VkPipelineColorBlendAttachmentState color_blend_attachment{};
+    color_blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    color_blend_attachment.blendEnable = description.state.blend;
+    color_blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    color_blend_attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    color_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
+    color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+    VkPipelineColorBlendStateCreateInfo color_blend_state{};
+    color_blend_state.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    color_blend_state.logicOpEnable = VK_FALSE;
+    color_blend_state.logicOp = VK_LOGIC_OP_COPY;
+    color_blend_state.attachmentCount = 1;
+    color_blend_state.pAttachments = &color_blend_attachment;
+
+    VkPipelineDepthStencilStateCreateInfo depth_stencil_state{};
+    depth_stencil_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depth_stencil_state.depthTestEnable = description.state.depth_test;
+    depth_stencil_state.depthWriteEnable = description.state.depth_write;
+    depth_stencil_state.depthCompareOp = VK_COMPARE_OP_LESS;
+    depth_stencil_state.depthBoundsTestEnable = VK_FALSE;
+    depth_stencil_state.minDepthBounds = 0.0f;
+    depth_stencil_state.maxDepthBounds = 1.0f;
+    depth_stencil_state.stencilTestEnable = VK_FALSE;
+
+    VkGraphicsPipelineCreateInfo graphics_pipeline_info{};
+    graphics_pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    graphics_pipeline_info.stageCount = 2;
+    graphics_pipeline_info.pStages = shader_stages;
+    graphics_pipeline_info.pVertexInputState = &vertex_input_pipeline_state;
+    graphics_pipeline_info.pInputAssemblyState = &input_assembly_state;
+    graphics_pipeline_info.pRasterizationState = &rasterizer_state;
+    graphics_pipeline_info.pMultisampleState = &multisampling_state;
+    graphics_pipeline_info.pDepthStencilState = &depth_stencil_state;
+    graphics_pipeline_info.pColorBlendState = &color_blend_state;
+    graphics_pipeline_info.pDynamicState = &dynamic_pipeline_state;
+    graphics_pipeline_info.pViewportState = &viewport_state;
+    graphics_pipeline_info.layout = description.layout;
+    graphics_pipeline_info.renderPass = description.render_pass;
+    graphics_pipeline_info.subpass = 0;
+    graphics_pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
+    graphics_pipeline_info.basePipelineIndex = -1;
+
+    // The pipeline cache is internally synchronized, workers compile into it at the same time
+    return cache_->CreateGraphicsPipeline(graphics_pipeline_info, pipeline);
+}
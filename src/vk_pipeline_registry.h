@@ -0,0 +1,129 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "geometry-helpers.h"
+#include "thread_pool.h"
+#include "vk_frame_clock.h"
+#include "vk_pipeline_cache.h"
+#include "vk_specialization.h"
+#include "vulkan_shader.h"
+
+// Index of a variant in the registry, valid until the registry is destroyed
+typedef uint32_t BP_PipelineVariant;
+const BP_PipelineVariant INVALID_PIPELINE_VARIANT = UINT32_MAX;
+
+enum class BP_PipelineStatus : uint32_t {
+    // Queued or compiling on a worker
+    PENDING = 0,
+    READY = 1,
+    // A shader is missing or the driver refused the pipeline, draws keep using their fallback
+    FAILED = 2
+};
+
+// Fixed function state that may differ between variants, the rest is the same for every pipeline of the renderer
+struct BP_PipelineState {
+    VkCullModeFlags cull_mode = VK_CULL_MODE_NONE;
+    VkBool32 depth_test = VK_TRUE;
+    VkBool32 depth_write = VK_TRUE;
+    // Alpha blending with the source alpha
+    VkBool32 blend = VK_FALSE;
+    VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+};
+
+// Everything a variant is built from, descriptions with the same key share one pipeline
+struct BP_PipelineDescription {
+    std::string vertex_shader;
+    std::string fragment_shader;
+    backpack::VertexLayout vertex_layout = backpack::VertexLayout::FULL;
+    // Adds the instance transforms as second vertex binding
+    bool instanced = false;
+    VkRenderPass render_pass = VK_NULL_HANDLE;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    BP_PipelineState state;
+    // Baked into the shaders, variants of one shader set that differ here are separate pipelines
+    BP_SpecializationConstants vertex_constants;
+    BP_SpecializationConstants fragment_constants;
+};
+
+// FNV-1a over the shader set, vertex layout, render pass, layout, fixed function state and specialization constants
+uint64_t GetPipelineKey(const BP_PipelineDescription& description);
+
+/*
+* Pipeline variants keyed by their description. A requested variant is compiled on the thread pool through
+* the pipeline cache, so adding one never blocks on vkCreateGraphicsPipelines. Until it is ready, callers
+* draw with a fallback pipeline they pass to GetPipeline.
+* When a shader changes on disk only the variants that use it are compiled again, they keep drawing with
+* their current pipeline until the new one is swapped in by Update.
+* Request, GetPipeline, Update and Destroy are called from the render thread, a worker only writes its own variant.
+*/
+class PipelineRegistry {
+    struct Variant {
+        BP_PipelineDescription description;
+        uint64_t key = 0;
+        // Written by the worker before the status turns READY
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        double compile_ms = 0.0;
+        std::atomic<BP_PipelineStatus> status{ BP_PipelineStatus::PENDING };
+        std::future<void> compiled;
+
+        // Set when a shader of the variant changed, the rebuild starts once no compilation of the variant runs
+        bool rebuild_requested = false;
+        VkPipeline rebuilt_pipeline = VK_NULL_HANDLE;
+        VkResult rebuild_result = VK_SUCCESS;
+        std::future<void> rebuilt;
+    };
+
+    VkDevice device_ = VK_NULL_HANDLE;
+    PipelineCache* cache_ = nullptr;
+    // Shared with the rest of the renderer, its modules outlive the pipelines compiled from them
+    VulkanShaderLoader* shader_loader_ = nullptr;
+    ThreadPool* thread_pool_ = nullptr;
+    uint32_t rebuild_count_ = 0;
+
+    // Taken from the shader loader after reloads, destroyed once no variant compiles
+    std::vector<VkShaderModule> retired_modules_;
+
+    // A deque, so variants keep their address while workers write them and new ones are added
+    std::deque<Variant> variants_;
+    std::unordered_map<uint64_t, BP_PipelineVariant> variant_index_;
+
+private:
+    // Takes the shader modules from the loader and creates the pipeline, runs on a worker
+    VkResult CompileVariant(const BP_PipelineDescription& description, VkPipeline& pipeline) const;
+
+public:
+    void Initialize(VkDevice device, PipelineCache* cache, VulkanShaderLoader* shader_loader, ThreadPool* thread_pool);
+    // Waits for the variants still compiling and destroys all pipelines
+    void Destroy();
+
+    // Returns the existing variant of the description or queues a new one, never waits for the compilation
+    BP_PipelineVariant Request(const BP_PipelineDescription& description);
+
+    // Blocks until the variant finished compiling, returns whether it is ready. For pipelines needed before the first frame
+    bool Wait(BP_PipelineVariant variant);
+
+    // FAILED for INVALID_PIPELINE_VARIANT
+    BP_PipelineStatus GetStatus(BP_PipelineVariant variant) const;
+
+    // The pipeline of the variant once it is ready, fallback before that or when it failed
+    VkPipeline GetPipeline(BP_PipelineVariant variant, VkPipeline fallback = VK_NULL_HANDLE) const;
+
+    // Queues a rebuild of every variant that uses the shader, returns how many there are
+    uint32_t RebuildShaderUsers(const std::string& shader_path);
+
+    // Starts the queued rebuilds and swaps in the finished ones, call once per frame. The replaced pipelines
+    // are destroyed once the frames submitted so far finished, the replaced shader modules once no variant
+    // compiles, pipelines don't need their modules after creation. Returns how many pipelines were swapped
+    uint32_t Update(FrameClock& frame_clock);
+
+    uint32_t GetVariantCount() const;
+    void LogStatistics() const;
+};
@@ -0,0 +1,136 @@
+#include "vk_specialization.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cstring>
+
+void BP_SpecializationConstants::SetUint(uint32_t id, uint32_t value) {
+    uint32_t position = 0;
+    while (position < count && ids[position] < id) {
+        position++;
+    }
+    if (position < count && ids[position] == id) {
+        values[position] = value;
+        return;
+    }
+    if (count == MAX_SPECIALIZATION_CONSTANTS) {
+        LOG << "FAILURE\t More than " << MAX_SPECIALIZATION_CONSTANTS << " specialization constants, ignoring id " << id;
+        return;
+    }
+
+    for (uint32_t i = count; i > position; i--) {
+        ids[i] = ids[i - 1];
+        values[i] = values[i - 1];
+    }
+    ids[position] = id;
+    values[position] = value;
+    count++;
+}
+
+void BP_SpecializationConstants::SetFloat(uint32_t id, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    SetUint(id, bits);
+}
+
+void BP_SpecializationConstants::SetBool(uint32_t id, bool value) {
+    SetUint(id, value ? VK_TRUE : VK_FALSE);
+}
+
+const VkSpecializationInfo* BP_SpecializationConstants::GetInfo(std::array<VkSpecializationMapEntry, MAX_SPECIALIZATION_CONSTANTS>& entries, VkSpecializationInfo& info) const {
+    if (count == 0) {
+        return nullptr;
+    }
+
+    // Ids that the shader doesn't declare are ignored, so one set of constants can serve several shaders
+    for (uint32_t i = 0; i < count; i++) {
+        entries[i].constantID = ids[i];
+        entries[i].offset = i * sizeof(uint32_t);
+        entries[i].size = sizeof(uint32_t);
+    }
+
+    info = {};
+    info.mapEntryCount = count;
+    info.pMapEntries = entries.data();
+    info.dataSize = count * sizeof(uint32_t);
+    info.pData = values.data();
+    return &info;
+}
+
+std::vector<uint32_t> GetWorkgroupSizeCandidates(const VkPhysicalDeviceLimits& limits) {
+    uint32_t max_size = std::min(limits.maxComputeWorkGroupSize[0], limits.maxComputeWorkGroupInvocations);
+    std::vector<uint32_t> sizes;
+    for (uint32_t size = 32; size <= std::min(max_size, 1024u); size *= 2) {
+        sizes.push_back(size);
+    }
+    // Every device supports 128, the loop only comes up empty on broken limits
+    if (sizes.empty()) {
+        sizes.push_back(std::max(max_size, 1u));
+    }
+    return sizes;
+}
+
+void WorkgroupSizeTuner::Initialize(const std::vector<uint32_t>& sizes, uint32_t samples_per_size) {
+    sizes_ = sizes;
+    total_ms_.assign(sizes_.size(), 0.0);
+    sample_counts_.assign(sizes_.size(), 0);
+    samples_per_size_ = samples_per_size;
+    next_ = 0;
+    best_ = 0;
+    tuning_ = sizes_.size() > 1 && samples_per_size_ > 0;
+}
+
+bool WorkgroupSizeTuner::IsTuning() const {
+    return tuning_;
+}
+
+uint32_t WorkgroupSizeTuner::NextCandidate() {
+    if (!tuning_) {
+        return best_;
+    }
+
+    uint32_t candidate = next_;
+    next_ = (next_ + 1) % static_cast<uint32_t>(sizes_.size());
+    return candidate;
+}
+
+uint32_t WorkgroupSizeTuner::GetCandidateCount() const {
+    return static_cast<uint32_t>(sizes_.size());
+}
+
+uint32_t WorkgroupSizeTuner::GetWorkgroupSize(uint32_t candidate) const {
+    return sizes_[candidate];
+}
+
+uint32_t WorkgroupSizeTuner::GetBestWorkgroupSize() const {
+    return sizes_[best_];
+}
+
+void WorkgroupSizeTuner::AddSample(uint32_t candidate, double ms) {
+    if (!tuning_ || candidate >= sizes_.size()) {
+        return;
+    }
+
+    total_ms_[candidate] += ms;
+    sample_counts_[candidate]++;
+    for (uint32_t count : sample_counts_) {
+        if (count < samples_per_size_) {
+            return;
+        }
+    }
+
+    for (uint32_t i = 1; i < sizes_.size(); i++) {
+        if (total_ms_[i] / sample_counts_[i] < total_ms_[best_] / sample_counts_[best_]) {
+            best_ = i;
+        }
+    }
+    tuning_ = false;
+}
+
+void WorkgroupSizeTuner::LogResults(const char* name) const {
+    std::stringstream results;
+    for (uint32_t i = 0; i < sizes_.size(); i++) {
+        results << " " << sizes_[i] << ": " << (sample_counts_[i] > 0 ? total_ms_[i] / sample_counts_[i] : 0.0) << "ms";
+    }
+    LOG << "Workgroup size of " << name << (tuning_ ? " still tuning, " : " tuned to ") << sizes_[best_] << ", mean dispatch time" << results.str();
+}
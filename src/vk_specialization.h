@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Constants one shader stage can have specialized
+const uint32_t MAX_SPECIALIZATION_CONSTANTS = 8;
+
+/*
+* Values of the specialization constants of one shader stage, baked into the pipeline when it is compiled.
+* Every value is 32 bits wide, floats and booleans are stored as their bit pattern. The entries are kept
+* sorted by id, so the same values set in another order describe the same pipeline.
+*/
+struct BP_SpecializationConstants {
+    uint32_t count = 0;
+    std::array<uint32_t, MAX_SPECIALIZATION_CONSTANTS> ids{};
+    std::array<uint32_t, MAX_SPECIALIZATION_CONSTANTS> values{};
+
+    // Replaces the value when the id is already set
+    void SetUint(uint32_t id, uint32_t value);
+    void SetFloat(uint32_t id, float value);
+    void SetBool(uint32_t id, bool value);
+
+    // Fills entries and info for the stage, nullptr without constants. The info points into this struct and entries
+    const VkSpecializationInfo* GetInfo(std::array<VkSpecializationMapEntry, MAX_SPECIALIZATION_CONSTANTS>& entries, VkSpecializationInfo& info) const;
+};
+
+// Power of two workgroup sizes from 32 up to the limits of the device in x
+std::vector<uint32_t> GetWorkgroupSizeCandidates(const VkPhysicalDeviceLimits& limits);
+
+/*
+* Picks the fastest workgroup size of a compute shader from the dispatch times of regular frames. The candidates
+* take turns, so a scene that changes while tuning affects all of them alike. Once every candidate has enough
+* samples, the one with the lowest mean is used from then on.
+*/
+class WorkgroupSizeTuner {
+    std::vector<uint32_t> sizes_;
+    std::vector<double> total_ms_;
+    std::vector<uint32_t> sample_counts_;
+    uint32_t samples_per_size_ = 0;
+    // Round robin position while tuning
+    uint32_t next_ = 0;
+    uint32_t best_ = 0;
+    bool tuning_ = false;
+
+public:
+    // The first size is used until the measurements pick another. Tuning is skipped with one size or zero samples
+    void Initialize(const std::vector<uint32_t>& sizes, uint32_t samples_per_size);
+
+    bool IsTuning() const;
+
+    // Candidate of the next dispatch, moves on to the next one while tuning
+    uint32_t NextCandidate();
+
+    uint32_t GetCandidateCount() const;
+    uint32_t GetWorkgroupSize(uint32_t candidate) const;
+    // Size of the best candidate so far, the first one before any samples
+    uint32_t GetBestWorkgroupSize() const;
+
+    // Adds the measured dispatch time of the candidate, picks the best one once every candidate has enough samples
+    void AddSample(uint32_t candidate, double ms);
+
+    void LogResults(const char* name) const;
+};
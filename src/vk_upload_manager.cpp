@@ -0,0 +1,391 @@
+#include "vk_upload_manager.h"
+#include "vk_helper_functions.h"
+#include "logger.h"
+
+#include <algorithm>
+
+namespace {
+    VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+}
+
+UploadManager::UploadLane& UploadManager::GetLane(BP_UploadQueue queue) {
+    return lanes_[static_cast<uint32_t>(queue)];
+}
+
+bool UploadManager::InitializeLane(UploadLane& lane, VkQueue queue, uint32_t family_index) {
+    lane.queue = queue;
+    lane.family_index = family_index;
+
+    // Command buffers are short lived and freed once their batch finished
+    VkCommandPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.queueFamilyIndex = family_index;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+    VkResult res = vkCreateCommandPool(device_, &pool_info, nullptr, &lane.cmd_pool);
+    if (res != VK_SUCCESS) {
+        LOG << "FAILURE\t Could not create upload command pool, error: " << res;
+        return false;
+    }
+
+    VkSemaphoreTypeCreateInfo type_info{};
+    type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    type_info.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphore_info{};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphore_info.pNext = &type_info;
+
+    res = vkCreateSemaphore(device_, &semaphore_info, nullptr, &lane.timeline);
+    if (res != VK_SUCCESS) {
+        LOG << "FAILURE\t Could not create upload timeline semaphore, error: " << res;
+        return false;
+    }
+
+    return true;
+}
+
+void UploadManager::Initialize(VkDevice device, GPUMemoryAllocator* allocator, VkQueue graphics_queue, uint32_t graphics_family, VkQueue transfer_queue, uint32_t transfer_family, VkDeviceSize staging_size) {
+    device_ = device;
+    allocator_ = allocator;
+    dedicated_transfer_ = graphics_family != transfer_family;
+
+    bool success = InitializeLane(GetLane(BP_UploadQueue::TRANSFER), transfer_queue, transfer_family);
+    success &= InitializeLane(GetLane(BP_UploadQueue::GRAPHICS), graphics_queue, graphics_family);
+
+    // Both queues copy out of the ring, it's mapped for as long as the manager lives
+    CreateBuffer(*allocator_, device_, staging_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, staging_buffer_, staging_allocation_,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, GetSharingFamilies());
+    success &= staging_allocation_.mapped != nullptr;
+    staging_capacity_ = staging_allocation_.mapped ? staging_size : 0;
+    staging_stats_.capacity = staging_capacity_;
+
+    if (success) {
+        LOG << "SUCCESS\t Created upload manager, dedicated transfer queue: " << (dedicated_transfer_ ? "yes" : "no") << ", staging ring " << staging_size << " bytes";
+    }
+}
+
+void UploadManager::Destroy() {
+    // Everything recorded is submitted so the releases run, then wait until it's done
+    SubmitAll();
+    for (uint32_t i = 0; i < static_cast<uint32_t>(BP_UploadQueue::COUNT); i++) {
+        Wait({ static_cast<BP_UploadQueue>(i), lanes_[i].next_value - 1 });
+    }
+    Collect();
+
+    DestroyBuffer(*allocator_, device_, staging_buffer_, staging_allocation_);
+    staging_ranges_.clear();
+    staging_capacity_ = 0;
+    staging_head_ = 0;
+
+    for (UploadLane& lane : lanes_) {
+        vkDestroySemaphore(device_, lane.timeline, nullptr);
+        vkDestroyCommandPool(device_, lane.cmd_pool, nullptr);
+        lane = UploadLane{};
+    }
+}
+
+VkCommandBuffer UploadManager::GetCommandBuffer(BP_UploadQueue queue) {
+    UploadLane& lane = GetLane(queue);
+    if (lane.recording != VK_NULL_HANDLE) {
+        return lane.recording;
+    }
+
+    VkCommandBufferAllocateInfo allocate_info{};
+    allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocate_info.commandPool = lane.cmd_pool;
+    allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocate_info.commandBufferCount = 1;
+
+    VkResult res = vkAllocateCommandBuffers(device_, &allocate_info, &lane.recording);
+    if (res != VK_SUCCESS) {
+        LOG << "FAILURE\t Couldn't allocate upload command buffer, error: " << res;
+        return VK_NULL_HANDLE;
+    }
+
+    VkCommandBufferBeginInfo begin_info{};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(lane.recording, &begin_info);
+
+    return lane.recording;
+}
+
+BP_UploadTicket UploadManager::GetCurrentTicket(BP_UploadQueue queue) {
+    return { queue, GetLane(queue).next_value };
+}
+
+bool UploadManager::FindStagingSpace(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset, VkDeviceSize& range_start) {
+    range_start = staging_head_;
+    VkDeviceSize aligned_head = AlignUp(staging_head_, alignment);
+
+    if (staging_ranges_.empty()) {
+        range_start = 0;
+        offset = 0;
+        return size <= staging_capacity_;
+    }
+
+    // Everything from the tail up to the head is in use, head and tail being equal means the ring is full
+    VkDeviceSize tail = staging_ranges_.front().start;
+    if (staging_head_ > tail) {
+        if (aligned_head + size <= staging_capacity_) {
+            offset = aligned_head;
+            return true;
+        }
+
+        // Wrap around, the skipped end of the ring belongs to the new range until it's reclaimed
+        if (size <= tail) {
+            offset = 0;
+            return true;
+        }
+        return false;
+    }
+
+    if (staging_head_ < tail && aligned_head + size <= tail) {
+        offset = aligned_head;
+        return true;
+    }
+    return false;
+}
+
+void UploadManager::ReclaimStaging() {
+    // Ranges are reclaimed in allocation order, a finished range behind an unfinished one waits for it
+    while (!staging_ranges_.empty() && IsComplete(staging_ranges_.front().ticket)) {
+        staging_ranges_.pop_front();
+    }
+
+    if (staging_ranges_.empty()) {
+        staging_head_ = 0;
+    }
+}
+
+void UploadManager::WaitForOldestStaging() {
+    staging_stats_.stall_count++;
+
+    BP_UploadTicket oldest = staging_ranges_.front().ticket;
+    if (oldest.value >= GetLane(oldest.queue).next_value) {
+        // Still recording, submit transfer before graphics so waits between them can resolve
+        SubmitAll();
+    }
+
+    Wait(oldest);
+    Collect();
+}
+
+BP_StagingRegion UploadManager::CreateOversizedStaging(BP_UploadQueue queue, VkDeviceSize size) {
+    staging_stats_.oversized_count++;
+
+    BP_StagingRegion region{};
+    BP_Allocation allocation{};
+    CreateBuffer(*allocator_, device_, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, region.buffer, allocation,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, GetSharingFamilies());
+    region.mapped = allocation.mapped;
+
+    // The buffer is read by the current batch, so it has to live until that batch finished
+    VkBuffer staging_buffer = region.buffer;
+    AddRelease(queue, [this, staging_buffer, allocation]() mutable {
+        DestroyBuffer(*allocator_, device_, staging_buffer, allocation);
+    });
+
+    return region;
+}
+
+BP_StagingRegion UploadManager::AllocateStaging(BP_UploadQueue queue, VkDeviceSize size, VkDeviceSize alignment) {
+    staging_stats_.total_bytes += size;
+    frame_staging_bytes_ += size;
+
+    if (size > staging_capacity_) {
+        LOG << "WARNING\t Upload of " << size << " bytes doesn't fit in the staging ring, creating a separate buffer";
+        return CreateOversizedStaging(queue, size);
+    }
+
+    VkDeviceSize offset = 0;
+    VkDeviceSize range_start = 0;
+    while (!FindStagingSpace(size, alignment, offset, range_start)) {
+        WaitForOldestStaging();
+    }
+
+    // Taken after waiting, waiting may have submitted the batch that was being recorded
+    BP_UploadTicket ticket = GetCurrentTicket(queue);
+
+    // Allocations of the same batch share a range, so reclaiming stays one pop per batch
+    StagingRange* last = staging_ranges_.empty() ? nullptr : &staging_ranges_.back();
+    if (last && last->ticket.queue == ticket.queue && last->ticket.value == ticket.value) {
+        last->end = offset + size;
+    }
+    else {
+        staging_ranges_.push_back({ range_start, offset + size, ticket });
+    }
+    staging_head_ = offset + size;
+
+    // Make sure the batch exists, the range is only reclaimed once it has been submitted and finished
+    GetCommandBuffer(queue);
+
+    BP_StagingRegion region{};
+    region.buffer = staging_buffer_;
+    region.offset = offset;
+    region.mapped = static_cast<char*>(staging_allocation_.mapped) + offset;
+    return region;
+}
+
+void UploadManager::AddRelease(BP_UploadQueue queue, std::function<void()> release) {
+    // Releases belong to a batch, so make sure one is being recorded
+    GetCommandBuffer(queue);
+    GetLane(queue).recording_releases.push_back(std::move(release));
+}
+
+void UploadManager::AddWait(BP_UploadQueue queue, BP_UploadTicket ticket) {
+    GetCommandBuffer(queue);
+    GetLane(queue).recording_waits.push_back(ticket);
+}
+
+BP_UploadTicket UploadManager::Submit(BP_UploadQueue queue) {
+    UploadLane& lane = GetLane(queue);
+    if (lane.recording == VK_NULL_HANDLE) {
+        // Nothing recorded, the last submitted batch is the most recent one
+        return { queue, lane.next_value - 1 };
+    }
+
+    vkEndCommandBuffer(lane.recording);
+
+    std::vector<VkSemaphore> wait_semaphores;
+    std::vector<uint64_t> wait_values;
+    std::vector<VkPipelineStageFlags> wait_stages;
+    for (const BP_UploadTicket& ticket : lane.recording_waits) {
+        wait_semaphores.push_back(GetLane(ticket.queue).timeline);
+        wait_values.push_back(ticket.value);
+        wait_stages.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+    }
+
+    uint64_t signal_value = lane.next_value;
+
+    VkTimelineSemaphoreSubmitInfo timeline_info{};
+    timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timeline_info.waitSemaphoreValueCount = static_cast<uint32_t>(wait_values.size());
+    timeline_info.pWaitSemaphoreValues = wait_values.data();
+    timeline_info.signalSemaphoreValueCount = 1;
+    timeline_info.pSignalSemaphoreValues = &signal_value;
+
+    VkSubmitInfo submit_info{};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = &timeline_info;
+    submit_info.waitSemaphoreCount = static_cast<uint32_t>(wait_semaphores.size());
+    submit_info.pWaitSemaphores = wait_semaphores.data();
+    submit_info.pWaitDstStageMask = wait_stages.data();
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &lane.recording;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &lane.timeline;
+
+    VkResult res = vkQueueSubmit(lane.queue, 1, &submit_info, VK_NULL_HANDLE);
+    if (res != VK_SUCCESS) {
+        LOG << "FAILURE\t Upload submit failed, error: " << res;
+    }
+
+    lane.pending.push_back({ signal_value, lane.recording, std::move(lane.recording_releases) });
+    lane.recording = VK_NULL_HANDLE;
+    lane.recording_releases.clear();
+    lane.recording_waits.clear();
+    lane.next_value++;
+
+    return { queue, signal_value };
+}
+
+void UploadManager::SubmitAll() {
+    Submit(BP_UploadQueue::TRANSFER);
+    Submit(BP_UploadQueue::GRAPHICS);
+}
+
+bool UploadManager::IsComplete(const BP_UploadTicket& ticket) {
+    return ticket.value <= GetLane(ticket.queue).completed_value;
+}
+
+void UploadManager::Wait(const BP_UploadTicket& ticket) {
+    UploadLane& lane = GetLane(ticket.queue);
+    if (ticket.value == 0 || ticket.value >= lane.next_value) {
+        // Nothing to wait for, or the batch hasn't been submitted and would never signal
+        return;
+    }
+
+    VkSemaphoreWaitInfo wait_info{};
+    wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    wait_info.semaphoreCount = 1;
+    wait_info.pSemaphores = &lane.timeline;
+    wait_info.pValues = &ticket.value;
+    vkWaitSemaphores(device_, &wait_info, UINT64_MAX);
+
+    RefreshCompletedValues();
+}
+
+void UploadManager::RefreshCompletedValues() {
+    for (UploadLane& lane : lanes_) {
+        vkGetSemaphoreCounterValue(device_, lane.timeline, &lane.completed_value);
+    }
+}
+
+void UploadManager::Collect() {
+    RefreshCompletedValues();
+
+    for (UploadLane& lane : lanes_) {
+        while (!lane.pending.empty() && lane.pending.front().value <= lane.completed_value) {
+            PendingBatch& batch = lane.pending.front();
+            for (auto& release : batch.releases) {
+                release();
+            }
+
+            vkFreeCommandBuffers(device_, lane.cmd_pool, 1, &batch.cmd_buffer);
+            lane.pending.pop_front();
+        }
+    }
+
+    ReclaimStaging();
+}
+
+void UploadManager::EndFrame() {
+    staging_stats_.last_frame_bytes = frame_staging_bytes_;
+    staging_stats_.peak_frame_bytes = std::max(staging_stats_.peak_frame_bytes, frame_staging_bytes_);
+    staging_stats_.frame_count++;
+    frame_staging_bytes_ = 0;
+}
+
+BP_StagingStatistics UploadManager::GetStagingStatistics() const {
+    BP_StagingStatistics stats = staging_stats_;
+    if (!staging_ranges_.empty()) {
+        VkDeviceSize tail = staging_ranges_.front().start;
+        stats.in_use_bytes = staging_head_ > tail ? staging_head_ - tail : staging_capacity_ - tail + staging_head_;
+    }
+    return stats;
+}
+
+void UploadManager::LogStatistics() const {
+    BP_StagingStatistics stats = GetStagingStatistics();
+    VkDeviceSize average = stats.frame_count > 0 ? stats.total_bytes / stats.frame_count : stats.total_bytes;
+    LOG << "Staging: " << stats.total_bytes << " bytes over " << stats.frame_count << " frames, " << average << " bytes/frame average, "
+        << stats.peak_frame_bytes << " bytes/frame peak, " << stats.stall_count << " stalls, " << stats.oversized_count << " oversized uploads";
+}
+
+void UploadManager::GetFrameWaits(std::vector<VkSemaphore>& semaphores, std::vector<uint64_t>& values) {
+    for (UploadLane& lane : lanes_) {
+        if (lane.completed_value == 0) {
+            continue;
+        }
+
+        semaphores.push_back(lane.timeline);
+        values.push_back(lane.completed_value);
+    }
+}
+
+std::vector<uint32_t> UploadManager::GetSharingFamilies() {
+    if (!dedicated_transfer_) {
+        return {};
+    }
+
+    return { GetLane(BP_UploadQueue::GRAPHICS).family_index, GetLane(BP_UploadQueue::TRANSFER).family_index };
+}
+
+bool UploadManager::HasDedicatedTransferQueue() const {
+    return dedicated_transfer_;
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include "vk_memory_allocator.h"
+
+// Queue an upload batch is recorded for
+enum class BP_UploadQueue : uint32_t {
+    // Dedicated transfer queue when the device has one, otherwise the graphics queue
+    TRANSFER = 0,
+    // For work that needs a graphics queue, like blitting mipmaps
+    GRAPHICS = 1,
+    COUNT
+};
+
+// Identifies an upload batch, it's complete once the timeline semaphore of its queue reached value
+struct BP_UploadTicket {
+    BP_UploadQueue queue = BP_UploadQueue::TRANSFER;
+    uint64_t value = 0;
+};
+
+// Part of the staging ring, valid until the batch it was allocated for finished
+struct BP_StagingRegion {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    void* mapped = nullptr;
+};
+
+struct BP_StagingStatistics {
+    VkDeviceSize capacity = 0;
+    VkDeviceSize in_use_bytes = 0;
+    VkDeviceSize last_frame_bytes = 0;
+    VkDeviceSize peak_frame_bytes = 0;
+    VkDeviceSize total_bytes = 0;
+    uint64_t frame_count = 0;
+    // Allocations that had to wait for the GPU to free ring space
+    uint32_t stall_count = 0;
+    // Allocations larger than the ring, they get their own buffer
+    uint32_t oversized_count = 0;
+};
+
+/*
+* Records uploads into batches that are submitted all at once and signal a timeline semaphore per queue.
+* Nothing waits for the device to go idle, callers check tickets and frames wait on completed values only.
+* Staging memory comes from one persistently mapped ring buffer. Ranges are handed back in Collect once
+* their batch finished, together with the command buffers of that batch.
+*/
+class UploadManager {
+    // Range of the ring used by one batch, from start up to end. Start is past end when the range wrapped
+    struct StagingRange {
+        VkDeviceSize start;
+        VkDeviceSize end;
+        BP_UploadTicket ticket;
+    };
+
+    struct PendingBatch {
+        uint64_t value;
+        VkCommandBuffer cmd_buffer;
+        std::vector<std::function<void()>> releases;
+    };
+
+    struct UploadLane {
+        VkQueue queue = VK_NULL_HANDLE;
+        uint32_t family_index = 0;
+        VkCommandPool cmd_pool = VK_NULL_HANDLE;
+        VkSemaphore timeline = VK_NULL_HANDLE;
+
+        // Value the batch that is being recorded will signal
+        uint64_t next_value = 1;
+        uint64_t completed_value = 0;
+
+        VkCommandBuffer recording = VK_NULL_HANDLE;
+        std::vector<std::function<void()>> recording_releases;
+        std::vector<BP_UploadTicket> recording_waits;
+
+        std::deque<PendingBatch> pending;
+    };
+
+    VkDevice device_ = VK_NULL_HANDLE;
+    GPUMemoryAllocator* allocator_ = nullptr;
+    bool dedicated_transfer_ = false;
+    UploadLane lanes_[static_cast<uint32_t>(BP_UploadQueue::COUNT)];
+
+    // Staging ring, oldest range in use at the front
+    VkBuffer staging_buffer_ = VK_NULL_HANDLE;
+    BP_Allocation staging_allocation_;
+    VkDeviceSize staging_capacity_ = 0;
+    VkDeviceSize staging_head_ = 0;
+    std::deque<StagingRange> staging_ranges_;
+
+    BP_StagingStatistics staging_stats_;
+    VkDeviceSize frame_staging_bytes_ = 0;
+
+private:
+    UploadLane& GetLane(BP_UploadQueue queue);
+    bool InitializeLane(UploadLane& lane, VkQueue queue, uint32_t family_index);
+    void RefreshCompletedValues();
+
+    // Finds an aligned offset in the ring, returns false when the free space is too small
+    bool FindStagingSpace(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset, VkDeviceSize& range_start);
+    void ReclaimStaging();
+    // Blocks until the oldest range in the ring can be reused
+    void WaitForOldestStaging();
+    BP_StagingRegion CreateOversizedStaging(BP_UploadQueue queue, VkDeviceSize size);
+
+public:
+    void Initialize(VkDevice device, GPUMemoryAllocator* allocator, VkQueue graphics_queue, uint32_t graphics_family, VkQueue transfer_queue, uint32_t transfer_family, VkDeviceSize staging_size = 32 * 1024 * 1024);
+    void Destroy();
+
+    // Returns the command buffer of the batch being recorded for the queue, starts a new batch when needed
+    VkCommandBuffer GetCommandBuffer(BP_UploadQueue queue);
+
+    // Ticket of the batch that is being recorded, it becomes valid once the batch is submitted
+    BP_UploadTicket GetCurrentTicket(BP_UploadQueue queue);
+
+    /*
+    * Bump allocates from the staging ring, the range is reused once the current batch of the queue finished.
+    * Stalls on the oldest batch when the ring is full, the mapped pointer is null when it failed.
+    */
+    BP_StagingRegion AllocateStaging(BP_UploadQueue queue, VkDeviceSize size, VkDeviceSize alignment = 16);
+
+    // Called once the current batch of the queue finished
+    void AddRelease(BP_UploadQueue queue, std::function<void()> release);
+
+    // Makes the current batch of the queue wait on the GPU for another ticket
+    void AddWait(BP_UploadQueue queue, BP_UploadTicket ticket);
+
+    // Submits the recorded batch of the queue
+    BP_UploadTicket Submit(BP_UploadQueue queue);
+
+    // Submits all recorded batches, transfer before graphics so graphics batches can wait on it
+    void SubmitAll();
+
+    // Uses the values cached by Collect, doesn't call into the driver
+    bool IsComplete(const BP_UploadTicket& ticket);
+
+    // Blocks until the ticket completed, for loading screens and shutdown only
+    void Wait(const BP_UploadTicket& ticket);
+
+    // Releases finished batches and their staging ranges
+    void Collect();
+
+    // Closes the staging statistics of the frame, call once per frame after submitting
+    void EndFrame();
+
+    BP_StagingStatistics GetStagingStatistics() const;
+    void LogStatistics() const;
+
+    /*
+    * Semaphores and values a frame submission can wait on to see every completed upload.
+    * The values are already reached, so the wait doesn't stall the GPU.
+    */
+    void GetFrameWaits(std::vector<VkSemaphore>& semaphores, std::vector<uint64_t>& values);
+
+    // Queue families resources written by uploads and read while rendering have to be shared with
+    std::vector<uint32_t> GetSharingFamilies();
+
+    bool HasDedicatedTransferQueue() const;
+};
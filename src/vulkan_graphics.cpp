@@ -1,6 +1,7 @@
 #include "vulkan_graphics.h"
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
 #include <map>
 #include <set>
 #include <string>
@@ -8,6 +9,10 @@
 #include "logger.h"
 #include "vulkan_shader.h"
 #include "image_loader.h"
+#include "mesh_cache.h"
+#include "obj_parser.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -15,7 +20,9 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <chrono>
+#include <cmath>
 #include <random>
+#include <thread>
 
 VKAPI_ATTR VkBool32 VKAPI_CALL DebugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity, VkDebugUtilsMessageTypeFlagsEXT messageType, const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData, void* pUserData) {
     if (messageSeverity >= VkDebugUtilsMessageSeverityFlagBitsEXT::VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT) {
@@ -196,16 +203,18 @@ void VulkanGraphics::DestroySwapchain() {
         vkDestroyFramebuffer(vulkan_device_, framebuffer, nullptr);
     }
 
-    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        vkDestroySemaphore(vulkan_device_, sem_image_available_[i], nullptr);
-        vkDestroySemaphore(vulkan_device_, sem_render_finished_[i], nullptr);
-        vkDestroyFence(vulkan_device_, fence_in_flight_[i], nullptr);
+    // Offscreen targets are owned by us instead of the swapchain
+    if (headless_) {
+        for (int i = 0; i < swapchain_data_.images.size(); i++) {
+            DestroyImage(memory_allocator_, vulkan_device_, swapchain_data_.images[i], offscreen_memory_[i]);
+        }
+        swapchain_data_.images.clear();
+        offscreen_memory_.clear();
     }
 
     // Destroy depth images
     vkDestroyImageView(vulkan_device_, depth_image_view_, nullptr);
-    vkDestroyImage(vulkan_device_, depth_image_, nullptr);
-    vkFreeMemory(vulkan_device_, depth_image_memory_, nullptr);
+    DestroyImage(memory_allocator_, vulkan_device_, depth_image_, depth_image_memory_);
 }
 
 void VulkanGraphics::SetValidationLayers(VkInstanceCreateInfo& create_info) {
@@ -216,20 +225,48 @@ void VulkanGraphics::SetValidationLayers(VkInstanceCreateInfo& create_info) {
 }
 
 void VulkanGraphics::Edulcorate() {
+    // Initialization stopped before the device was created
+    if (vulkan_device_ == VK_NULL_HANDLE) {
+        if (vulkan_surface_) {
+            vkDestroySurfaceKHR(instance_, vulkan_surface_, nullptr);
+        }
+        DestroyDebugUtilsMessengerEXT(instance_, debug_messenger_, nullptr);
+        vkDestroyInstance(instance_, nullptr);
+        return;
+    }
+
     vkDeviceWaitIdle(vulkan_device_);
 
+    // Finishes outstanding uploads and releases the staging ring
+    upload_manager_.LogStatistics();
+    upload_manager_.Destroy();
+    LogCullingStatistics();
+    LogFrameTimingStatistics();
+    if (cache_command_buffers_) {
+        LOG << "Command buffer cache: " << command_cache_statistics_.recorded << " frames recorded, " << command_cache_statistics_.reused << " reused";
+    }
+    if (render_queue_statistics_.draws > 0) {
+        LOG << "Render queue: " << render_queue_statistics_.draws << " draws recorded with " << render_queue_statistics_.binds << " state commands, "
+            << render_queue_statistics_.binds_saved << " saved by sorting and redundant bind elimination";
+    }
+
     DestroySwapchain();
+    DestroySyncObjects();
 
     if (vulkan_surface_) {
         vkDestroySurfaceKHR(instance_, vulkan_surface_, nullptr);
     }
 
     vkDestroyRenderPass(vulkan_device_, render_pass_, nullptr);
-    vkDestroyPipeline(vulkan_device_, pipeline_, nullptr);
+    // Waits for variants still compiling, pipeline_ is one of them
+    pipeline_registry_.LogStatistics();
+    pipeline_registry_.Destroy();
+    shader_loader_.LogStatistics();
+    shader_loader_.DestroyCreatedShaderModules(vulkan_device_, nullptr);
     vkDestroyPipelineLayout(vulkan_device_, pipeline_layout_, nullptr);
     DestroyDebugUtilsMessengerEXT(instance_, debug_messenger_, nullptr);
-    vkDestroyDescriptorSetLayout(vulkan_device_, descriptor_set_layout_, nullptr);
-    vkDestroyDescriptorPool(vulkan_device_, descriptor_pool_, nullptr);
+    bindless_.LogStatistics();
+    bindless_.Destroy();
 
     // Destroy vertex and index buffers
     //vkDestroyBuffer(vulkan_device_, triangle_buffer_, nullptr);
@@ -242,29 +279,44 @@ void VulkanGraphics::Edulcorate() {
     // Destroy image views
     vkDestroyImageView(vulkan_device_, texture_image_view_, nullptr);
     // Destroy images
-    vkDestroyImage(vulkan_device_, texture_image_, nullptr);
-    vkFreeMemory(vulkan_device_, texture_image_memory_, nullptr);
+    DestroyImage(memory_allocator_, vulkan_device_, texture_image_, texture_image_memory_);
 
     // Destroy MSAA image
     vkDestroyImageView(vulkan_device_, color_image_view_, nullptr);
-    vkDestroyImage(vulkan_device_, color_image_, nullptr);
-    vkFreeMemory(vulkan_device_, color_image_memory_, nullptr);
+    DestroyImage(memory_allocator_, vulkan_device_, color_image_, color_image_memory_);
 
     // Depth image is destroyed with the swapchain
 
+    DestroyBuffer(memory_allocator_, vulkan_device_, readback_buffer_, readback_memory_);
+
     // Destroy uniform buffers
-    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        vkDestroyBuffer(vulkan_device_, uniform_buffers_[i], nullptr);
-        vkFreeMemory(vulkan_device_, uniform_memory_[i], nullptr);
+    for (int i = 0; i < frames_in_flight_; i++) {
+        DestroyBuffer(memory_allocator_, vulkan_device_, uniform_buffers_[i], uniform_memory_[i]);
+    }
+    for (size_t i = 0; i < instance_buffers_.size(); i++) {
+        DestroyBuffer(memory_allocator_, vulkan_device_, instance_buffers_[i], instance_memory_[i]);
     }
 
     // TODO Resource manager that tracks handles
     //for (int i = 0; i < models.size(); i++) {
     // Only destroy one time since all models share the same buffer and emmory handles
-    backpack::DestroyModel(vulkan_device_, &models[0]);
+    if (!models.empty()) {
+        backpack::DestroyModel(memory_allocator_, vulkan_device_, &models[0]);
+    }
     //}
 
+    DestroyCommandCache();
     vkDestroyCommandPool(vulkan_device_, command_pool_, nullptr);
+    DestroyRecordingSlots();
+
+    DestroyCullingResources();
+
+    memory_allocator_.LogStatistics();
+    memory_allocator_.Destroy();
+
+    // Written back after all pipelines ran, so it holds everything this run compiled
+    pipeline_cache_.LogStatistics();
+    pipeline_cache_.Destroy();
 
 
     vkDeviceWaitIdle(vulkan_device_);
@@ -275,12 +327,18 @@ void VulkanGraphics::Edulcorate() {
 }
 
 void VulkanGraphics::CreateVulkanSurface(const WindowData& window_data) {
+#ifdef WIN32
     VkWin32SurfaceCreateInfoKHR surface_create_info{};
     surface_create_info.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
     surface_create_info.hinstance = window_data.hinstance;
     surface_create_info.hwnd = window_data.hwnd;
 
     VkResult res = vkCreateWin32SurfaceKHR(instance_, &surface_create_info, nullptr, &vulkan_surface_);
+#else
+    // Let the window create a surface for the platform it runs on
+    vulkan_surface_ = app_window_->CreateVulkanWindowSurface(instance_);
+    VkResult res = vulkan_surface_ != VK_NULL_HANDLE ? VK_SUCCESS : VK_ERROR_INITIALIZATION_FAILED;
+#endif // WIN32
     if (res == VK_SUCCESS) {
         LOG << "SUCCESS\t Create Vulkan surface";
     }
@@ -290,11 +348,16 @@ void VulkanGraphics::CreateVulkanSurface(const WindowData& window_data) {
 }
 
 std::vector<const char*> VulkanGraphics::GetRequiredInstanceExtensions() {
-    uint32_t glfw_extension_count = 0;
-    const char** glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
+    std::vector<const char*> extensions;
+
+    // Surface extensions are only needed when presenting to a window
+    if (!headless_) {
+        uint32_t glfw_extension_count = 0;
+        const char** glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
+        extensions.assign(glfw_extensions, glfw_extensions + glfw_extension_count);
+    }
 
     // Add debug messages when validation layers are enabled
-    std::vector<const char*> extensions(glfw_extensions, glfw_extensions + glfw_extension_count);
     if (enable_validation_layers_) {
         extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
     }
@@ -332,7 +395,7 @@ void VulkanGraphics::PopulateDebugMessengerCreateInfoStruct(VkDebugUtilsMessenge
     //createInfo.pfnUserCallback;
 }
 
-void VulkanGraphics::SelectPhysicalDevice() {
+bool VulkanGraphics::SelectPhysicalDevice() {
     LOG << "Searching for physical device";
 
     uint32_t device_count;
@@ -348,18 +411,23 @@ void VulkanGraphics::SelectPhysicalDevice() {
         VkPhysicalDeviceProperties device_properties;
         vkGetPhysicalDeviceProperties(device, &device_properties);
 
-        uint32_t score = DetermineDeviceScore(device);
-
+        // Devices that lack a queue, an extension or a feature the renderer enables are never picked
         if (!IsDeviceSuitable(device)) {
-            LOG << device_properties.deviceName << score << "\tUNSUITABLE";
-            score = 0;
+            LOG << "FOUND\t Physical device " << device_properties.deviceName << "\tUNSUITABLE";
+            continue;
         }
 
+        uint32_t score = DetermineDeviceScore(device);
         device_scores.insert({ score, device });
         LOG << "FOUND\t Physical device " << device_properties.deviceName << " score: " << score;
     }
 
-    selected_device_ = device_scores.begin()->second;
+    if (device_scores.empty()) {
+        LOG << "FAILURE\t No suitable physical device";
+        return false;
+    }
+    // The map is ordered by score, the best device is the last one
+    selected_device_ = device_scores.rbegin()->second;
 
     VkPhysicalDeviceProperties device_properties;
     vkGetPhysicalDeviceProperties(selected_device_, &device_properties);
@@ -368,6 +436,7 @@ void VulkanGraphics::SelectPhysicalDevice() {
     device_sample_count = GetDeviceSampleCount(selected_device_);
 
     LOG << "SELECTED\t Physical device" << device_properties.deviceName;
+    return true;
 }
 
 QueueFamilyIndices VulkanGraphics::FindQueueFamilies(VkPhysicalDevice device) {
@@ -386,6 +455,20 @@ QueueFamilyIndices VulkanGraphics::FindQueueFamilies(VkPhysicalDevice device) {
             indices.graphics_index = i;
         }
 
+        // A transfer-only family usually maps to a DMA engine that copies while the graphics queue renders
+        VkQueueFlags family_flags = family_properties[i].queueFlags;
+        if (family_flags & VK_QUEUE_TRANSFER_BIT && !(family_flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+            indices.transfer_index = i;
+        }
+
+        // Nothing is presented when headless, so the graphics queue is also used as present queue
+        if (headless_) {
+            if (indices.graphics_index.has_value()) {
+                indices.present_index = indices.graphics_index;
+            }
+            continue;
+        }
+
         VkBool32 present_supported = false;
         vkGetPhysicalDeviceSurfaceSupportKHR(device, i, vulkan_surface_, &present_supported);
         if (present_supported) {
@@ -428,16 +511,22 @@ bool VulkanGraphics::IsDeviceSuitable(VkPhysicalDevice device) {
     bool extensions_supported = CheckDeviceExtensionSupport(device);
 
     // Only check swapchain if extensions are supported, swapchain support is an extension
-    bool swapchain_adequate = false;
-    if (extensions_supported) {
+    bool swapchain_adequate = headless_;
+    if (!extensions_supported) {
+        LOG << "Extensions not supported, no swapchain support";
+    }
+    else if (!headless_) {
         SwapChainDetails sw_details = QuerySwapchainSupport(device);
         swapchain_adequate = !sw_details.formats.empty() && !sw_details.present_modes.empty();
     }
-    else {
-        LOG << "Extensions not supported, no swapchain support";
+
+    // Every draw reads its textures and buffers through the bindless set
+    bool bindless_supported = IsBindlessSupported(device);
+    if (!bindless_supported) {
+        LOG << "Descriptor indexing not supported, no bindless descriptors";
     }
 
-    bool success = queues_found && extensions_supported && swapchain_adequate;
+    bool success = queues_found && extensions_supported && swapchain_adequate && bindless_supported;
     if (!success) {
         LOG << "FAILURE\t Device is not suitable";
     }
@@ -455,6 +544,9 @@ void VulkanGraphics::CreateLogicalDevice() {
 
     std::vector<VkDeviceQueueCreateInfo> device_queues;
     std::set<uint32_t> queues_to_create{ indices.graphics_index.value(), indices.present_index.value() };
+    if (indices.transfer_index.has_value()) {
+        queues_to_create.insert(indices.transfer_index.value());
+    }
 
     // Populate queue creation structs for each queue to be created
     float queue_priority = 1.0f;
@@ -474,9 +566,34 @@ void VulkanGraphics::CreateLogicalDevice() {
     // Set the amount of samples used per fragment https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap28.html#primsrast-sampleshading
     device_features.sampleRateShading = VK_TRUE;
 
+    // Uploads signal timeline semaphores, core since Vulkan 1.2
+    VkPhysicalDeviceVulkan12Features vulkan12_features{};
+    vulkan12_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    vulkan12_features.timelineSemaphore = VK_TRUE;
+    // Checked by IsDeviceSuitable
+    EnableBindlessFeatures(device_features, vulkan12_features);
+
+    // GPU culling draws every mesh with one indirect count call, each draw finds its object through firstInstance
+    VkPhysicalDeviceVulkan12Features supported_vulkan12_features{};
+    supported_vulkan12_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    VkPhysicalDeviceFeatures2 supported_features{};
+    supported_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    supported_features.pNext = &supported_vulkan12_features;
+    vkGetPhysicalDeviceFeatures2(selected_device_, &supported_features);
+    if (gpu_culling_ && supported_vulkan12_features.drawIndirectCount && supported_features.features.multiDrawIndirect && supported_features.features.drawIndirectFirstInstance) {
+        vulkan12_features.drawIndirectCount = VK_TRUE;
+        device_features.multiDrawIndirect = VK_TRUE;
+        device_features.drawIndirectFirstInstance = VK_TRUE;
+    }
+    else if (gpu_culling_) {
+        LOG << "WARNING\t Device doesn't support indirect count draws, culling on the CPU";
+        gpu_culling_ = false;
+    }
+
     // Create device create info struct
     VkDeviceCreateInfo device_create_info{};
     device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    device_create_info.pNext = &vulkan12_features;
     device_create_info.pQueueCreateInfos = device_queues.data();
     device_create_info.queueCreateInfoCount = static_cast<uint32_t>(device_queues.size());
     device_create_info.pEnabledFeatures = &device_features;
@@ -504,6 +621,23 @@ void VulkanGraphics::CreateLogicalDevice() {
     // Get created queues from the device
     vkGetDeviceQueue(vulkan_device_, indices.graphics_index.value(), 0, &device_queues_.graphics_queue);
     vkGetDeviceQueue(vulkan_device_, indices.present_index.value(), 0, &device_queues_.present_queue);
+
+    // Without a dedicated family uploads are submitted to the graphics queue
+    graphics_family_index_ = indices.graphics_index.value();
+    transfer_family_index_ = indices.transfer_index.value_or(graphics_family_index_);
+    vkGetDeviceQueue(vulkan_device_, transfer_family_index_, 0, &device_queues_.transfer_queue);
+}
+
+void VulkanGraphics::SetRequiredDeviceExtensions() {
+    // Offscreen rendering doesn't need a swapchain, which software drivers without a display may not expose
+    if (!headless_) {
+        required_device_extensions_.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
+
+#ifdef WIN32
+    required_device_extensions_.push_back("VK_KHR_external_memory_win32");
+    required_device_extensions_.push_back("VK_KHR_external_semaphore_win32");
+#endif // WIN32
 }
 
 void VulkanGraphics::ResizeBuffer(uint32_t width, uint32_t height) {
@@ -595,12 +729,22 @@ VkSurfaceFormatKHR VulkanGraphics::GetPreferredSwapchainSurfaceFormat(const std:
 }
 
 VkPresentModeKHR VulkanGraphics::GetPreferredSwapchainPresentMode(const std::vector<VkPresentModeKHR>& present_modes) {
+    // PACED limits the frame rate on the CPU and presents with FIFO like VSYNC
+    VkPresentModeKHR policy_mode = VK_PRESENT_MODE_FIFO_KHR;
+    if (present_policy_ == BP_PresentPolicy::LOW_LATENCY) {
+        policy_mode = VK_PRESENT_MODE_MAILBOX_KHR;
+    }
+    else if (present_policy_ == BP_PresentPolicy::THROUGHPUT) {
+        policy_mode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+    }
+
+    // FIFO is the only mode every surface has to support
     VkPresentModeKHR preferred_mode = VK_PRESENT_MODE_FIFO_KHR;
-    for (const VkPresentModeKHR& mode : present_modes) {
-        if (mode == VK_PRESENT_MODE_MAILBOX_KHR) {
-            preferred_mode = VK_PRESENT_MODE_MAILBOX_KHR;
-            break;
-        }
+    if (std::find(present_modes.begin(), present_modes.end(), policy_mode) != present_modes.end()) {
+        preferred_mode = policy_mode;
+    }
+    else {
+        LOG << "WARNING\t Present mode of the " << GetPresentPolicyName(present_policy_) << " policy not supported, using FIFO";
     }
 
     switch (preferred_mode) {
@@ -677,14 +821,14 @@ VkFormat VulkanGraphics::FindDepthFormat() {
     //Don't use VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT here!
 }
 
-bool VulkanGraphics::CreateSwapchain(const WindowData& window_data, VkPhysicalDevice device) {
+bool VulkanGraphics::CreateSwapchain(const WindowData& window_data, VkPhysicalDevice device, VkSwapchainKHR old_swapchain) {
     SwapChainDetails sw_detail = QuerySwapchainSupport(device);
     VkSurfaceFormatKHR sw_format = GetPreferredSwapchainSurfaceFormat(sw_detail.formats);
     VkPresentModeKHR sw_present_mode = GetPreferredSwapchainPresentMode(sw_detail.present_modes);
     VkExtent2D sw_extend = GetPreferredSwapchainExtend(window_data, sw_detail.capabilities);
 
-    // Image count is minimum + 1 or the maximum
-    uint32_t sw_image_count = sw_detail.capabilities.minImageCount + 1;
+    // Image count is minimum + 1 or the maximum, more frames in flight need an image each to get ahead of the display
+    uint32_t sw_image_count = std::max(sw_detail.capabilities.minImageCount + 1, frames_in_flight_);
     if (sw_detail.capabilities.maxImageCount > 0 && sw_image_count > sw_detail.capabilities.maxImageCount) {
         sw_image_count = sw_detail.capabilities.maxImageCount;
     }
@@ -729,7 +873,8 @@ bool VulkanGraphics::CreateSwapchain(const WindowData& window_data, VkPhysicalDe
 
     sw_create_info.presentMode = sw_present_mode;
     sw_create_info.clipped = VK_TRUE;
-    sw_create_info.oldSwapchain = VK_NULL_HANDLE;
+    // Lets the implementation hand resources over, the old swapchain is retired even when the creation fails
+    sw_create_info.oldSwapchain = old_swapchain;
 
     VkResult res = vkCreateSwapchainKHR(vulkan_device_, &sw_create_info, nullptr, &swapchain_data_.swapchain);
     if (res == VK_SUCCESS) {
@@ -755,6 +900,25 @@ bool VulkanGraphics::CreateSwapchain(const WindowData& window_data, VkPhysicalDe
     return true;
 }
 
+bool VulkanGraphics::CreateOffscreenTargets(uint32_t width, uint32_t height) {
+    // Same format the swapchain prefers so the render pass and pipeline are identical to the windowed path
+    swapchain_data_.swapchain = VK_NULL_HANDLE;
+    swapchain_data_.format = VK_FORMAT_B8G8R8A8_SRGB;
+    swapchain_data_.extent = { width, height };
+
+    // One target per frame in flight, so a frame can be read back while the next one renders
+    swapchain_data_.images.resize(frames_in_flight_);
+    offscreen_memory_.resize(frames_in_flight_);
+    for (int i = 0; i < frames_in_flight_; i++) {
+        CreateImage(memory_allocator_, width, height, 1, swapchain_data_.format, VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            vulkan_device_, swapchain_data_.images[i], offscreen_memory_[i]);
+    }
+
+    LOG << "SUCCESS\t Created " << frames_in_flight_ << " offscreen targets " << width << "x" << height;
+    return true;
+}
+
 bool VulkanGraphics::CreateImageViews() {
     // For 3D and multiple swapchain image layers, view would have to be created for each layer as well
     uint32_t count = swapchain_data_.images.size();
@@ -812,7 +976,8 @@ void VulkanGraphics::CreateRenderPass() {
     color_resolve_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     color_resolve_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     color_resolve_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    color_resolve_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    // Offscreen targets are copied to host memory after rendering instead of presented
+    color_resolve_attachment.finalLayout = headless_ ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
     std::array<VkAttachmentDescription, 3> attachments{ color_attachment, depth_attachment, color_resolve_attachment };
 
@@ -875,191 +1040,49 @@ void VulkanGraphics::CreateRenderPass() {
     }
 }
 
-void VulkanGraphics::CreateDescriptorSetLayout() {
-    // A descriptor set layout let's a shader access certain data.
-    // It can contain multiple bindings with different types of data in each binding.
-    // In the shader, these bindings are then explicitly declared as well.
-
-    // Tell the shader what type of object it can access, it's binding position and in which shader stage
-    // In this case it's a uniform buffer and combined image sampler
-    VkDescriptorSetLayoutBinding binding0{};
-    binding0.binding = 0;
-    binding0.descriptorCount = 1;
-    binding0.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    binding0.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-    binding0.pImmutableSamplers = nullptr;
-
-    VkDescriptorSetLayoutBinding binding1{};
-    binding1.binding = 1;
-    binding1.descriptorCount = 1;
-    binding1.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    binding1.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-    binding1.pImmutableSamplers = nullptr;
-
-    // Create info holds a list of layout bindings
-    std::array<VkDescriptorSetLayoutBinding, 2> bindings{ binding0, binding1 };
-    VkDescriptorSetLayoutCreateInfo create_info{};
-    create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    create_info.bindingCount = static_cast<uint32_t>(bindings.size());
-    create_info.pBindings = bindings.data();
-
-    VkResult res = vkCreateDescriptorSetLayout(vulkan_device_, &create_info, nullptr, &descriptor_set_layout_);
-    if (res != VK_SUCCESS) {
-        LOG << "FAILURE\t Failed to create descriptor seet layout, error:" << res;
+void VulkanGraphics::CreateBindlessDescriptors() {
+    // One set for all draws instead of a set per frame. Textures and buffers are added to its arrays as they are
+    // created, a draw finds them through the indices in its push constants
+    if (!bindless_.Initialize(selected_device_, vulkan_device_)) {
+        LOG << "FAILURE\t Couldn't create the bindless descriptors";
     }
 }
 
+void VulkanGraphics::SelectVertexLayout() {
+    if (vertex_layout_ != backpack::VertexLayout::FULL && !backpack::IsVertexLayoutSupported(selected_device_, vertex_layout_)) {
+        LOG << "WARNING\t Device can't read " << backpack::GetVertexLayoutName(vertex_layout_) << " vertices, using full vertices";
+        vertex_layout_ = backpack::VertexLayout::FULL;
+    }
+    LOG << "Using " << backpack::GetVertexLayoutName(vertex_layout_) << " vertex layout, " << backpack::GetVertexStride(vertex_layout_) << " bytes per vertex";
+}
+
+BP_PipelineDescription VulkanGraphics::GetPipelineDescription(const std::string& vertex_shader, bool instanced) const {
+    BP_PipelineDescription description;
+    description.vertex_shader = vertex_shader;
+    description.fragment_shader = "../src/shaders/f_triangle.spv";
+    description.vertex_layout = vertex_layout_;
+    description.instanced = instanced;
+    description.render_pass = render_pass_;
+    description.layout = pipeline_layout_;
+    description.state.samples = device_sample_count;
+    description.fragment_constants.SetFloat(FRAGMENT_CONSTANT_TEXTURE_MIX, settings_.texture_mix);
+    description.fragment_constants.SetBool(FRAGMENT_CONSTANT_USE_TEXTURE, settings_.textured);
+    return description;
+}
+
 void VulkanGraphics::CreateGraphicsPipeline() {
-    // Load shaders
-    VulkanShaderLoader shader_loader;
-    VkShaderModule vertex_shader = shader_loader.CreateShaderModule(shader_loader.LoadShader("..\\src\\shaders\\v_triangle.spv"), vulkan_device_, nullptr);
-    VkShaderModule fragment_shader = shader_loader.CreateShaderModule(shader_loader.LoadShader("..\\src\\shaders\\f_triangle.spv"), vulkan_device_, nullptr);
-
-    // Initialize shader stages
-    VkPipelineShaderStageCreateInfo vertex_pipeline{};
-    vertex_pipeline.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    vertex_pipeline.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vertex_pipeline.module = vertex_shader;
-    vertex_pipeline.pName = "main";
-
-    VkPipelineShaderStageCreateInfo fragment_pipeline{};
-    fragment_pipeline.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    fragment_pipeline.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    fragment_pipeline.module = fragment_shader;
-    fragment_pipeline.pName = "main";
-
-    VkPipelineShaderStageCreateInfo shader_stages[]{ vertex_pipeline, fragment_pipeline };
-
-    // Create Vertex input pipeline state
-    VkVertexInputBindingDescription binding_desc = backpack::GetVertexBindingDescription();
-    auto attribute_desc_array = backpack::GetVertexAttributeDescription();
-
-    VkPipelineVertexInputStateCreateInfo vertex_input_pipeline_state{};
-    vertex_input_pipeline_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertex_input_pipeline_state.pVertexBindingDescriptions = &binding_desc;
-    vertex_input_pipeline_state.pVertexAttributeDescriptions = attribute_desc_array.data();
-    vertex_input_pipeline_state.vertexBindingDescriptionCount = 1;
-    vertex_input_pipeline_state.vertexAttributeDescriptionCount = static_cast<uint32_t>(attribute_desc_array.size());
-
-    // Add dynamic states to the pipeline
-    // Viewport and scissor allow changing these settings at render time
-    uint32_t dynamic_state_count = 2;
-    VkDynamicState dynamic_states[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
-
-    // Define dynamic stages of the pipeline
-    VkPipelineDynamicStateCreateInfo dynamic_pipeline_state{};
-    dynamic_pipeline_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    dynamic_pipeline_state.pDynamicStates = &dynamic_states[0];
-    dynamic_pipeline_state.dynamicStateCount = dynamic_state_count;
-
-    // Define how the vertex data should be interpreted
-    VkPipelineInputAssemblyStateCreateInfo input_assembly_state{};
-    input_assembly_state.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    input_assembly_state.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    input_assembly_state.primitiveRestartEnable = VK_FALSE;
-
-    // Define the viewport
-    VkViewport viewport{};
-    viewport.x = 0;
-    viewport.y = 0;
-    viewport.width = swapchain_data_.extent.width;
-    viewport.height = swapchain_data_.extent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-
-    // Define scissor
-    VkRect2D scissor{};
-    scissor.offset = VkOffset2D{ 0, 0 };
-    scissor.extent = swapchain_data_.extent;
-
-    VkPipelineViewportStateCreateInfo viewport_state{};
-    viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    viewport_state.pViewports = &viewport;
-    viewport_state.viewportCount = 1;
-    viewport_state.pScissors = &scissor;
-    viewport_state.scissorCount = 1;
-
-    // Create rasterize state
-    VkPipelineRasterizationStateCreateInfo rasterizer_state{};
-    rasterizer_state.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterizer_state.depthClampEnable = VK_FALSE; // Clamps fragments outside the near-and-far plane to them. Requires enabling a GPU feature.
-    rasterizer_state.rasterizerDiscardEnable = VK_FALSE; // Discards geometry
-
-    // Face culling
-    rasterizer_state.polygonMode = VK_POLYGON_MODE_FILL; // Using any mode other than fill requires enabling a GPU feature.
-    rasterizer_state.lineWidth = 1.0f;
-    rasterizer_state.cullMode = VK_CULL_MODE_NONE;
-    rasterizer_state.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-
-    // Depth settings
-    rasterizer_state.depthClampEnable = VK_FALSE;
-    rasterizer_state.depthBiasConstantFactor = 0.0f;
-    rasterizer_state.depthBiasClamp = 0.0f;
-    rasterizer_state.depthBiasConstantFactor = 0.0f;
-
-    // Create Multisampling state
-    VkPipelineMultisampleStateCreateInfo multisampling_state{};
-    multisampling_state.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    multisampling_state.sampleShadingEnable = VK_TRUE; // Enable sample shading in the pipeline
-    multisampling_state.minSampleShading = .2f; // Min fraction for sample shading; closer to one is smooth
-    multisampling_state.rasterizationSamples = device_sample_count;
-    multisampling_state.pSampleMask = nullptr;
-    multisampling_state.alphaToCoverageEnable = VK_FALSE;
-    multisampling_state.alphaToOneEnable = VK_FALSE;
-
-    // Depth testing
-
-    // Framebuffer color blending attachment
-    // Each framebuffer should have an attachment, a list of the attachments are being passed to the creation struct
-    VkPipelineColorBlendAttachmentState color_blend_attachment{};
-    color_blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    color_blend_attachment.blendEnable = VK_FALSE;
-    color_blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_CONSTANT_ALPHA;
-    color_blend_attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-    color_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
-    color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-    color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-    color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
-
-    // Create color blending state for all frame buffers
-    VkPipelineColorBlendStateCreateInfo color_blend_state{};
-    color_blend_state.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    color_blend_state.logicOpEnable = VK_FALSE;
-    color_blend_state.logicOp = VK_LOGIC_OP_COPY;
-    color_blend_state.attachmentCount = 1;
-    color_blend_state.pAttachments = &color_blend_attachment; // pass attachments
-    color_blend_state.blendConstants[0] = 0.0f;
-    color_blend_state.blendConstants[1] = 0.0f;
-    color_blend_state.blendConstants[2] = 0.0f;
-    color_blend_state.blendConstants[3] = 0.0f;
-
-    VkPipelineDepthStencilStateCreateInfo depth_stencil_state{};
-    depth_stencil_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-    depth_stencil_state.depthTestEnable = true;
-    depth_stencil_state.depthWriteEnable = true;
-
-    depth_stencil_state.depthCompareOp = VK_COMPARE_OP_LESS;
-
-    // Bounds the depth buffer should be within
-    depth_stencil_state.depthBoundsTestEnable = VK_FALSE;
-    depth_stencil_state.maxDepthBounds = 1.0f;
-    depth_stencil_state.maxDepthBounds = 0.0f;
-
-    depth_stencil_state.stencilTestEnable = VK_FALSE;
-    depth_stencil_state.front = {};
-    depth_stencil_state.back = {};
-
-    // Push constant only accessible in the vertex shader. Giving matrix to shaders
+    // Giving matrix to the vertex shader and the bindless indices to both stages
     VkPushConstantRange mesh_push_constant{};
     mesh_push_constant.size = sizeof(MeshPushConstants);
     mesh_push_constant.offset = 0;
-    mesh_push_constant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    mesh_push_constant.stageFlags = RENDER_QUEUE_PUSH_CONSTANT_STAGES;
 
     // Describes the uniform data used in shaders
     VkPipelineLayoutCreateInfo pipeline_layout_info{};
     pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    VkDescriptorSetLayout bindless_layout = bindless_.GetLayout();
     pipeline_layout_info.setLayoutCount = 1;
-    pipeline_layout_info.pSetLayouts = &descriptor_set_layout_;
+    pipeline_layout_info.pSetLayouts = &bindless_layout;
     pipeline_layout_info.pPushConstantRanges = &mesh_push_constant;
     pipeline_layout_info.pushConstantRangeCount = 1;
 
@@ -1070,34 +1093,72 @@ void VulkanGraphics::CreateGraphicsPipeline() {
         LOG << "Failure\t Couldn't create pipeline layout";
     }
 
-    // Create graphics pipeline
-    VkGraphicsPipelineCreateInfo graphics_pipeline_info{};
-    graphics_pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    graphics_pipeline_info.stageCount = 2;
-    graphics_pipeline_info.pStages = shader_stages;
-    graphics_pipeline_info.pVertexInputState = &vertex_input_pipeline_state;
-    graphics_pipeline_info.pInputAssemblyState = &input_assembly_state;
-    graphics_pipeline_info.pRasterizationState = &rasterizer_state;
-    graphics_pipeline_info.pMultisampleState = &multisampling_state;
-    graphics_pipeline_info.pDepthStencilState = &depth_stencil_state;
-    graphics_pipeline_info.pColorBlendState = &color_blend_state;
-    graphics_pipeline_info.pDynamicState = &dynamic_pipeline_state;
-    graphics_pipeline_info.pViewportState = &viewport_state;
-
-    graphics_pipeline_info.layout = pipeline_layout_;
-    graphics_pipeline_info.renderPass = render_pass_;
-    graphics_pipeline_info.subpass = 0; // Specify the subpass where this graphics pipeline will be used
-    graphics_pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
-    graphics_pipeline_info.basePipelineIndex = -1;
-
-    if (vkCreateGraphicsPipelines(vulkan_device_, VK_NULL_HANDLE, 1, &graphics_pipeline_info, nullptr, &pipeline_) == VK_SUCCESS) {
+    pipeline_registry_.Initialize(vulkan_device_, &pipeline_cache_, &shader_loader_, &thread_pool_);
+
+    // Requested first so a worker picks it up right away, the first frame can't be drawn without it
+    object_variant_ = pipeline_registry_.Request(GetPipelineDescription("../src/shaders/v_triangle.spv", false));
+
+    // Same state with a vertex shader that reads the object transforms written for the culling pass. The shaders are
+    // compiled with the renderer, so the variant only fails on a broken build and frames keep the per object path then
+    if (gpu_culling_) {
+        indirect_variant_ = pipeline_registry_.Request(GetPipelineDescription("../src/shaders/v_triangle_indirect.spv", false));
+    }
+
+    // Same state with the transforms of the instances as second vertex binding
+    instanced_variant_ = pipeline_registry_.Request(GetPipelineDescription("../src/shaders/v_triangle_instanced.spv", true));
+
+    // The other variants keep compiling while the models load, frames draw per object until they are ready
+    if (pipeline_registry_.Wait(object_variant_)) {
+        pipeline_ = pipeline_registry_.GetPipeline(object_variant_);
         LOG << "SUCCESS\t Created graphics pipeline";
     }
     else {
         LOG << "Failure\t Couldn't create graphics pipeline";
     }
+}
+
+void VulkanGraphics::UpdatePipelines() {
+    // Polled, file change notifications work differently on every platform
+    if (settings_.watch_shaders) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now >= next_shader_check_) {
+            next_shader_check_ = now + std::chrono::milliseconds(SHADER_CHECK_INTERVAL_MS);
+            for (const std::string& path : shader_loader_.CheckForChanges(vulkan_device_)) {
+                uint32_t users = pipeline_registry_.RebuildShaderUsers(path);
+                // The culling pipelines are not in the registry, they are small enough to rebuild right here
+                if (path == CULLING_SHADER) {
+                    uint32_t rebuilt = RebuildCullingPipelines();
+                    users += rebuilt;
+                    if (rebuilt > 0) {
+                        draw_list_version_++;
+                    }
+                }
+                LOG << "Rebuilding " << users << " pipelines that use " << path;
+            }
+        }
+    }
 
-    shader_loader.DestroyCreatedShaderModules(vulkan_device_, nullptr);
+    if (pipeline_registry_.Update(frame_clock_) > 0) {
+        // The per object pipeline may have been replaced as well
+        pipeline_ = pipeline_registry_.GetPipeline(object_variant_, pipeline_);
+        draw_list_version_++;
+    }
+}
+
+void VulkanGraphics::SelectDrawPath() {
+    BP_DrawPath draw_path = BP_DrawPath::PER_OBJECT;
+    if (gpu_culling_ && pipeline_registry_.GetStatus(indirect_variant_) == BP_PipelineStatus::READY) {
+        draw_path = BP_DrawPath::GPU_CULLED;
+    }
+    else if (pipeline_registry_.GetStatus(instanced_variant_) == BP_PipelineStatus::READY) {
+        draw_path = BP_DrawPath::INSTANCED;
+    }
+
+    if (draw_path != draw_path_) {
+        LOG << "Drawing with the " << GetDrawPathName(draw_path) << " path";
+        draw_path_ = draw_path;
+        draw_list_version_++;
+    }
 }
 
 void VulkanGraphics::CreateFramebuffers() {
@@ -1157,41 +1218,43 @@ void VulkanGraphics::CreateDepthResources() {
 
     FormatHasStencilComponent(depth_format);
 
-    // Create device image
-    CreateImage(swapchain_data_.extent.width, swapchain_data_.extent.height, 1, depth_format, VK_IMAGE_TILING_OPTIMAL,
+    // Create device image, framebuffers may be smaller than their attachments so it's shared by the sizes of one step
+    VkExtent2D extent = GetRenderTargetExtent();
+    CreateImage(memory_allocator_, extent.width, extent.height, 1, depth_format, VK_IMAGE_TILING_OPTIMAL,
         VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        vulkan_device_, selected_device_, color_image_, depth_image_memory_, device_sample_count);
+        vulkan_device_, depth_image_, depth_image_memory_, device_sample_count);
 
-    depth_image_view_ = CreateImageView(vulkan_device_, color_image_, depth_format, 1, VK_IMAGE_VIEW_TYPE_2D, VK_IMAGE_ASPECT_DEPTH_BIT);
+    depth_image_view_ = CreateImageView(vulkan_device_, depth_image_, depth_format, 1, VK_IMAGE_VIEW_TYPE_2D, VK_IMAGE_ASPECT_DEPTH_BIT);
 }
 
 BP_Texture VulkanGraphics::CreateTextureImage() {
     // Load image
     int width, height, channels;
     uint32_t mip_levels;
-    VkBuffer image_staging_buffer;
-    VkDeviceMemory image_staging_memory;
-    size_t image_size = LoadTexture(vulkan_device_, selected_device_, image_staging_buffer, image_staging_memory, width, height, channels, mip_levels, VIKING_ROOM_T);
+    BP_StagingRegion image_staging;
+    size_t image_size = LoadTexture(upload_manager_, BP_UploadQueue::TRANSFER, image_staging, width, height, channels, mip_levels, VIKING_ROOM_T);
 
     // Usage is both src and dst for generating mipmaps
-    CreateImage(width, height, mip_levels, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        vulkan_device_, selected_device_, texture_image_, texture_image_memory_);
+    CreateImage(memory_allocator_, width, height, mip_levels, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        vulkan_device_, texture_image_, texture_image_memory_, VK_SAMPLE_COUNT_1_BIT, upload_manager_.GetSharingFamilies());
 
-    VkCommandBuffer cmd_buffer = BeginSingleTimeCommandBuffer(vulkan_device_, command_pool_);
-    CmdTransitionImageLayout(cmd_buffer, texture_image_, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mip_levels);
-    CmdCopyBufferToImage(cmd_buffer, image_staging_buffer, texture_image_, width, height);
-    CmdGenerateMipmaps(cmd_buffer, selected_device_, VK_FORMAT_R8G8B8A8_SRGB, texture_image_, width, height, mip_levels);
-    CmdTransitionImageLayout(cmd_buffer, texture_image_, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mip_levels);
-    EndSingleTimeCommandBuffer(vulkan_device_, device_queues_.graphics_queue, command_pool_, cmd_buffer);
+    // The copy runs on the transfer queue
+    VkCommandBuffer transfer_cmd = upload_manager_.GetCommandBuffer(BP_UploadQueue::TRANSFER);
+    CmdTransitionImageLayout(transfer_cmd, texture_image_, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mip_levels);
+    CmdCopyBufferToImage(transfer_cmd, image_staging.buffer, texture_image_, width, height, image_staging.offset);
 
-    vkDestroyBuffer(vulkan_device_, image_staging_buffer, nullptr);
-    vkFreeMemory(vulkan_device_, image_staging_memory, nullptr);
+    // Blitting needs a graphics queue, so mipmaps are generated once the copy finished
+    upload_manager_.AddWait(BP_UploadQueue::GRAPHICS, upload_manager_.GetCurrentTicket(BP_UploadQueue::TRANSFER));
+    VkCommandBuffer graphics_cmd = upload_manager_.GetCommandBuffer(BP_UploadQueue::GRAPHICS);
+    CmdGenerateMipmaps(graphics_cmd, selected_device_, VK_FORMAT_R8G8B8A8_SRGB, texture_image_, width, height, mip_levels);
+    CmdTransitionImageLayout(graphics_cmd, texture_image_, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mip_levels);
+    texture_upload_ticket_ = upload_manager_.GetCurrentTicket(BP_UploadQueue::GRAPHICS);
 
     // Create image view
     texture_image_view_ = CreateImageView(vulkan_device_, texture_image_, VK_FORMAT_R8G8B8A8_SRGB, mip_levels);
     BP_Texture bp_image;
     bp_image.image = texture_image_;
-    bp_image.memory = texture_image_memory_;
+    bp_image.allocation = texture_image_memory_;
     bp_image.mip_levels = mip_levels;
     bp_image.image_view = texture_image_view_;
     bp_image.format = VK_FORMAT_R8G8B8A8_SRGB;
@@ -1199,9 +1262,12 @@ BP_Texture VulkanGraphics::CreateTextureImage() {
 }
 
 BP_Texture VulkanGraphics::CreateColorResources() {
-    // Create multi-sampled buffer
-    CreateImage(swapchain_data_.extent.width, swapchain_data_.extent.height, 1, swapchain_data_.format, VkImageTiling::VK_IMAGE_TILING_OPTIMAL,
-        VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vulkan_device_, selected_device_,
+    // Create multi-sampled buffer, sized like the depth buffer
+    VkExtent2D extent = GetRenderTargetExtent();
+    render_target_extent_ = extent;
+    render_target_format_ = swapchain_data_.format;
+    CreateImage(memory_allocator_, extent.width, extent.height, 1, swapchain_data_.format, VkImageTiling::VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vulkan_device_,
         color_image_, color_image_memory_, device_sample_count);
 
     //Create image view for it
@@ -1211,7 +1277,7 @@ BP_Texture VulkanGraphics::CreateColorResources() {
     color.format = swapchain_data_.format;
     color.image = color_image_;
     color.image_view = color_image_view_;
-    color.memory = color_image_memory_;
+    color.allocation = color_image_memory_;
     color.mip_levels = 1;
 
     return color;
@@ -1260,20 +1326,21 @@ void VulkanGraphics::CreateTextureSampler(BP_Texture texture) {
 }
 
 void VulkanGraphics::CreateUniformBuffers() {
-    uniform_buffers_.resize(MAX_FRAMES_IN_FLIGHT);
-    uniform_memory_.resize(MAX_FRAMES_IN_FLIGHT);
-    uniform_mapped_memory_.resize(MAX_FRAMES_IN_FLIGHT);
+    uniform_buffers_.resize(frames_in_flight_);
+    uniform_memory_.resize(frames_in_flight_);
+    uniform_mapped_memory_.resize(frames_in_flight_);
 
     VkDeviceSize size = sizeof(UniformBufferObject);
 
-    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        CreateBuffer(vulkan_device_, selected_device_, size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, uniform_buffers_[i], uniform_memory_[i], VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-        vkMapMemory(vulkan_device_, uniform_memory_[i], 0, size, 0, &uniform_mapped_memory_[i]);
+    for (int i = 0; i < frames_in_flight_; i++) {
+        // Host visible blocks are persistently mapped by the allocator. Read as a storage buffer through the bindless set
+        CreateBuffer(memory_allocator_, vulkan_device_, size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, uniform_buffers_[i], uniform_memory_[i], VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        uniform_mapped_memory_[i] = uniform_memory_[i].mapped;
     }
 }
 
 void VulkanGraphics::CreateCommandBuffer() {
-    command_buffers_.resize(MAX_FRAMES_IN_FLIGHT);
+    command_buffers_.resize(frames_in_flight_);
 
     VkCommandBufferAllocateInfo allocate_info{};
     allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -1286,89 +1353,19 @@ void VulkanGraphics::CreateCommandBuffer() {
     }
 }
 
-void VulkanGraphics::CreateDescriptorPools() {
-    VkDescriptorPoolSize ubo_pool_size{};
-    ubo_pool_size.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    ubo_pool_size.descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-
-    VkDescriptorPoolSize sampler_pool_size{};
-    sampler_pool_size.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    sampler_pool_size.descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-
-    std::array<VkDescriptorPoolSize, 2> pool_sizes = { ubo_pool_size, sampler_pool_size };
-
-    VkDescriptorPoolCreateInfo info{};
-    info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    info.poolSizeCount = pool_sizes.size();
-    info.pPoolSizes = pool_sizes.data();
-    info.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-
-    VkResult res = vkCreateDescriptorPool(vulkan_device_, &info, nullptr, &descriptor_pool_);
-    if (res != VK_SUCCESS) {
-        LOG << "FAILURE\t Failed creatinf descriptor pool, error:" << res;
-    }
-}
-
-void VulkanGraphics::CreateDescriptorSets() {
-    // Create allocation info struct
-    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, descriptor_set_layout_);
-    VkDescriptorSetAllocateInfo alloc_info{};
-    alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    alloc_info.descriptorPool = descriptor_pool_;
-    alloc_info.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-    alloc_info.pSetLayouts = layouts.data();
+void VulkanGraphics::WriteBindlessDescriptors() {
+    texture_index_ = bindless_.AddTexture(texture_image_view_, texture_sampler_);
 
-    // Resize array
-    descriptor_sets_.resize(MAX_FRAMES_IN_FLIGHT);
-    VkResult res = vkAllocateDescriptorSets(vulkan_device_, &alloc_info, descriptor_sets_.data());
-    if (res != VK_SUCCESS) {
-        LOG << "FAILURE\t Failed creating descriptor sets, error:" << res;
+    uniform_indices_.resize(frames_in_flight_);
+    for (uint32_t i = 0; i < frames_in_flight_; i++) {
+        uniform_indices_[i] = bindless_.AddStorageBuffer(uniform_buffers_[i], 0, sizeof(UniformBufferObject));
     }
 
-    // Update every descriptor inside a descriptor-set with write structs
-    // This must be done for every descriptor set
-    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        std::array<VkWriteDescriptorSet, 2> descriptor_writes;
-
-        VkDescriptorBufferInfo buffer_info{};
-        buffer_info.buffer = uniform_buffers_[i];
-        buffer_info.offset = 0;
-        buffer_info.range = sizeof(UniformBufferObject);
-
-        VkDescriptorImageInfo image_info{};
-        image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        image_info.imageView = texture_image_view_;
-        image_info.sampler = texture_sampler_;
-
-        // Update UBO descriptor
-        descriptor_writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptor_writes[0].dstSet = descriptor_sets_[i]; // Update the descriptor set here
-        descriptor_writes[0].dstBinding = 0;
-        descriptor_writes[0].dstArrayElement = 0;
-
-        descriptor_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptor_writes[0].descriptorCount = 1;
-
-        descriptor_writes[0].pBufferInfo = &buffer_info; // Update UBO buffer descriptor
-        descriptor_writes[0].pImageInfo = nullptr; // Update Image buffer descriptor
-        descriptor_writes[0].pTexelBufferView = nullptr; // Update texel buffer descriptor
-        descriptor_writes[0].pNext = nullptr;
-
-        // Update image descriptor
-        descriptor_writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptor_writes[1].dstSet = descriptor_sets_[i]; // Update the descriptor set here
-        descriptor_writes[1].dstBinding = 1;
-        descriptor_writes[1].dstArrayElement = 0;
-
-        descriptor_writes[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descriptor_writes[1].descriptorCount = 1;
-
-        descriptor_writes[1].pBufferInfo = nullptr; // Update UBO buffer descriptor
-        descriptor_writes[1].pImageInfo = &image_info; // Update Image buffer descriptor
-        descriptor_writes[1].pTexelBufferView = nullptr; // Update texel buffer descriptor
-        descriptor_writes[1].pNext = nullptr;
-
-        vkUpdateDescriptorSets(vulkan_device_, descriptor_writes.size(), descriptor_writes.data(), 0, nullptr);
+    // Only read by the indirect pipeline
+    if (gpu_culling_) {
+        for (BP_CullingFrame& frame : culling_frames_) {
+            frame.objects_index = bindless_.AddStorageBuffer(frame.objects);
+        }
     }
 }
 
@@ -1383,6 +1380,11 @@ void VulkanGraphics::RecordCommandBuffer(const VkCommandBuffer& cmd_buffer, uint
         LOG << "FAILURE\t Failed creating command buffer";
     }
 
+    // Visibility and levels of detail are decided on the GPU before the pass reads the draws
+    if (draw_path_ == BP_DrawPath::GPU_CULLED) {
+        RecordCullingPass(cmd_buffer);
+    }
+
     // Begin render pass
     VkRenderPassBeginInfo begin_pass_info{};
     begin_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -1398,39 +1400,55 @@ void VulkanGraphics::RecordCommandBuffer(const VkCommandBuffer& cmd_buffer, uint
     begin_pass_info.clearValueCount = clear_colors.size();
     begin_pass_info.pClearValues = clear_colors.data();
 
-    // Define the commands in the render pass
-    vkCmdBeginRenderPass(cmd_buffer, &begin_pass_info, VK_SUBPASS_CONTENTS_INLINE);
-
-    // Draw all models
-    for (uint32_t i = 0; i < models.size(); i++) {
-
-        vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_);
-
-        //Because viewport and scissors were set as dynamic states, it has to be set during rendering
-        VkViewport viewport{};
-        viewport.x = 0;
-        viewport.y = 0;
-        viewport.width = swapchain_data_.extent.width;
-        viewport.height = swapchain_data_.extent.height;
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
-        vkCmdSetViewport(cmd_buffer, 0, 1, &viewport);
-
-        // Define scissor
-        VkRect2D scissor{};
-        scissor.offset = VkOffset2D{ 0, 0 };
-        scissor.extent = swapchain_data_.extent;
-        vkCmdSetScissor(cmd_buffer, 0, 1, &scissor);
-
-        // Draw
-        VkBuffer vertex_buffers[] = { models[i].gpu_buffer };
-        VkDeviceSize offsets[] = { 0 };
-        std::array<VkDescriptorSet, 1> descriptor_sets{ descriptor_sets_[current_frame_] };
-        vkCmdBindVertexBuffers(cmd_buffer, 0, 1, vertex_buffers, offsets);
-        vkCmdBindIndexBuffer(cmd_buffer, models[i].gpu_buffer, models[i].index_offset, VK_INDEX_TYPE_UINT32);
-        vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout_, 0, descriptor_sets.size(), descriptor_sets.data(), 0, nullptr);
-        vkCmdPushConstants(cmd_buffer, pipeline_layout_, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &transforms[i]);
-        vkCmdDrawIndexed(cmd_buffer, models[i].index_count, 1, 0, 0, 0);
+    uint32_t draw_count = PrepareDrawList() ? BuildRenderQueue() : 0;
+    if (cache_command_buffers_) {
+        // Cached buffers are recorded rarely and must not reference the slots, which are reset by every recording
+        vkCmdBeginRenderPass(cmd_buffer, &begin_pass_info, VK_SUBPASS_CONTENTS_INLINE);
+        render_queue_statistics_ += render_queue_.Record(cmd_buffer, pipeline_layout_, bindless_.GetSet(), swapchain_data_.extent, 0, draw_count);
+    }
+    else if (draw_count > 0) {
+        // Draws are recorded into secondary command buffers on the thread pool, the render pass only executes them
+        vkCmdBeginRenderPass(cmd_buffer, &begin_pass_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+        // Small lists stay on fewer threads, a task costs a pool reset and the state setup
+        std::vector<BP_RecordingSlot>& slots = recording_slots_[current_frame_];
+        uint32_t task_count = std::min(static_cast<uint32_t>(slots.size()), (draw_count + MIN_DRAWS_PER_RECORDING_TASK - 1) / MIN_DRAWS_PER_RECORDING_TASK);
+        uint32_t draws_per_task = (draw_count + task_count - 1) / task_count;
+
+        VkCommandBufferInheritanceInfo inheritance_info{};
+        inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritance_info.renderPass = render_pass_;
+        inheritance_info.subpass = 0;
+        inheritance_info.framebuffer = swapchain_data_.framebuffers[img_index];
+
+        // Each task owns its slot, so the pools are never used by two threads at once
+        std::vector<BP_RenderQueueStatistics> task_statistics(task_count);
+        thread_pool_.ParallelFor(task_count, [&](uint32_t task) {
+            BP_RecordingSlot& slot = slots[task];
+            vkResetCommandPool(vulkan_device_, slot.command_pool, 0);
+
+            VkCommandBufferBeginInfo secondary_begin_info{};
+            secondary_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            secondary_begin_info.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            secondary_begin_info.pInheritanceInfo = &inheritance_info;
+            vkBeginCommandBuffer(slot.command_buffer, &secondary_begin_info);
+
+            // Sorted ranges, so a task mostly sees runs of the same state
+            uint32_t begin = std::min(draw_count, task * draws_per_task);
+            task_statistics[task] = render_queue_.Record(slot.command_buffer, pipeline_layout_, bindless_.GetSet(), swapchain_data_.extent, begin, std::min(draw_count, begin + draws_per_task));
+
+            vkEndCommandBuffer(slot.command_buffer);
+        });
+
+        std::vector<VkCommandBuffer> secondary_buffers(task_count);
+        for (uint32_t i = 0; i < task_count; i++) {
+            secondary_buffers[i] = slots[i].command_buffer;
+            render_queue_statistics_ += task_statistics[i];
+        }
+        vkCmdExecuteCommands(cmd_buffer, task_count, secondary_buffers.data());
+    }
+    else {
+        vkCmdBeginRenderPass(cmd_buffer, &begin_pass_info, VK_SUBPASS_CONTENTS_INLINE);
     }
 
     // End render pass
@@ -1441,58 +1459,328 @@ void VulkanGraphics::RecordCommandBuffer(const VkCommandBuffer& cmd_buffer, uint
     }
 }
 
+bool VulkanGraphics::PrepareDrawList() {
+    // Every change of what gets drawn invalidates the cached command buffers
+    bool texture_ready = upload_manager_.IsComplete(texture_upload_ticket_);
+    if (texture_ready != texture_ready_) {
+        texture_ready_ = texture_ready;
+        draw_list_version_++;
+    }
+    if (!texture_ready) {
+        return false;
+    }
+
+    // Skip models that are still streaming in instead of waiting for them. Decided here, so the recording threads only read
+    model_ready_.resize(models.size(), 0);
+    for (uint32_t i = 0; i < models.size(); i++) {
+        uint8_t ready = upload_manager_.IsComplete(models[i].upload_ticket) ? 1 : 0;
+        if (ready != model_ready_[i]) {
+            model_ready_[i] = ready;
+            draw_list_version_++;
+        }
+    }
+    return true;
+}
+
+uint32_t VulkanGraphics::BuildRenderQueue() {
+    // Ids of the sort keys, the pipeline variant takes the highest bits. There is one material so far and every draw uses the bindless set
+    const uint32_t material_id = 0, descriptor_set_id = 0;
+
+    render_queue_.Clear();
+    BP_RenderItem item{};
+    item.vertex_buffer_count = 1;
+    // The same slots for every draw of the frame, only the transform differs
+    MeshPushConstants frame_constants{};
+    frame_constants.texture_index = texture_index_;
+    frame_constants.uniform_index = uniform_indices_[current_frame_];
+    frame_constants.object_index = gpu_culling_ ? culling_frames_[current_frame_].objects_index : 0;
+    item.push_constants = frame_constants;
+
+    if (draw_path_ == BP_DrawPath::GPU_CULLED) {
+        // One call per mesh buffer, the count the culling pass wrote decides how many of its draws run
+        const BP_CullingFrame& frame = culling_frames_[current_frame_];
+        item.pipeline = pipeline_registry_.GetPipeline(indirect_variant_, pipeline_);
+        for (uint32_t i = 0; i < models.size(); i++) {
+            if (!model_ready_[i]) {
+                continue;
+            }
+
+            item.key = RenderQueue::MakeSortKey(indirect_variant_, material_id, descriptor_set_id, i, 0.0f);
+            item.vertex_buffers[0] = models[i].gpu_buffer;
+            item.index_buffer = models[i].gpu_buffer;
+            item.index_offset = models[i].index_offset;
+            // The object transform comes from the object buffer, only the dequantization of the mesh is pushed
+            item.push_constants.transform = models[i].dequantization;
+            item.indirect_buffer = frame.draw_commands;
+            item.indirect_offset = gpu_meshes_[i].draw_offset * sizeof(VkDrawIndexedIndirectCommand);
+            item.count_buffer = frame.draw_counts;
+            item.count_offset = i * sizeof(uint32_t);
+            item.max_draw_count = gpu_meshes_[i].draw_capacity;
+            render_queue_.Push(item);
+        }
+    }
+    else if (draw_path_ == BP_DrawPath::INSTANCED) {
+        // One call per model and level, the instances of a batch are consecutive in the instance buffer
+        item.pipeline = pipeline_registry_.GetPipeline(instanced_variant_, pipeline_);
+        item.vertex_buffers[1] = instance_buffers_[current_frame_];
+        item.vertex_buffer_count = 2;
+        for (const BP_InstanceBatch& batch : instance_batches_) {
+            const backpack::Model3D& model = models[batch.model];
+            if (!model_ready_[batch.model]) {
+                continue;
+            }
+
+            const backpack::MeshLod& mesh_lod = model.lods[batch.lod];
+            item.key = RenderQueue::MakeSortKey(instanced_variant_, material_id, descriptor_set_id, batch.model, 0.0f);
+            item.vertex_buffers[0] = model.gpu_buffer;
+            item.index_buffer = model.gpu_buffer;
+            item.index_offset = model.index_offset;
+            // The instance transform comes from the instance buffer, only the dequantization of the mesh is pushed
+            item.push_constants.transform = model.dequantization;
+            item.index_count = mesh_lod.index_count;
+            item.instance_count = batch.instance_count;
+            item.first_index = mesh_lod.first_index;
+            item.first_instance = batch.first_instance;
+            render_queue_.Push(item);
+        }
+    }
+    else {
+        item.instance_count = 1;
+        float viewport_height = static_cast<float>(swapchain_data_.extent.height);
+        for (uint32_t i = 0; i < scene_.GetObjectCount(); i++) {
+            uint32_t model_index = scene_.GetObjectModel(i);
+            if (!object_visible_[i] || !model_ready_[model_index]) {
+                continue;
+            }
+
+            const backpack::Model3D& model = models[model_index];
+            // Models whose variant is still compiling are drawn with the per object pipeline meanwhile
+            BP_PipelineVariant variant = pipeline_registry_.GetStatus(model.pipeline_variant) == BP_PipelineStatus::READY ? model.pipeline_variant : object_variant_;
+            item.pipeline = pipeline_registry_.GetPipeline(variant, pipeline_);
+            // Objects of one mesh are drawn front to back, by the depth of their bounding sphere
+            glm::vec4 clip_center = transforms[i].transform * glm::vec4{ model.sphere_center, 1.0f };
+            float depth = clip_center.w > 0.0f ? clip_center.z / clip_center.w : 0.0f;
+
+            // The error is measured in object space, so the level is picked with the transform before dequantization
+            uint32_t lod = backpack::SelectMeshLod(model, transforms[i].transform, viewport_height, lod_pixel_error_);
+            const backpack::MeshLod& mesh_lod = model.lods[lod];
+
+            item.key = RenderQueue::MakeSortKey(variant, material_id, descriptor_set_id, model_index, depth);
+            item.vertex_buffers[0] = model.gpu_buffer;
+            item.index_buffer = model.gpu_buffer;
+            item.index_offset = model.index_offset;
+            // Quantized positions are scaled back into the model bounds by the same matrix
+            item.push_constants.transform = transforms[i].transform * model.dequantization;
+            item.index_count = mesh_lod.index_count;
+            item.first_index = mesh_lod.first_index;
+            render_queue_.Push(item);
+        }
+    }
+
+    render_queue_.Sort();
+    return render_queue_.GetCount();
+}
+
+VkCommandBuffer VulkanGraphics::GetFrameCommandBuffer(uint32_t image_index) {
+    // Per object draws push their transforms, so their buffers would change every frame. While the culling
+    // workgroup size is tuned, every frame dispatches with another size
+    bool tuning = draw_path_ == BP_DrawPath::GPU_CULLED && culling_tuner_.IsTuning();
+    if (!cache_command_buffers_ || draw_path_ == BP_DrawPath::PER_OBJECT || tuning) {
+        // Make the command buffer able to record by resetting it. An already full buffer can't record
+        vkResetCommandBuffer(command_buffers_[current_frame_], 0);
+        RecordCommandBuffer(command_buffers_[current_frame_], image_index);
+        return command_buffers_[current_frame_];
+    }
+
+    // Updates the draw list version before it is compared
+    PrepareDrawList();
+
+    // The buffer of this frame and image was last submitted in this slot, whose previous frame already finished
+    uint32_t cache_index = current_frame_ * static_cast<uint32_t>(swapchain_data_.framebuffers.size()) + image_index;
+    VkCommandBuffer cmd_buffer = cached_command_buffers_[cache_index];
+    if (cached_versions_[cache_index] == draw_list_version_) {
+        command_cache_statistics_.reused++;
+        return cmd_buffer;
+    }
+
+    vkResetCommandBuffer(cmd_buffer, 0);
+    RecordCommandBuffer(cmd_buffer, image_index);
+    cached_versions_[cache_index] = draw_list_version_;
+    command_cache_statistics_.recorded++;
+    return cmd_buffer;
+}
+
+void VulkanGraphics::CreateCommandCache() {
+    if (!cache_command_buffers_) {
+        return;
+    }
+
+    // Per object draws push their transforms, so their buffers would change every frame
+    if (!gpu_culling_ && instanced_variant_ == INVALID_PIPELINE_VARIANT) {
+        LOG << "WARNING\t Per object draws can't be cached, recording every frame";
+        cache_command_buffers_ = false;
+        return;
+    }
+
+    uint32_t buffer_count = frames_in_flight_ * static_cast<uint32_t>(swapchain_data_.framebuffers.size());
+    cached_command_buffers_.resize(buffer_count);
+    // Zero is never a draw list version, so every buffer is recorded on first use
+    cached_versions_.assign(buffer_count, 0);
+
+    VkCommandBufferAllocateInfo allocate_info{};
+    allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocate_info.commandPool = command_pool_;
+    allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocate_info.commandBufferCount = buffer_count;
+    VkResult res = vkAllocateCommandBuffers(vulkan_device_, &allocate_info, cached_command_buffers_.data());
+    if (res == VK_SUCCESS) {
+        LOG << "SUCCESS\t Created " << buffer_count << " cached command buffers";
+    }
+    else {
+        LOG << "FAILURE\t Couldn't allocate cached command buffers, error: " << res;
+    }
+}
+
+void VulkanGraphics::DestroyCommandCache() {
+    if (cached_command_buffers_.empty()) {
+        return;
+    }
+
+    vkFreeCommandBuffers(vulkan_device_, command_pool_, static_cast<uint32_t>(cached_command_buffers_.size()), cached_command_buffers_.data());
+    cached_command_buffers_.clear();
+    cached_versions_.clear();
+}
+
+void VulkanGraphics::CreateRecordingSlots() {
+    // One slot per thread that can record, the pool workers and the thread calling ParallelFor
+    uint32_t slot_count = thread_pool_.GetThreadCount() + 1;
+    recording_slots_.resize(frames_in_flight_);
+
+    VkCommandPoolCreateInfo command_pool_info{};
+    command_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    command_pool_info.queueFamilyIndex = graphics_family_index_;
+    // Reset as a whole every frame
+    command_pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+    for (std::vector<BP_RecordingSlot>& frame_slots : recording_slots_) {
+        frame_slots.resize(slot_count);
+        for (BP_RecordingSlot& slot : frame_slots) {
+            VkResult res = vkCreateCommandPool(vulkan_device_, &command_pool_info, nullptr, &slot.command_pool);
+            if (res != VK_SUCCESS) {
+                LOG << "FAILURE\t Could not create recording command pool, error: " << res;
+                continue;
+            }
+
+            VkCommandBufferAllocateInfo allocate_info{};
+            allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocate_info.commandPool = slot.command_pool;
+            allocate_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocate_info.commandBufferCount = 1;
+            res = vkAllocateCommandBuffers(vulkan_device_, &allocate_info, &slot.command_buffer);
+            if (res != VK_SUCCESS) {
+                LOG << "FAILURE\t Could not allocate secondary command buffer, error: " << res;
+            }
+        }
+    }
+    LOG << "SUCCESS\t Created " << slot_count << " secondary command buffers per frame for parallel recording";
+}
+
+void VulkanGraphics::DestroyRecordingSlots() {
+    // Destroying the pools frees their command buffers
+    for (std::vector<BP_RecordingSlot>& frame_slots : recording_slots_) {
+        for (BP_RecordingSlot& slot : frame_slots) {
+            vkDestroyCommandPool(vulkan_device_, slot.command_pool, nullptr);
+        }
+    }
+    recording_slots_.clear();
+}
+
 void VulkanGraphics::CreateSyncObjects() {
-    sem_image_available_.resize(MAX_FRAMES_IN_FLIGHT);
-    sem_render_finished_.resize(MAX_FRAMES_IN_FLIGHT);
-    fence_in_flight_.resize(MAX_FRAMES_IN_FLIGHT);
+    sem_image_available_.resize(frames_in_flight_);
+    sem_render_finished_.resize(frames_in_flight_);
+    // No frame was submitted in any slot yet, frame 0 counts as complete
+    slot_frames_.assign(frames_in_flight_, 0);
 
     VkSemaphoreCreateInfo semaphore_info{};
     semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-    VkFenceCreateInfo fence_info{};
-    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-    // Create sync objects
-    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    // Acquire and present only take binary semaphores, everything else waits on the frame clock
+    for (int i = 0; i < frames_in_flight_; i++) {
         VkResult res_image_available = vkCreateSemaphore(vulkan_device_, &semaphore_info, nullptr, &sem_image_available_[i]);
         VkResult res_render_finished = vkCreateSemaphore(vulkan_device_, &semaphore_info, nullptr, &sem_render_finished_[i]);
-        VkResult in_flight = vkCreateFence(vulkan_device_, &fence_info, nullptr, &fence_in_flight_[i]);
 
-        if (res_image_available && res_render_finished && in_flight != VK_SUCCESS) {
+        if (res_image_available != VK_SUCCESS || res_render_finished != VK_SUCCESS) {
             LOG << "Failed creating sync objects";
         }
     }
+
+    if (!frame_clock_.Initialize(vulkan_device_)) {
+        LOG << "Failed creating sync objects";
+    }
+}
+
+void VulkanGraphics::DestroySyncObjects() {
+    frame_clock_.Destroy();
+    for (int i = 0; i < frames_in_flight_; i++) {
+        vkDestroySemaphore(vulkan_device_, sem_image_available_[i], nullptr);
+        vkDestroySemaphore(vulkan_device_, sem_render_finished_[i], nullptr);
+    }
+    sem_image_available_.clear();
+    sem_render_finished_.clear();
 }
 
 // Submits the command to the GPU
 void VulkanGraphics::RenderFrame() {
-    // Wait for GPU to finish (QueueSubmit). Doesn't wait for swapchain presentation since it might already have an image freed
-    vkWaitForFences(vulkan_device_, 1, &fence_in_flight_[current_frame_], true, UINT64_MAX);
+    // Nobody called WaitForNextFrame, input to present queued is measured from here
+    if (!frame_input_marked_) {
+        frame_input_time_ = std::chrono::steady_clock::now();
+        frame_input_marked_ = true;
+    }
+
+    if (device_lost_) {
+        return;
+    }
+
+    if (headless_) {
+        RenderOffscreenFrame();
+        return;
+    }
+
+    if (minimized_) {
+        RecreateSwapchain(app_window_->GetWindowData(), selected_device_);
+        if (minimized_) {
+            return;
+        }
+    }
+
+    // Wait for the GPU to finish the frame that last used this slot. Doesn't wait for swapchain presentation since it might already have an image freed
+    frame_clock_.WaitForFrame(slot_frames_[current_frame_]);
+    // Retired swapchains and targets whose frames finished
+    frame_clock_.CollectReleases();
 
     // Get next image from swapchain
     uint32_t image_index = 0;
 
     // Makes QueueSubmit wait for a freed image in the swap chain
     VkResult sw_result = vkAcquireNextImageKHR(vulkan_device_, swapchain_data_.swapchain, UINT64_MAX, sem_image_available_[current_frame_], VK_NULL_HANDLE, &image_index);
-    if (sw_result == VK_ERROR_OUT_OF_DATE_KHR || sw_result == VK_SUBOPTIMAL_KHR || resize_necessary_) {
-        // Swapchain not compatible with the surface anymore
-
+    if (sw_result == VK_ERROR_OUT_OF_DATE_KHR) {
+        // Swapchain not compatible with the surface anymore. Nothing was acquired, so the semaphore stays unsignaled
         resize_necessary_ = false;
         RecreateSwapchain(app_window_->GetWindowData(), selected_device_);
         return;
     }
+    // A suboptimal image still signals the semaphore, it's rendered and presented and the swapchain recreated after the present
 
-    // Only wait for fences when the swapchain can render
-    vkResetFences(vulkan_device_, 1, &fence_in_flight_[current_frame_]);
-
-    // Make the command buffer able to record by resetting it. An already full buffer can't record
-    vkResetCommandBuffer(command_buffers_[current_frame_], 0);
-
+    UpdateScene();
     UpdateUniformBuffer(current_frame_);
+    UpdatePipelines();
+    SelectDrawPath();
+    CullObjects();
 
-    RecordCommandBuffer(command_buffers_[current_frame_], image_index);
+    // Release finished uploads, models are only drawn when their upload completed
+    upload_manager_.Collect();
 
+    VkCommandBuffer frame_cmd_buffer = GetFrameCommandBuffer(image_index);
 
     // Submit the queue to the gpu
     VkSubmitInfo submit_info{};
@@ -1501,30 +1789,57 @@ void VulkanGraphics::RenderFrame() {
     // Tell vulkan at which stages to wait on using semaphores
     // Wait at the color attachment output stage until an image is available.
     // The color attachment stage is defined when creating the render pass
-    VkSemaphore semaphores[]{ sem_image_available_[current_frame_] };
-    VkPipelineStageFlags wait_stages[]{ VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-    submit_info.waitSemaphoreCount = 1;
-    submit_info.pWaitSemaphores = semaphores;
+    std::vector<VkSemaphore> semaphores{ sem_image_available_[current_frame_] };
+    std::vector<VkPipelineStageFlags> wait_stages{ VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+    // Value is ignored for the binary semaphore
+    std::vector<uint64_t> wait_values{ 0 };
 
-    submit_info.pWaitDstStageMask = wait_stages;
+    // Makes upload writes visible, the values were already reached so this doesn't stall
+    upload_manager_.GetFrameWaits(semaphores, wait_values);
+    wait_stages.resize(semaphores.size(), VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+    // The binary semaphore lets the present wait, the frame clock everything else. The binary value is ignored
+    uint64_t frame = frame_clock_.BeginFrameSubmission();
+    VkSemaphore signal_semaphores[]{ sem_render_finished_[current_frame_], frame_clock_.GetSemaphore() };
+    uint64_t signal_values[]{ 0, frame };
+
+    VkTimelineSemaphoreSubmitInfo timeline_info{};
+    timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timeline_info.waitSemaphoreValueCount = static_cast<uint32_t>(wait_values.size());
+    timeline_info.pWaitSemaphoreValues = wait_values.data();
+    timeline_info.signalSemaphoreValueCount = 2;
+    timeline_info.pSignalSemaphoreValues = signal_values;
+
+    submit_info.pNext = &timeline_info;
+    submit_info.waitSemaphoreCount = static_cast<uint32_t>(semaphores.size());
+    submit_info.pWaitSemaphores = semaphores.data();
+
+    submit_info.pWaitDstStageMask = wait_stages.data();
 
     // Submit the command buffer to use
     submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &command_buffers_[current_frame_];
+    submit_info.pCommandBuffers = &frame_cmd_buffer;
 
     // Specify which semapores to signal when rendering is finished
-    VkSemaphore signal_semaphores[]{ sem_render_finished_[current_frame_] };
-    submit_info.signalSemaphoreCount = 1;
+    submit_info.signalSemaphoreCount = 2;
     submit_info.pSignalSemaphores = signal_semaphores;
 
     // Submit the command buffer on the graphics queue. The command pool is only ony used for storing 
     //command buffers in memory
-    vkQueueSubmit(device_queues_.graphics_queue, 1, &submit_info, fence_in_flight_[current_frame_]);
+    VkResult res = vkQueueSubmit(device_queues_.graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
+    if (res != VK_SUCCESS) {
+        // Only out of memory or a lost device, the frame never signals and the image is never presented
+        LOG << "FAILURE\t Frame submit failed, stopping rendering, error: " << res;
+        device_lost_ = true;
+        return;
+    }
+    frame_clock_.CommitFrameSubmission();
+    slot_frames_[current_frame_] = frame;
 
     VkPresentInfoKHR present_info{};
     present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
     present_info.waitSemaphoreCount = 1;
-    present_info.pWaitSemaphores = signal_semaphores;
+    present_info.pWaitSemaphores = &sem_render_finished_[current_frame_];
 
     VkSwapchainKHR swapchains[] = { swapchain_data_.swapchain };
     present_info.swapchainCount = 1;
@@ -1538,80 +1853,924 @@ void VulkanGraphics::RenderFrame() {
         resize_necessary_ = false;
         RecreateSwapchain(app_window_->GetWindowData(), selected_device_);
     }
+    RecordFrameTiming();
 
-    current_frame_ = (current_frame_ + 1) % (MAX_FRAMES_IN_FLIGHT);
+    upload_manager_.EndFrame();
+    rendered_frame_count_++;
+    current_frame_ = (current_frame_ + 1) % frames_in_flight_;
 }
 
-void VulkanGraphics::UpdateUniformBuffer(uint32_t current_frame) {
-    static auto start_time = std::chrono::high_resolution_clock::now();
+void VulkanGraphics::RenderOffscreenFrame() {
+    // Wait until the target of this frame is not used by the GPU anymore
+    frame_clock_.WaitForFrame(slot_frames_[current_frame_]);
+    frame_clock_.CollectReleases();
 
-    auto current_time = std::chrono::high_resolution_clock::now();
-    float time = std::chrono::duration<float, std::chrono::seconds::period>(current_time - start_time).count();
+    UpdateScene();
+    UpdateUniformBuffer(current_frame_);
+    UpdatePipelines();
+    SelectDrawPath();
+    CullObjects();
 
-    //UniformBufferObject ubo{};
-    // x = right
-    // y = depth
-    // z = height
+    upload_manager_.Collect();
 
-    // x = right
-    // y = down
-    // z = forward
+    // Every frame in flight owns one offscreen target
+    uint32_t image_index = current_frame_;
+    VkCommandBuffer frame_cmd_buffer = GetFrameCommandBuffer(image_index);
 
-    // Quad 1
-    // rotate over z
-    glm::vec3 pos = glm::vec3(2.f, 0.f, -1.f);
-    glm::mat4 model = glm::translate(glm::mat4{ 1.0f }, pos);
-    model = glm::rotate(model, time * glm::radians(45.f), glm::vec3(0.0f, 0.0f, 1.0f));
+    // No acquire or present, so only the completed uploads are waited on
+    std::vector<VkSemaphore> semaphores;
+    std::vector<uint64_t> wait_values;
+    upload_manager_.GetFrameWaits(semaphores, wait_values);
+    std::vector<VkPipelineStageFlags> wait_stages(semaphores.size(), VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
 
-    // Quad 2
-    glm::vec3 pos2 = glm::vec3(0, -1, 4.0f);
-    glm::mat4 model2 = glm::translate(glm::mat4{ 1.0f }, pos2);
-    model2 = glm::rotate(model2, time * glm::radians(90.f), glm::vec3(0.0f, 0.0f, 1.0f));
+    uint64_t frame = frame_clock_.BeginFrameSubmission();
+    VkSemaphore frame_semaphore = frame_clock_.GetSemaphore();
 
-    // Look at the center from a distance
-    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), pos, glm::vec3(0.0f, 0.0f, -1.0f));
-    //90deg fov with swapchain aspect ration and near/far plane
-    float aspect = swapchain_data_.extent.width / (float)swapchain_data_.extent.height;
-    glm::mat4 projection = glm::perspective(glm::radians(45.f), aspect, 0.1f, 100.0f);
+    VkTimelineSemaphoreSubmitInfo timeline_info{};
+    timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timeline_info.waitSemaphoreValueCount = static_cast<uint32_t>(wait_values.size());
+    timeline_info.pWaitSemaphoreValues = wait_values.data();
+    timeline_info.signalSemaphoreValueCount = 1;
+    timeline_info.pSignalSemaphoreValues = &frame;
 
-    transforms[0].transform = projection * view * model;
-    transforms[1].transform = projection * view * model2;
+    VkSubmitInfo submit_info{};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = &timeline_info;
+    submit_info.waitSemaphoreCount = static_cast<uint32_t>(semaphores.size());
+    submit_info.pWaitSemaphores = semaphores.data();
+    submit_info.pWaitDstStageMask = wait_stages.data();
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &frame_cmd_buffer;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &frame_semaphore;
 
-    //// glm is for opengl with an inverted y coordinate system, so we comensate for that
-    //ubo.projection[1][1] *= -1;
+    VkResult res = vkQueueSubmit(device_queues_.graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
+    if (res != VK_SUCCESS) {
+        LOG << "FAILURE\t Offscreen frame submit failed, stopping rendering, error: " << res;
+        device_lost_ = true;
+        return;
+    }
+    frame_clock_.CommitFrameSubmission();
+    slot_frames_[current_frame_] = frame;
 
-    //memcpy(uniform_mapped_memory_[current_frame], &ubo, sizeof(ubo));
+    last_rendered_image_ = image_index;
+    // Without a present the submit ends the frame
+    RecordFrameTiming();
+    upload_manager_.EndFrame();
+    rendered_frame_count_++;
+    current_frame_ = (current_frame_ + 1) % frames_in_flight_;
 }
 
-void VulkanGraphics::RecreateSwapchain(const WindowData& window_data, VkPhysicalDevice device) {
-    WindowData win = window_data;
-    vkDeviceWaitIdle(vulkan_device_);
-    DestroySwapchain();
-
-    while (win.window_width == 0 || win.window_height == 0) {
-        glfwWaitEvents();
-        win = app_window_->GetWindowData();
+bool VulkanGraphics::ReadbackFrame(std::vector<uint8_t>& pixels, uint32_t& width, uint32_t& height) {
+    if (!headless_ || rendered_frame_count_ == 0) {
+        LOG << "FAILURE\t Readback is only supported after rendering a headless frame";
+        return false;
     }
 
-    // We don't need to destroy these images before creating new ones?
-    CreateSwapchain(win, device);
-    CreateImageViews();
-    CreateColorResources();
-    CreateDepthResources();
-    CreateFramebuffers();
-    CreateSyncObjects();
-}
+    width = swapchain_data_.extent.width;
+    height = swapchain_data_.extent.height;
+    VkDeviceSize size = static_cast<VkDeviceSize>(width) * height * 4;
 
-void VulkanGraphics::CreateComputeResources() {
-    storage_buffer_.resize(MAX_FRAMES_IN_FLIGHT);
-    storage_memory_.resize(MAX_FRAMES_IN_FLIGHT);
+    // (Re)create the readback buffer when the target size changed
+    if (readback_size_ != size) {
+        DestroyBuffer(memory_allocator_, vulkan_device_, readback_buffer_, readback_memory_);
 
-    // Random number generator
-    size_t seed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-    std::default_random_engine random_engine(seed);
-    std::uniform_real_distribution<float> random_dist(0.0f, 1.0f);
+        CreateBuffer(memory_allocator_, vulkan_device_, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, readback_buffer_, readback_memory_,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        readback_size_ = size;
+    }
 
-    // Calculate initial particle positions
+    // The frame that rendered into the image has to be finished
+    frame_clock_.WaitForFrame(slot_frames_[last_rendered_image_]);
+
+    VkImage image = swapchain_data_.images[last_rendered_image_];
+    VkCommandBuffer cmd_buffer = BeginSingleTimeCommandBuffer(vulkan_device_, command_pool_);
+
+    // Make the resolve writes visible to the copy, the layout is already set by the render pass
+    VkImageMemoryBarrier image_barrier{};
+    image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    image_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    image_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    image_barrier.image = image;
+    image_barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    image_barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    image_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+        0, nullptr,
+        0, nullptr,
+        1, &image_barrier);
+
+    VkBufferImageCopy region{};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = { width, height, 1 };
+    vkCmdCopyImageToBuffer(cmd_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback_buffer_, 1, &region);
+
+    // Make the copied data visible to the host
+    VkBufferMemoryBarrier buffer_barrier{};
+    buffer_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    buffer_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    buffer_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    buffer_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    buffer_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    buffer_barrier.buffer = readback_buffer_;
+    buffer_barrier.offset = 0;
+    buffer_barrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+        0, nullptr,
+        1, &buffer_barrier,
+        0, nullptr);
+
+    EndSingleTimeCommandBuffer(vulkan_device_, device_queues_.graphics_queue, command_pool_, cmd_buffer);
+
+    // Targets are BGRA, swizzle to RGBA while copying out
+    pixels.resize(static_cast<size_t>(size));
+    const uint8_t* src = static_cast<const uint8_t*>(readback_memory_.mapped);
+    for (size_t i = 0; i < pixels.size(); i += 4) {
+        pixels[i + 0] = src[i + 2];
+        pixels[i + 1] = src[i + 1];
+        pixels[i + 2] = src[i + 0];
+        pixels[i + 3] = src[i + 3];
+    }
+
+    return true;
+}
+
+bool VulkanGraphics::IsHeadless() const {
+    return headless_;
+}
+
+void VulkanGraphics::WaitForUploads() {
+    upload_manager_.Wait(upload_manager_.Submit(BP_UploadQueue::TRANSFER));
+    upload_manager_.Wait(upload_manager_.Submit(BP_UploadQueue::GRAPHICS));
+    upload_manager_.Collect();
+}
+
+uint64_t VulkanGraphics::GetRenderedFrameCount() const {
+    return rendered_frame_count_;
+}
+
+FrameClock& VulkanGraphics::GetFrameClock() {
+    return frame_clock_;
+}
+
+void BP_RunningStatistics::Add(double value) {
+    count++;
+    double delta = value - mean;
+    mean += delta / count;
+    m2 += delta * (value - mean);
+    max = std::max(max, value);
+}
+
+double BP_RunningStatistics::GetVariance() const {
+    return count > 1 ? m2 / (count - 1) : 0.0;
+}
+
+const char* GetPresentPolicyName(BP_PresentPolicy policy) {
+    switch (policy) {
+    case BP_PresentPolicy::VSYNC:
+        return "vsync";
+    case BP_PresentPolicy::LOW_LATENCY:
+        return "low latency";
+    case BP_PresentPolicy::THROUGHPUT:
+        return "throughput";
+    case BP_PresentPolicy::PACED:
+        return "paced";
+    default:
+        return "unknown";
+    }
+}
+
+const char* GetDrawPathName(BP_DrawPath path) {
+    switch (path) {
+    case BP_DrawPath::GPU_CULLED:
+        return "GPU culled";
+    case BP_DrawPath::INSTANCED:
+        return "instanced";
+    case BP_DrawPath::PER_OBJECT:
+        return "per object";
+    default:
+        return "unknown";
+    }
+}
+
+void VulkanGraphics::WaitForNextFrame() {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (present_policy_ == BP_PresentPolicy::PACED && settings_.frame_rate_limit > 0) {
+        std::chrono::steady_clock::duration interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(1.0 / settings_.frame_rate_limit));
+        if (now < next_frame_start_) {
+            std::this_thread::sleep_until(next_frame_start_);
+            now = std::chrono::steady_clock::now();
+        }
+
+        next_frame_start_ += interval;
+        if (next_frame_start_ < now) {
+            // More than a frame late, restart the schedule instead of rushing the next frames to catch up
+            next_frame_start_ = now + interval;
+        }
+    }
+
+    frame_input_time_ = now;
+    frame_input_marked_ = true;
+}
+
+void VulkanGraphics::RecordFrameTiming() {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    BP_FrameTimingStatistics& timing = frame_timing_[static_cast<size_t>(present_policy_)];
+    if (frame_input_marked_) {
+        timing.input_to_present_queued.Add(std::chrono::duration<double, std::chrono::milliseconds::period>(now - frame_input_time_).count());
+        frame_input_marked_ = false;
+    }
+    if (presented_before_) {
+        timing.frame_time.Add(std::chrono::duration<double, std::chrono::milliseconds::period>(now - last_present_time_).count());
+    }
+    last_present_time_ = now;
+    presented_before_ = true;
+}
+
+void VulkanGraphics::SetPresentPolicy(BP_PresentPolicy policy) {
+    if (policy == present_policy_ || policy >= BP_PresentPolicy::COUNT) {
+        return;
+    }
+
+    present_policy_ = policy;
+    LOG << "Switching to the " << GetPresentPolicyName(policy) << " present policy";
+    // The frame across the switch belongs to neither policy
+    presented_before_ = false;
+    if (!headless_) {
+        resize_necessary_ = true;
+    }
+}
+
+BP_PresentPolicy VulkanGraphics::GetPresentPolicy() const {
+    return present_policy_;
+}
+
+const BP_FrameTimingStatistics& VulkanGraphics::GetFrameTimingStatistics(BP_PresentPolicy policy) const {
+    return frame_timing_[static_cast<size_t>(policy)];
+}
+
+void VulkanGraphics::LogFrameTimingStatistics() {
+    for (uint32_t i = 0; i < static_cast<uint32_t>(BP_PresentPolicy::COUNT); i++) {
+        const BP_FrameTimingStatistics& timing = frame_timing_[i];
+        if (timing.input_to_present_queued.count == 0) {
+            continue;
+        }
+
+        LOG << "Frame timing " << GetPresentPolicyName(static_cast<BP_PresentPolicy>(i)) << ", " << frames_in_flight_ << " frames in flight: "
+            << timing.input_to_present_queued.count << " frames, input to present queued " << timing.input_to_present_queued.mean << "ms (max "
+            << timing.input_to_present_queued.max << "ms), frame time "
+            << timing.frame_time.mean << "ms (variance " << timing.frame_time.GetVariance() << "ms^2, max " << timing.frame_time.max << "ms)";
+    }
+}
+
+void VulkanGraphics::CullObjects() {
+    // The culling pass decides on the GPU, only its inputs are written here
+    if (draw_path_ == BP_DrawPath::GPU_CULLED) {
+        WriteCullingInputs();
+        return;
+    }
+
+    uint32_t object_count = scene_.GetObjectCount();
+    if (culling_set_.GetCount() != object_count) {
+        culling_set_.Resize(object_count);
+    }
+    for (uint32_t i = 0; i < object_count; i++) {
+        culling_set_.SetBounds(i, models[scene_.GetObjectModel(i)], scene_.GetObjectWorld(i));
+    }
+
+    uint32_t visible = culling_set_.Cull(view_frustum_, object_visible_);
+    culling_statistics_.visible_objects = visible;
+    culling_statistics_.culled_objects = object_count - visible;
+    culling_statistics_.total_visible += visible;
+    culling_statistics_.total_culled += object_count - visible;
+    culling_statistics_.frame_count++;
+
+    if (draw_path_ == BP_DrawPath::INSTANCED) {
+        BuildInstanceBatches();
+    }
+}
+
+void VulkanGraphics::LogCullingStatistics() {
+    if (culling_statistics_.frame_count == 0) {
+        return;
+    }
+
+    double frames = static_cast<double>(culling_statistics_.frame_count);
+    LOG << "Frustum culling (" << backpack::GetCullingKernelName() << "): " << culling_statistics_.total_visible / frames << " visible and "
+        << culling_statistics_.total_culled / frames << " culled objects per frame over " << culling_statistics_.frame_count << " frames";
+    // The result was logged when the tuning finished
+    if (culling_tuner_.IsTuning()) {
+        culling_tuner_.LogResults("the culling pass");
+    }
+}
+
+void VulkanGraphics::CreateInstanceBuffers() {
+    instance_buffers_.resize(frames_in_flight_);
+    instance_memory_.resize(frames_in_flight_);
+
+    VkDeviceSize size = sizeof(BP_Instance) * scene_.GetObjectCount();
+
+    for (int i = 0; i < frames_in_flight_; i++) {
+        CreateBuffer(memory_allocator_, vulkan_device_, size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, instance_buffers_[i], instance_memory_[i], VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    }
+}
+
+void VulkanGraphics::BuildInstanceBatches() {
+    // Counting sort of the visible objects by model and level, every non empty pair becomes one batch
+    uint32_t object_count = scene_.GetObjectCount();
+    std::vector<uint32_t> batch_offsets(models.size() * backpack::MAX_MESH_LODS + 1, 0);
+    object_batches_.resize(object_count);
+    float viewport_height = static_cast<float>(swapchain_data_.extent.height);
+    for (uint32_t i = 0; i < object_count; i++) {
+        if (!object_visible_[i]) {
+            continue;
+        }
+        uint32_t model = scene_.GetObjectModel(i);
+        uint32_t lod = backpack::SelectMeshLod(models[model], view_projection_ * scene_.GetObjectWorld(i), viewport_height, lod_pixel_error_);
+        object_batches_[i] = model * backpack::MAX_MESH_LODS + lod;
+        batch_offsets[object_batches_[i] + 1]++;
+    }
+
+    std::vector<BP_InstanceBatch> batches;
+    for (uint32_t batch = 0; batch + 1 < batch_offsets.size(); batch++) {
+        uint32_t instance_count = batch_offsets[batch + 1];
+        batch_offsets[batch + 1] += batch_offsets[batch];
+        if (instance_count > 0) {
+            batches.push_back(BP_InstanceBatch{ batch / backpack::MAX_MESH_LODS, batch % backpack::MAX_MESH_LODS, batch_offsets[batch], instance_count });
+        }
+    }
+
+    // The draws only change when the visible counts or levels do, the transforms are read from the instance buffer
+    bool unchanged = batches.size() == instance_batches_.size() && std::equal(batches.begin(), batches.end(), instance_batches_.begin(),
+        [](const BP_InstanceBatch& a, const BP_InstanceBatch& b) {
+            return a.model == b.model && a.lod == b.lod && a.first_instance == b.first_instance && a.instance_count == b.instance_count;
+        });
+    if (!unchanged) {
+        instance_batches_ = std::move(batches);
+        draw_list_version_++;
+    }
+
+    // The previous frame of this slot finished, so its instance buffer is no longer read
+    BP_Instance* instances = static_cast<BP_Instance*>(instance_memory_[current_frame_].mapped);
+    for (uint32_t i = 0; i < object_count; i++) {
+        if (object_visible_[i]) {
+            instances[batch_offsets[object_batches_[i]]++] = BP_Instance{ scene_.GetObjectWorld(i) };
+        }
+    }
+}
+
+void VulkanGraphics::CreateCullingResources() {
+    if (!gpu_culling_) {
+        return;
+    }
+
+    VkShaderModule culling_shader = shader_loader_.GetShaderModule(CULLING_SHADER, vulkan_device_);
+    if (culling_shader == VK_NULL_HANDLE) {
+        LOG << "FAILURE\t Culling shader is missing, the build compiles it to src/shaders/c_cull.spv";
+        gpu_culling_ = false;
+        return;
+    }
+    if (models.empty()) {
+        gpu_culling_ = false;
+        return;
+    }
+
+    // Each mesh gets room for a draw of every object that uses it
+    uint32_t object_count = scene_.GetObjectCount();
+    gpu_meshes_.assign(models.size(), BP_GpuMesh{});
+    for (uint32_t i = 0; i < object_count; i++) {
+        gpu_meshes_[scene_.GetObjectModel(i)].draw_capacity++;
+    }
+    uint32_t draw_count = 0;
+    for (uint32_t i = 0; i < models.size(); i++) {
+        BP_GpuMesh& mesh = gpu_meshes_[i];
+        mesh.lod_count = models[i].lod_count;
+        for (uint32_t lod = 0; lod < models[i].lod_count; lod++) {
+            mesh.lods[lod] = BP_GpuMeshLod{ models[i].lods[lod].first_index, models[i].lods[lod].index_count, models[i].lods[lod].error, 0 };
+        }
+        mesh.draw_offset = draw_count;
+        draw_count += mesh.draw_capacity;
+    }
+
+    // Meshes don't change after loading
+    VkDeviceSize mesh_size = sizeof(BP_GpuMesh) * gpu_meshes_.size();
+    CreateBuffer(memory_allocator_, vulkan_device_, mesh_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, mesh_buffer_, mesh_memory_, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    memcpy(mesh_memory_.mapped, gpu_meshes_.data(), mesh_size);
+
+    // Objects and uniforms are written by the host every frame, the draws only by the culling pass
+    culling_frames_.resize(frames_in_flight_);
+    for (BP_CullingFrame& frame : culling_frames_) {
+        CreateBuffer(memory_allocator_, vulkan_device_, sizeof(BP_CullingUniforms), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            frame.uniforms, frame.uniforms_memory, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        CreateBuffer(memory_allocator_, vulkan_device_, sizeof(BP_GpuObject) * object_count, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            frame.objects, frame.objects_memory, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        CreateBuffer(memory_allocator_, vulkan_device_, sizeof(VkDrawIndexedIndirectCommand) * draw_count, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+            frame.draw_commands, frame.draw_commands_memory, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        CreateBuffer(memory_allocator_, vulkan_device_, sizeof(uint32_t) * gpu_meshes_.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            frame.draw_counts, frame.draw_counts_memory, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+        // The world matrices follow with the first frame that uses the buffer
+        BP_GpuObject* objects = static_cast<BP_GpuObject*>(frame.objects_memory.mapped);
+        for (uint32_t i = 0; i < object_count; i++) {
+            const backpack::Model3D& model = models[scene_.GetObjectModel(i)];
+            BP_GpuObject object{};
+            object.sphere = glm::vec4{ model.sphere_center, model.sphere_radius };
+            object.mesh = scene_.GetObjectModel(i);
+            objects[i] = object;
+        }
+    }
+
+    // Create descriptor set layout, uniforms followed by the objects, meshes, draws and counts
+    std::array<VkDescriptorSetLayoutBinding, 5> desc_set_layouts_bindings{};
+    for (uint32_t i = 0; i < desc_set_layouts_bindings.size(); i++) {
+        desc_set_layouts_bindings[i].binding = i;
+        desc_set_layouts_bindings[i].descriptorCount = 1;
+        desc_set_layouts_bindings[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        desc_set_layouts_bindings[i].pImmutableSamplers = nullptr;
+        desc_set_layouts_bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layout_info{};
+    layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_info.bindingCount = static_cast<uint32_t>(desc_set_layouts_bindings.size());
+    layout_info.pBindings = desc_set_layouts_bindings.data();
+
+    VkResult res = vkCreateDescriptorSetLayout(vulkan_device_, &layout_info, nullptr, &culling_desc_set_layout_);
+    if (res != VK_SUCCESS) {
+        LOG << "FAILURE\t Failed creating culling descriptor set layout, error:" << res;
+        DestroyCullingResources();
+        gpu_culling_ = false;
+        return;
+    }
+
+    // Create descriptor pool
+    VkDescriptorPoolSize ubo_pool_size{};
+    ubo_pool_size.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    ubo_pool_size.descriptorCount = frames_in_flight_;
+
+    VkDescriptorPoolSize ssbo_pool_size{};
+    ssbo_pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    ssbo_pool_size.descriptorCount = frames_in_flight_ * 4;
+
+    std::array<VkDescriptorPoolSize, 2> pool_sizes = { ubo_pool_size, ssbo_pool_size };
+
+    VkDescriptorPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.poolSizeCount = static_cast<uint32_t>(pool_sizes.size());
+    pool_info.pPoolSizes = pool_sizes.data();
+    pool_info.maxSets = frames_in_flight_;
+
+    res = vkCreateDescriptorPool(vulkan_device_, &pool_info, nullptr, &culling_desc_pool_);
+    if (res != VK_SUCCESS) {
+        LOG << "FAILURE\t Failed creating culling descriptor pool, error:" << res;
+        DestroyCullingResources();
+        gpu_culling_ = false;
+        return;
+    }
+
+    // Allocate and write one set per frame in flight
+    std::vector<VkDescriptorSetLayout> desc_set_layouts(frames_in_flight_, culling_desc_set_layout_);
+    std::vector<VkDescriptorSet> descriptor_sets(frames_in_flight_);
+    VkDescriptorSetAllocateInfo allocate_info{};
+    allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocate_info.descriptorPool = culling_desc_pool_;
+    allocate_info.descriptorSetCount = frames_in_flight_;
+    allocate_info.pSetLayouts = desc_set_layouts.data();
+
+    res = vkAllocateDescriptorSets(vulkan_device_, &allocate_info, descriptor_sets.data());
+    if (res != VK_SUCCESS) {
+        LOG << "FAILURE\t Failed allocating culling descriptor sets, error:" << res;
+        DestroyCullingResources();
+        gpu_culling_ = false;
+        return;
+    }
+
+    for (uint32_t i = 0; i < frames_in_flight_; i++) {
+        BP_CullingFrame& frame = culling_frames_[i];
+        frame.descriptor_set = descriptor_sets[i];
+
+        std::array<VkDescriptorBufferInfo, 5> buffer_infos{};
+        std::array<VkBuffer, 5> buffers{ frame.uniforms, frame.objects, mesh_buffer_, frame.draw_commands, frame.draw_counts };
+        std::array<VkWriteDescriptorSet, 5> write_set{};
+        for (uint32_t binding = 0; binding < write_set.size(); binding++) {
+            buffer_infos[binding].buffer = buffers[binding];
+            buffer_infos[binding].offset = 0;
+            buffer_infos[binding].range = VK_WHOLE_SIZE;
+
+            write_set[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write_set[binding].descriptorType = desc_set_layouts_bindings[binding].descriptorType;
+            write_set[binding].pBufferInfo = &buffer_infos[binding];
+            write_set[binding].descriptorCount = 1;
+            write_set[binding].dstBinding = binding;
+            write_set[binding].dstArrayElement = 0;
+            write_set[binding].dstSet = frame.descriptor_set;
+        }
+
+        vkUpdateDescriptorSets(vulkan_device_, static_cast<uint32_t>(write_set.size()), write_set.data(), 0, nullptr);
+    }
+
+    VkPipelineLayoutCreateInfo pipeline_layout_info{};
+    pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeline_layout_info.setLayoutCount = 1;
+    pipeline_layout_info.pSetLayouts = &culling_desc_set_layout_;
+    res = vkCreatePipelineLayout(vulkan_device_, &pipeline_layout_info, nullptr, &culling_pipeline_layout_);
+    if (res != VK_SUCCESS) {
+        LOG << "FAILURE\t Failed creating culling pipeline layout, error:" << res;
+        DestroyCullingResources();
+        gpu_culling_ = false;
+        return;
+    }
+
+    // Every workgroup size the device allows is a candidate, the default goes first so it is used until the tuning finished
+    VkPhysicalDeviceProperties device_properties;
+    vkGetPhysicalDeviceProperties(selected_device_, &device_properties);
+    std::vector<uint32_t> workgroup_sizes = GetWorkgroupSizeCandidates(device_properties.limits);
+    auto default_size = std::find(workgroup_sizes.begin(), workgroup_sizes.end(), CULLING_WORKGROUP_SIZE);
+    if (default_size != workgroup_sizes.end()) {
+        std::rotate(workgroup_sizes.begin(), default_size, default_size + 1);
+    }
+    if (!settings_.tune_workgroup_size || !CreateCullingTimestamps(device_properties)) {
+        workgroup_sizes.resize(1);
+    }
+
+    // The same shader specialized to each size
+    std::vector<uint32_t> created_sizes;
+    for (uint32_t size : workgroup_sizes) {
+        VkPipeline pipeline = CreateCullingPipeline(culling_shader, size);
+        if (pipeline == VK_NULL_HANDLE) {
+            continue;
+        }
+        culling_pipelines_.push_back(pipeline);
+        created_sizes.push_back(size);
+    }
+
+    if (culling_pipelines_.empty()) {
+        LOG << "WARNING\t No culling pipeline, culling on the CPU";
+        DestroyCullingResources();
+        gpu_culling_ = false;
+        return;
+    }
+    culling_tuner_.Initialize(created_sizes, WORKGROUP_TUNING_SAMPLES);
+    LOG << "SUCCESS\t Created culling pipeline for " << object_count << " objects and " << gpu_meshes_.size() << " meshes"
+        << (culling_tuner_.IsTuning() ? ", tuning its workgroup size over " : ", workgroup size ") << (culling_tuner_.IsTuning() ? created_sizes.size() : created_sizes[0])
+        << (culling_tuner_.IsTuning() ? " candidates" : "");
+}
+
+VkPipeline VulkanGraphics::CreateCullingPipeline(VkShaderModule shader, uint32_t workgroup_size) {
+    BP_SpecializationConstants constants;
+    constants.SetUint(COMPUTE_CONSTANT_WORKGROUP_SIZE, workgroup_size);
+    std::array<VkSpecializationMapEntry, MAX_SPECIALIZATION_CONSTANTS> entries;
+    VkSpecializationInfo specialization;
+
+    VkComputePipelineCreateInfo compute_pipeline_info{};
+    compute_pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    compute_pipeline_info.layout = culling_pipeline_layout_;
+    compute_pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    compute_pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    compute_pipeline_info.stage.module = shader;
+    compute_pipeline_info.stage.pName = "main";
+    compute_pipeline_info.stage.pSpecializationInfo = constants.GetInfo(entries, specialization);
+
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkResult res = pipeline_cache_.CreateComputePipeline(compute_pipeline_info, pipeline);
+    if (res != VK_SUCCESS) {
+        LOG << "FAILURE\t Couldn't create culling pipeline with workgroup size " << workgroup_size << ", error:" << res;
+        return VK_NULL_HANDLE;
+    }
+    return pipeline;
+}
+
+uint32_t VulkanGraphics::RebuildCullingPipelines() {
+    if (culling_pipelines_.empty()) {
+        return 0;
+    }
+
+    VkShaderModule culling_shader = shader_loader_.GetShaderModule(CULLING_SHADER, vulkan_device_);
+    if (culling_shader == VK_NULL_HANDLE) {
+        return 0;
+    }
+
+    // All candidates or none, the tuner indexes them by position
+    std::vector<VkPipeline> rebuilt;
+    for (uint32_t candidate = 0; candidate < culling_tuner_.GetCandidateCount(); candidate++) {
+        VkPipeline pipeline = CreateCullingPipeline(culling_shader, culling_tuner_.GetWorkgroupSize(candidate));
+        if (pipeline == VK_NULL_HANDLE) {
+            for (VkPipeline created : rebuilt) {
+                vkDestroyPipeline(vulkan_device_, created, nullptr);
+            }
+            LOG << "FAILURE\t Couldn't rebuild the culling pipelines, keeping the previous ones";
+            return 0;
+        }
+        rebuilt.push_back(pipeline);
+    }
+
+    // Frames in flight may still dispatch the old pipelines
+    std::vector<VkPipeline> replaced;
+    replaced.swap(culling_pipelines_);
+    culling_pipelines_ = std::move(rebuilt);
+    VkDevice device = vulkan_device_;
+    frame_clock_.ReleaseAfterSubmittedFrames([device, replaced]() {
+        for (VkPipeline pipeline : replaced) {
+            vkDestroyPipeline(device, pipeline, nullptr);
+        }
+    });
+
+    // The new code may prefer another size, measure again when timestamps are available
+    if (culling_query_pool_ != VK_NULL_HANDLE) {
+        std::vector<uint32_t> sizes;
+        for (uint32_t candidate = 0; candidate < culling_tuner_.GetCandidateCount(); candidate++) {
+            sizes.push_back(culling_tuner_.GetWorkgroupSize(candidate));
+        }
+        culling_tuner_.Initialize(sizes, WORKGROUP_TUNING_SAMPLES);
+    }
+    return static_cast<uint32_t>(culling_pipelines_.size());
+}
+
+bool VulkanGraphics::CreateCullingTimestamps(const VkPhysicalDeviceProperties& device_properties) {
+    if (!device_properties.limits.timestampComputeAndGraphics) {
+        LOG << "WARNING\t Device can't write timestamps, keeping the default culling workgroup size";
+        return false;
+    }
+
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(selected_device_, &family_count, nullptr);
+    std::vector<VkQueueFamilyProperties> families(family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(selected_device_, &family_count, families.data());
+    uint32_t valid_bits = families[graphics_family_index_].timestampValidBits;
+    if (valid_bits == 0) {
+        LOG << "WARNING\t Graphics queue can't write timestamps, keeping the default culling workgroup size";
+        return false;
+    }
+    timestamp_period_ns_ = device_properties.limits.timestampPeriod;
+    timestamp_mask_ = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+
+    VkQueryPoolCreateInfo query_info{};
+    query_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    query_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    query_info.queryCount = 2 * frames_in_flight_;
+    VkResult res = vkCreateQueryPool(vulkan_device_, &query_info, nullptr, &culling_query_pool_);
+    if (res != VK_SUCCESS) {
+        LOG << "FAILURE\t Couldn't create culling timestamp queries, error:" << res;
+        culling_query_pool_ = VK_NULL_HANDLE;
+        return false;
+    }
+    return true;
+}
+
+void VulkanGraphics::DestroyCullingResources() {
+    if (culling_frames_.empty()) {
+        return;
+    }
+
+    for (VkPipeline pipeline : culling_pipelines_) {
+        vkDestroyPipeline(vulkan_device_, pipeline, nullptr);
+    }
+    culling_pipelines_.clear();
+    if (culling_query_pool_ != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(vulkan_device_, culling_query_pool_, nullptr);
+        culling_query_pool_ = VK_NULL_HANDLE;
+    }
+    // Also called when the creation failed part way, destroying VK_NULL_HANDLE does nothing
+    vkDestroyPipelineLayout(vulkan_device_, culling_pipeline_layout_, nullptr);
+    vkDestroyDescriptorPool(vulkan_device_, culling_desc_pool_, nullptr);
+    vkDestroyDescriptorSetLayout(vulkan_device_, culling_desc_set_layout_, nullptr);
+    culling_pipeline_layout_ = VK_NULL_HANDLE;
+    culling_desc_pool_ = VK_NULL_HANDLE;
+    culling_desc_set_layout_ = VK_NULL_HANDLE;
+
+    for (BP_CullingFrame& frame : culling_frames_) {
+        DestroyBuffer(memory_allocator_, vulkan_device_, frame.uniforms, frame.uniforms_memory);
+        DestroyBuffer(memory_allocator_, vulkan_device_, frame.objects, frame.objects_memory);
+        DestroyBuffer(memory_allocator_, vulkan_device_, frame.draw_commands, frame.draw_commands_memory);
+        DestroyBuffer(memory_allocator_, vulkan_device_, frame.draw_counts, frame.draw_counts_memory);
+    }
+    culling_frames_.clear();
+    DestroyBuffer(memory_allocator_, vulkan_device_, mesh_buffer_, mesh_memory_);
+}
+
+void VulkanGraphics::WriteCullingInputs() {
+    BP_CullingFrame& frame = culling_frames_[current_frame_];
+    uint32_t object_count = scene_.GetObjectCount();
+
+    // The previous frame of this slot finished, so the counts are the ones of its last culling pass
+    if (frame.submitted) {
+        const uint32_t* draw_counts = static_cast<const uint32_t*>(frame.draw_counts_memory.mapped);
+        uint32_t visible = 0;
+        for (uint32_t i = 0; i < gpu_meshes_.size(); i++) {
+            visible += std::min(draw_counts[i], gpu_meshes_[i].draw_capacity);
+        }
+        culling_statistics_.visible_objects = visible;
+        culling_statistics_.culled_objects = object_count - visible;
+        culling_statistics_.total_visible += visible;
+        culling_statistics_.total_culled += object_count - visible;
+        culling_statistics_.frame_count++;
+    }
+    frame.submitted = true;
+
+    // Dispatch time of the last use, its frame finished so the timestamps are available
+    if (frame.measured_candidate != UINT32_MAX) {
+        uint64_t timestamps[2]{};
+        VkResult res = vkGetQueryPoolResults(vulkan_device_, culling_query_pool_, current_frame_ * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+        if (res == VK_SUCCESS) {
+            double ms = static_cast<double>((timestamps[1] - timestamps[0]) & timestamp_mask_) * timestamp_period_ns_ / 1000000.0;
+            culling_tuner_.AddSample(frame.measured_candidate, ms);
+            if (!culling_tuner_.IsTuning()) {
+                culling_tuner_.LogResults("the culling pass");
+                // Cached command buffers were recorded with the candidates
+                draw_list_version_++;
+            }
+        }
+        frame.measured_candidate = UINT32_MAX;
+    }
+
+    BP_CullingUniforms uniforms{};
+    uniforms.view_projection = view_projection_;
+    for (uint32_t i = 0; i < view_frustum_.planes.size(); i++) {
+        uniforms.planes[i] = view_frustum_.planes[i];
+    }
+    uniforms.object_count = object_count;
+    uniforms.viewport_height = static_cast<float>(swapchain_data_.extent.height);
+    uniforms.pixel_error = lod_pixel_error_;
+    memcpy(frame.uniforms_memory.mapped, &uniforms, sizeof(uniforms));
+
+    // Bounds and meshes were written at creation, only the matrices that changed since this buffer was last used are copied
+    uint8_t* worlds = static_cast<uint8_t*>(frame.objects_memory.mapped) + offsetof(BP_GpuObject, world);
+    scene_.WriteObjectWorlds(worlds, sizeof(BP_GpuObject), frame.world_version);
+}
+
+void VulkanGraphics::RecordCullingPass(VkCommandBuffer cmd_buffer) {
+    BP_CullingFrame& frame = culling_frames_[current_frame_];
+
+    // While tuning, the workgroup size candidates take turns and every dispatch is timed
+    bool measure = culling_tuner_.IsTuning();
+    uint32_t candidate = culling_tuner_.NextCandidate();
+    uint32_t workgroup_size = culling_tuner_.GetWorkgroupSize(candidate);
+    uint32_t first_query = current_frame_ * 2;
+    frame.measured_candidate = measure ? candidate : UINT32_MAX;
+    if (measure) {
+        vkCmdResetQueryPool(cmd_buffer, culling_query_pool_, first_query, 2);
+    }
+
+    // Counts are accumulated with atomics, so they start at zero every frame
+    vkCmdFillBuffer(cmd_buffer, frame.draw_counts, 0, VK_WHOLE_SIZE, 0);
+
+    VkMemoryBarrier clear_barrier{};
+    clear_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    clear_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    clear_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clear_barrier, 0, nullptr, 0, nullptr);
+
+    uint32_t object_count = scene_.GetObjectCount();
+    vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, culling_pipelines_[candidate]);
+    vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, culling_pipeline_layout_, 0, 1, &frame.descriptor_set, 0, nullptr);
+    if (measure) {
+        vkCmdWriteTimestamp(cmd_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, culling_query_pool_, first_query);
+    }
+    vkCmdDispatch(cmd_buffer, (object_count + workgroup_size - 1) / workgroup_size, 1, 1);
+    if (measure) {
+        vkCmdWriteTimestamp(cmd_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, culling_query_pool_, first_query + 1);
+    }
+
+    // The draws and counts are read as indirect arguments, the counts also by the host after the frame finished
+    VkMemoryBarrier draw_barrier{};
+    draw_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    draw_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    draw_barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &draw_barrier, 0, nullptr, 0, nullptr);
+}
+
+void VulkanGraphics::UpdateUniformBuffer(uint32_t current_frame) {
+    //UniformBufferObject ubo{};
+    // x = right
+    // y = depth
+    // z = height
+
+    // x = right
+    // y = down
+    // z = forward
+
+    // Quad 1
+    // rotate over z
+    glm::vec3 pos = glm::vec3(2.f, 0.f, -1.f);
+
+    // Look at the center from a distance
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), pos, glm::vec3(0.0f, 0.0f, -1.0f));
+    //90deg fov with swapchain aspect ration and near/far plane
+    float aspect = swapchain_data_.extent.width / (float)swapchain_data_.extent.height;
+    glm::mat4 projection = glm::perspective(glm::radians(45.f), aspect, 0.1f, 100.0f);
+
+    view_projection_ = projection * view;
+    for (uint32_t i = 0; i < scene_.GetObjectCount(); i++) {
+        transforms[i].transform = view_projection_ * scene_.GetObjectWorld(i);
+    }
+    view_frustum_ = backpack::ExtractFrustum(view_projection_);
+
+    // Read by the indirect pipeline, the other pipeline gets the whole transform as push constant
+    UniformBufferObject ubo{};
+    ubo.view = view;
+    ubo.projection = projection;
+    ubo.view_projection = view_projection_;
+    memcpy(uniform_mapped_memory_[current_frame], &ubo, sizeof(ubo));
+
+    //// glm is for opengl with an inverted y coordinate system, so we comensate for that
+    //ubo.projection[1][1] *= -1;
+
+    //memcpy(uniform_mapped_memory_[current_frame], &ubo, sizeof(ubo));
+}
+
+void VulkanGraphics::RecreateSwapchain(const WindowData& window_data, VkPhysicalDevice device) {
+    // Nothing can be presented while minimized, the old swapchain stays until the window has an area again
+    if (window_data.window_width == 0 || window_data.window_height == 0) {
+        minimized_ = true;
+        return;
+    }
+    minimized_ = false;
+
+    // Frames in flight still render into the old images, so everything that belongs to them is released once those frames finished
+    BP_SwapchainInfo old_swapchain = swapchain_data_;
+    if (!CreateSwapchain(window_data, device, old_swapchain.swapchain)) {
+        // The old swapchain is retired anyway, acquiring from it fails and the next frame tries again
+        swapchain_data_ = old_swapchain;
+        return;
+    }
+
+    VkDevice device_handle = vulkan_device_;
+    frame_clock_.ReleaseAfterSubmittedFrames([device_handle, old_swapchain]() {
+        for (VkFramebuffer framebuffer : old_swapchain.framebuffers) {
+            vkDestroyFramebuffer(device_handle, framebuffer, nullptr);
+        }
+        for (VkImageView image_view : old_swapchain.image_views) {
+            vkDestroyImageView(device_handle, image_view, nullptr);
+        }
+        vkDestroySwapchainKHR(device_handle, old_swapchain.swapchain, nullptr);
+    });
+    swapchain_data_.image_views.clear();
+    swapchain_data_.framebuffers.clear();
+    CreateImageViews();
+
+    // The targets only have to be at least as large as the framebuffers, they are replaced when the size step or the format changed
+    VkExtent2D target_extent = GetRenderTargetExtent();
+    if (target_extent.width != render_target_extent_.width || target_extent.height != render_target_extent_.height || swapchain_data_.format != render_target_format_) {
+        VkImage color_image = color_image_, depth_image = depth_image_;
+        VkImageView color_view = color_image_view_, depth_view = depth_image_view_;
+        BP_Allocation color_memory = color_image_memory_, depth_memory = depth_image_memory_;
+        frame_clock_.ReleaseAfterSubmittedFrames([this, color_image, color_view, color_memory, depth_image, depth_view, depth_memory]() mutable {
+            vkDestroyImageView(vulkan_device_, color_view, nullptr);
+            DestroyImage(memory_allocator_, vulkan_device_, color_image, color_memory);
+            vkDestroyImageView(vulkan_device_, depth_view, nullptr);
+            DestroyImage(memory_allocator_, vulkan_device_, depth_image, depth_memory);
+        });
+        CreateColorResources();
+        CreateDepthResources();
+        LOG << "Resized render targets to " << target_extent.width << "x" << target_extent.height;
+    }
+    CreateFramebuffers();
+
+    // Recorded for the old framebuffers and extent, frames in flight may still execute them
+    std::vector<VkCommandBuffer> cached_buffers = std::move(cached_command_buffers_);
+    cached_command_buffers_.clear();
+    cached_versions_.clear();
+    if (!cached_buffers.empty()) {
+        frame_clock_.ReleaseAfterSubmittedFrames([this, cached_buffers]() {
+            vkFreeCommandBuffers(vulkan_device_, command_pool_, static_cast<uint32_t>(cached_buffers.size()), cached_buffers.data());
+        });
+    }
+    CreateCommandCache();
+}
+
+bool VulkanGraphics::IsMinimized() const {
+    return minimized_;
+}
+
+bool VulkanGraphics::IsDeviceLost() const {
+    return device_lost_;
+}
+
+bool VulkanGraphics::IsInitialized() const {
+    return vulkan_device_ != VK_NULL_HANDLE && !models.empty();
+}
+
+VkExtent2D VulkanGraphics::GetRenderTargetExtent() const {
+    auto round_up = [](uint32_t size) {
+        return (size + RENDER_TARGET_SIZE_STEP - 1) / RENDER_TARGET_SIZE_STEP * RENDER_TARGET_SIZE_STEP;
+    };
+    return VkExtent2D{ round_up(swapchain_data_.extent.width), round_up(swapchain_data_.extent.height) };
+}
+
+void VulkanGraphics::CreateComputeResources() {
+    storage_buffer_.resize(frames_in_flight_);
+    storage_memory_.resize(frames_in_flight_);
+
+    // Random number generator
+    size_t seed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
+    std::default_random_engine random_engine(seed);
+    std::uniform_real_distribution<float> random_dist(0.0f, 1.0f);
+
+    // Calculate initial particle positions
     std::vector<BP_Particle> particles(100);
     for (auto& particle : particles) {
         float r = random_dist(random_engine) * 0.25f;
@@ -1624,31 +2783,22 @@ void VulkanGraphics::CreateComputeResources() {
 
     VkDeviceSize size = sizeof(BP_Particle) * particles.size();
 
-    VkBuffer staging_buffer;
-    VkDeviceMemory staging_memory;
-
-    // Create staging buffer
-    CreateBuffer(vulkan_device_, selected_device_, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        staging_buffer, staging_memory, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, nullptr);
-
-    void* data;
-    vkMapMemory(vulkan_device_, staging_memory, 0, size, 0, &data);
-    memcpy_s(data, size, particles.data(), size);
-    vkUnmapMemory(vulkan_device_, staging_memory);
+    // Copy particles into the staging ring, the range is reused once the copies finished
+    BP_StagingRegion staging = upload_manager_.AllocateStaging(BP_UploadQueue::TRANSFER, size);
+    memcpy(staging.mapped, particles.data(), size);
 
     // Create storage buffer and record copy commands
-    VkCommandBuffer cmd_buffer = BeginSingleTimeCommandBuffer(vulkan_device_, command_pool_);
+    VkCommandBuffer cmd_buffer = upload_manager_.GetCommandBuffer(BP_UploadQueue::TRANSFER);
     // Will be used in compute shader as ssbo and in vertex shader as vbo
-    storage_buffer_.resize(MAX_FRAMES_IN_FLIGHT);
-    storage_memory_.resize(MAX_FRAMES_IN_FLIGHT);
-    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        CreateBuffer(vulkan_device_, selected_device_, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-            storage_buffer_[i], storage_memory_[i], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, nullptr);
+    storage_buffer_.resize(frames_in_flight_);
+    storage_memory_.resize(frames_in_flight_);
+    for (uint32_t i = 0; i < frames_in_flight_; i++) {
+        CreateBuffer(memory_allocator_, vulkan_device_, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+            storage_buffer_[i], storage_memory_[i], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, upload_manager_.GetSharingFamilies());
 
         // Copy data
-        CmdCopyBuffer(cmd_buffer, staging_buffer, storage_buffer_[i], size);
+        CmdCopyBuffer(cmd_buffer, staging.buffer, storage_buffer_[i], size, staging.offset);
     }
-    EndSingleTimeCommandBuffer(vulkan_device_, device_queues_.graphics_queue, command_pool_, cmd_buffer);
 
     // Create descriptor set layouts
     std::array<VkDescriptorSetLayoutBinding, 3> desc_set_layouts_bindings;
@@ -1670,7 +2820,7 @@ void VulkanGraphics::CreateComputeResources() {
     desc_set_layouts_bindings[2].pImmutableSamplers = nullptr;
     desc_set_layouts_bindings[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 
-    VkDescriptorSetLayoutCreateInfo layout_info;
+    VkDescriptorSetLayoutCreateInfo layout_info{};
     layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     layout_info.bindingCount = desc_set_layouts_bindings.size();
     layout_info.pBindings = desc_set_layouts_bindings.data();
@@ -1684,11 +2834,11 @@ void VulkanGraphics::CreateComputeResources() {
     // Create descriptor pool
     VkDescriptorPoolSize ubo_pool_size{};
     ubo_pool_size.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    ubo_pool_size.descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    ubo_pool_size.descriptorCount = frames_in_flight_;
 
     VkDescriptorPoolSize ssbo_pool_size{};
     ssbo_pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    ssbo_pool_size.descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT) * 2;
+    ssbo_pool_size.descriptorCount = frames_in_flight_ * 2;
 
     std::array<VkDescriptorPoolSize, 2> pool_sizes = { ubo_pool_size, ssbo_pool_size };
 
@@ -1696,38 +2846,39 @@ void VulkanGraphics::CreateComputeResources() {
     pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     pool_info.poolSizeCount = pool_sizes.size();
     pool_info.pPoolSizes = pool_sizes.data();
-    pool_info.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    pool_info.maxSets = frames_in_flight_;
 
     res = vkCreateDescriptorPool(vulkan_device_, &pool_info, nullptr, &compute_desc_pool_);
     if (res != VK_SUCCESS) {
         LOG << "FAILURE\t Failed creating compute descriptor pool, error:" << res;
     }
 
-    std::array<VkDescriptorSetLayout, static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT)> desc_set_layouts {compute_desc_set_layout_};
+    std::vector<VkDescriptorSetLayout> desc_set_layouts(frames_in_flight_, compute_desc_set_layout_);
     VkDescriptorSetAllocateInfo allocate_info{};
     allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocate_info.descriptorPool = compute_desc_pool_;
-    allocate_info.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    allocate_info.descriptorSetCount = frames_in_flight_;
     allocate_info.pSetLayouts = desc_set_layouts.data();
 
-    vkAllocateDescriptorSets(vulkan_device_, &allocate_info, &compute_descriptor_set_);
+    compute_descriptor_sets_.resize(frames_in_flight_);
+    vkAllocateDescriptorSets(vulkan_device_, &allocate_info, compute_descriptor_sets_.data());
 
-    // Initialize descriptors
-    for (int i = 0; i < static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT); i++) {
+    // Initialize descriptors, every frame reads the particles of the frame before it
+    for (uint32_t i = 0; i < frames_in_flight_; i++) {
         VkDescriptorBufferInfo ubo_info{};
         ubo_info.buffer = uniform_buffers_[i];
         ubo_info.offset = 0;
         ubo_info.range = VK_WHOLE_SIZE;
 
         VkDescriptorBufferInfo ssbo_info_previous{};
-        ubo_info.buffer = storage_buffer_[i - 1 % static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT)];
-        ubo_info.offset = 0;
-        ubo_info.range = VK_WHOLE_SIZE;
+        ssbo_info_previous.buffer = storage_buffer_[(i + frames_in_flight_ - 1) % frames_in_flight_];
+        ssbo_info_previous.offset = 0;
+        ssbo_info_previous.range = VK_WHOLE_SIZE;
 
         VkDescriptorBufferInfo ssbo_info_current{};
-        ubo_info.buffer = storage_buffer_[i];
-        ubo_info.offset = 0;
-        ubo_info.range = VK_WHOLE_SIZE;
+        ssbo_info_current.buffer = storage_buffer_[i];
+        ssbo_info_current.offset = 0;
+        ssbo_info_current.range = VK_WHOLE_SIZE;
 
         std::array<VkWriteDescriptorSet, 3> write_set{};
         write_set[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
@@ -1736,7 +2887,7 @@ void VulkanGraphics::CreateComputeResources() {
         write_set[0].descriptorCount = 1;
         write_set[0].dstBinding = 0;
         write_set[0].dstArrayElement = 0;
-        write_set[0].dstSet = compute_descriptor_set_;
+        write_set[0].dstSet = compute_descriptor_sets_[i];
 
         write_set[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         write_set[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
@@ -1744,7 +2895,7 @@ void VulkanGraphics::CreateComputeResources() {
         write_set[1].descriptorCount = 1;
         write_set[1].dstBinding = 1;
         write_set[1].dstArrayElement = 0;
-        write_set[1].dstSet = compute_descriptor_set_;
+        write_set[1].dstSet = compute_descriptor_sets_[i];
 
         write_set[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         write_set[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
@@ -1752,7 +2903,7 @@ void VulkanGraphics::CreateComputeResources() {
         write_set[2].descriptorCount = 1;
         write_set[2].dstBinding = 2;
         write_set[2].dstArrayElement = 0;
-        write_set[2].dstSet = compute_descriptor_set_;
+        write_set[2].dstSet = compute_descriptor_sets_[i];
 
         vkUpdateDescriptorSets(vulkan_device_, write_set.size(), write_set.data(), 0, nullptr);
     }
@@ -1766,8 +2917,7 @@ void VulkanGraphics::CreateComputeResources() {
     pipeline_layout_info.pSetLayouts = &compute_desc_set_layout_;
     vkCreatePipelineLayout(vulkan_device_, &pipeline_layout_info, nullptr, &compute_pipeline_layout_);
 
-    VulkanShaderLoader shader_loader;
-    VkShaderModule compute_shader = shader_loader.CreateShaderModule(shader_loader.LoadShader("..\\src\\shaders\\particle.spv"), vulkan_device_, nullptr);
+    VkShaderModule compute_shader = shader_loader_.GetShaderModule("../src/shaders/c_particle.spv", vulkan_device_);
     VkPipelineShaderStageCreateInfo compute_pipeline_shader_stage_info{};
     compute_pipeline_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     compute_pipeline_shader_stage_info.stage = VK_SHADER_STAGE_COMPUTE_BIT;
@@ -1775,43 +2925,114 @@ void VulkanGraphics::CreateComputeResources() {
     compute_pipeline_shader_stage_info.pName = "main";
 
     // Creating the compute pipeline
-    VkComputePipelineCreateInfo compute_pipeline_info;
+    VkComputePipelineCreateInfo compute_pipeline_info{};
     compute_pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
     compute_pipeline_info.layout = compute_pipeline_layout_;
     compute_pipeline_info.stage = compute_pipeline_shader_stage_info;
 
-    vkCreateComputePipelines(vulkan_device_, VK_NULL_HANDLE, 1, &compute_pipeline_info, nullptr, &compute_pipeline_);
+    pipeline_cache_.CreateComputePipeline(compute_pipeline_info, compute_pipeline_);
 }
 
 void VulkanGraphics::InitializeScene() {
-    /*
-     * Init scene ubo
-     * Create models
-    */
-
+    // The copies hang below a root at the point the camera looks at, on a square grid that starts there and runs away from the camera
+    uint32_t root = scene_.AddNode(SCENE_NO_PARENT, glm::vec3(2.f, 0.f, -1.f));
+
+    uint32_t object_count = std::max(1u, settings_.instance_count);
+    uint32_t grid_size = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(object_count))));
+    const float spacing = 2.5f;
+    animated_nodes_.resize(object_count);
+    for (uint32_t i = 0; i < object_count; i++) {
+        glm::vec3 offset{ (i / grid_size) * spacing, ((i % grid_size) - (grid_size - 1) * 0.5f) * spacing, 0.0f };
+        animated_nodes_[i] = scene_.AddNode(root, offset);
+        // Every object is a copy of the viking room
+        scene_.AddObject(animated_nodes_[i], 0);
+    }
+
+    transforms.resize(object_count, MeshPushConstants{ 0, 0, 0, 0, glm::mat4{1.0f} });
+    LOG << "Scene has " << scene_.GetObjectCount() << " objects of " << models.size() << " meshes in " << scene_.GetNodeCount() << " nodes";
 }
 
-void VulkanGraphics::InitializeModels() {
-    backpack::ModelLoader loader;
-    backpack::MeshGeometry geometry = loader.LoadModels({ VIKING_ROOM_M });
+bool VulkanGraphics::InitializeModels() {
+    auto start_time = std::chrono::high_resolution_clock::now();
 
+    // The binary cache is mapped and copied straight into staging memory, the OBJ is only parsed when it's missing or stale
+    std::string cache_path = backpack::GetMeshCachePath(VIKING_ROOM_M);
+    backpack::MappedMesh mesh;
     backpack::Model3D model;
-    model = backpack::LoadSingleModel3D(vulkan_device_, selected_device_, command_pool_, device_queues_.graphics_queue, MAX_FRAMES_IN_FLIGHT, geometry.vertices, geometry.indices);
+    uint32_t cache_flags = (optimize_meshes_ ? backpack::MESH_CACHE_FLAG_OPTIMIZED : 0) | (mesh_lod_count_ << backpack::MESH_CACHE_LOD_SHIFT);
+    bool from_cache = backpack::OpenMeshCache(cache_path, VIKING_ROOM_M, mesh, cache_flags);
+    if (from_cache) {
+        glm::vec3 bounds_min{ mesh.header->bounds_min[0], mesh.header->bounds_min[1], mesh.header->bounds_min[2] };
+        glm::vec3 bounds_max{ mesh.header->bounds_max[0], mesh.header->bounds_max[1], mesh.header->bounds_max[2] };
+        model = backpack::LoadSingleModel3D(memory_allocator_, vulkan_device_, upload_manager_, mesh.vertices, mesh.header->vertex_count, mesh.indices, mesh.header->index_count,
+            vertex_layout_, bounds_min, bounds_max);
+        backpack::SetModelLods(model, mesh.lods, mesh.header->lod_count);
+        mesh.file.Close();
+    }
+    else {
+        backpack::MeshGeometry geometry = backpack::LoadObjParallel(VIKING_ROOM_M, thread_pool_);
+        // Neither cached nor uploaded, an empty cache would look valid until the OBJ changes
+        if (geometry.indices.empty()) {
+            LOG << "ERROR\t Couldn't load any triangles from " << VIKING_ROOM_M;
+            return false;
+        }
+        if (optimize_meshes_) {
+            backpack::OptimizeMesh(geometry, VIKING_ROOM_M);
+        }
+        // Simplified after the optimization so all levels index the already reordered vertices
+        if (mesh_lod_count_ > 1) {
+            backpack::GenerateMeshLods(geometry, mesh_lod_count_, VIKING_ROOM_M);
+        }
+        backpack::WriteMeshCache(cache_path, VIKING_ROOM_M, geometry, cache_flags);
+        model = backpack::LoadSingleModel3D(memory_allocator_, vulkan_device_, upload_manager_, geometry.vertices, geometry.indices, vertex_layout_);
+        if (!geometry.lods.empty()) {
+            backpack::SetModelLods(model, geometry.lods.data(), static_cast<uint32_t>(geometry.lods.size()));
+        }
+    }
+
+    VkDeviceSize vertex_count = model.index_offset / backpack::GetVertexStride(model.layout);
+    VkDeviceSize saved_bytes = vertex_count * (sizeof(backpack::Vertex) - backpack::GetVertexStride(model.layout));
+    LOG << "Uploaded " << vertex_count << " " << backpack::GetVertexLayoutName(model.layout) << " vertices at "
+        << backpack::GetVertexStride(model.layout) << " bytes each, " << saved_bytes / 1024 << "KB less vertex memory than full vertices";
+
+    auto end_time = std::chrono::high_resolution_clock::now();
+    LOG << "Loaded " << VIKING_ROOM_M << (from_cache ? " from mesh cache" : " from OBJ") << " in "
+        << std::chrono::duration<double, std::chrono::milliseconds::period>(end_time - start_time).count() << "ms";
+    model.pipeline_variant = object_variant_;
     models.push_back(model);
-    //models.push_back(model);
-    transforms.push_back(MeshPushConstants{ glm::vec4{0.0f}, glm::mat4{1.0f} });
-    transforms.push_back(MeshPushConstants{ glm::vec4{0.0f}, glm::mat4{1.0f} });
+    return true;
 }
 
 void VulkanGraphics::UpdateScene() {
-    /*
-     * Update scene objects every frame
-     * Update scene ubo every frame
-     */
+    static auto start_time = std::chrono::high_resolution_clock::now();
+
+    auto current_time = std::chrono::high_resolution_clock::now();
+    float time = std::chrono::duration<float, std::chrono::seconds::period>(current_time - start_time).count();
+
+    // Every copy spins around its z axis, the root and the grid stay where they are
+    for (uint32_t i = 0; i < animated_nodes_.size(); i++) {
+        scene_.SetRotation(animated_nodes_[i], glm::angleAxis(time * glm::radians(45.f) + i, glm::vec3(0.0f, 0.0f, 1.0f)));
+    }
+    scene_.UpdateWorldTransforms();
+}
+
+VulkanGraphics::VulkanGraphics(BP_Window* window, const BP_RenderSettings& settings) :
+    app_window_(window), settings_(settings), cache_command_buffers_(settings.cache_command_buffers),
+    frames_in_flight_(std::clamp(settings.frames_in_flight, 1u, MAX_FRAMES_IN_FLIGHT)), present_policy_(settings.present_policy),
+    vertex_layout_(settings.vertex_layout) {
+    InitializeRenderer();
+}
+
+VulkanGraphics::VulkanGraphics(uint32_t width, uint32_t height, const BP_RenderSettings& settings) :
+    app_window_(nullptr), headless_(true), settings_(settings), cache_command_buffers_(settings.cache_command_buffers),
+    frames_in_flight_(std::clamp(settings.frames_in_flight, 1u, MAX_FRAMES_IN_FLIGHT)), present_policy_(settings.present_policy),
+    vertex_layout_(settings.vertex_layout) {
+    win_width_ = width;
+    win_height_ = height;
+    InitializeRenderer();
 }
 
-VulkanGraphics::VulkanGraphics(BP_Window* window) :
-    app_window_(window) {
+void VulkanGraphics::InitializeRenderer() {
     // Check if requested validation layers exist
     bool validation_layer_support = CheckValidationLayerSupport();
     if (validation_layer_support) {
@@ -1829,36 +3050,65 @@ VulkanGraphics::VulkanGraphics(BP_Window* window) :
     }
 #endif // _DEBUG
 
+    LOG << frames_in_flight_ << " frames in flight, present policy " << GetPresentPolicyName(present_policy_);
+
     // Initialize vulkan
+    SetRequiredDeviceExtensions();
     Initialize();
     EnableVulkanDebugMessages();
 
-    WindowData window_data = app_window_->GetWindowData();
-
     LOG;
-    CreateVulkanSurface(window_data);
-    SelectPhysicalDevice();
-    CreateLogicalDevice();
-    CreateSwapchain(window_data, selected_device_);
+    if (headless_) {
+        LOG << "Running headless, rendering into offscreen targets";
+        if (!SelectPhysicalDevice()) {
+            return;
+        }
+        CreateLogicalDevice();
+        memory_allocator_.Initialize(vulkan_device_, selected_device_);
+        CreateOffscreenTargets(win_width_, win_height_);
+    }
+    else {
+        WindowData window_data = app_window_->GetWindowData();
+        CreateVulkanSurface(window_data);
+        if (!SelectPhysicalDevice()) {
+            return;
+        }
+        CreateLogicalDevice();
+        memory_allocator_.Initialize(vulkan_device_, selected_device_);
+        CreateSwapchain(window_data, selected_device_);
+    }
     CreateImageViews();
     CreateRenderPass();
-    CreateDescriptorSetLayout();
+    CreateBindlessDescriptors();
+    SelectVertexLayout();
+    pipeline_cache_.Initialize(vulkan_device_, selected_device_, settings_.pipeline_cache_path);
     CreateGraphicsPipeline();
     CreateColorResources();
     CreateDepthResources();
     CreateFramebuffers();
     CreateCommandPool();
+    upload_manager_.Initialize(vulkan_device_, &memory_allocator_, device_queues_.graphics_queue, graphics_family_index_, device_queues_.transfer_queue, transfer_family_index_);
 
     auto image = CreateTextureImage();
     //CreateTextureImageViews();
     CreateTextureSampler(image);
 
-    InitializeModels();
+    // Without the model the rest is still created so it can be destroyed as usual, IsInitialized reports the failure
+    if (!InitializeModels()) {
+        LOG << "FAILURE\t Couldn't initialize the models";
+    }
+    InitializeScene();
+
+    // Texture and models are uploaded while the rest of the renderer is created
+    upload_manager_.SubmitAll();
 
     CreateUniformBuffers();
-    CreateDescriptorPools();
-    CreateDescriptorSets();
+    CreateInstanceBuffers();
+    CreateCullingResources();
+    WriteBindlessDescriptors();
     CreateCommandBuffer();
+    CreateRecordingSlots();
+    CreateCommandCache();
     CreateSyncObjects();
 
     //CreateComputeResources();
@@ -1,17 +1,163 @@
 #pragma once
+#ifdef WIN32
 #define VK_USE_PLATFORM_WIN32_KHR
+#endif // WIN32
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_structs.hpp>
 
+#ifdef WIN32
 #include <Windows.h>
+#endif // WIN32
 #include <glm/fwd.hpp>
 
+#include <array>
+#include <chrono>
+
 #include "bp_window.h"
 
 #include "vk_helper_functions.h"
 #include "geometry-helpers.h"
+#include "vk_upload_manager.h"
+#include "vk_frame_clock.h"
+#include "vk_bindless.h"
+#include "vk_pipeline_cache.h"
+#include "vk_pipeline_registry.h"
+#include "vk_specialization.h"
+#include "thread_pool.h"
+#include "frustum_culling.h"
+#include "scene_objects.h"
+#include "render_queue.h"
+
+// Upper bound of BP_RenderSettings::frames_in_flight
+const uint32_t MAX_FRAMES_IN_FLIGHT = 4;
+// Built from cull.comp, watched like the graphics shaders when watch_shaders is set
+const char* const CULLING_SHADER = "../src/shaders/c_cull.spv";
+// Default of local_size_x in cull.comp, used until the tuning measured a faster size for the device
+const uint32_t CULLING_WORKGROUP_SIZE = 64;
+// Dispatches measured per workgroup size candidate before the fastest is picked
+const uint32_t WORKGROUP_TUNING_SAMPLES = 16;
+
+// Specialization constant ids, see triangle.frag and the local_size_x_id of cull.comp
+const uint32_t FRAGMENT_CONSTANT_TEXTURE_MIX = 0;
+const uint32_t FRAGMENT_CONSTANT_USE_TEXTURE = 1;
+const uint32_t COMPUTE_CONSTANT_WORKGROUP_SIZE = 0;
+
+// Color and depth targets are allocated in steps of this many pixels, resizes that stay within the step reuse them
+const uint32_t RENDER_TARGET_SIZE_STEP = 128;
+
+// How often the shader files are checked for changes when BP_RenderSettings::watch_shaders is set
+const uint32_t SHADER_CHECK_INTERVAL_MS = 500;
+
+// Draws a recording task takes at least, smaller draw lists are recorded on fewer threads
+const uint32_t MIN_DRAWS_PER_RECORDING_TASK = 64;
+
+// How the swapchain presents, each falls back to FIFO when the surface lacks its mode
+enum class BP_PresentPolicy : uint32_t {
+    // FIFO, every frame is shown and the CPU is throttled to the refresh rate
+    VSYNC = 0,
+    // MAILBOX, a newer frame replaces the queued one so input is shown as soon as possible without tearing
+    LOW_LATENCY = 1,
+    // FIFO_RELAXED, late frames are presented immediately instead of waiting a whole refresh
+    THROUGHPUT = 2,
+    // FIFO with a CPU limiter that starts frames at a fixed rate, for even frame times below the refresh rate
+    PACED = 3,
+    COUNT
+};
+
+// Running mean and variance of a measurement (Welford)
+struct BP_RunningStatistics {
+    uint64_t count = 0;
+    double mean = 0.0;
+    double m2 = 0.0;
+    double max = 0.0;
+
+    void Add(double value);
+    double GetVariance() const;
+};
+
+// Measured while a present policy is active, in milliseconds
+struct BP_FrameTimingStatistics {
+    /*
+    * CPU side, from sampling the input of a frame until vkQueuePresentKHR returned. This is not the latency to the display,
+    * the time the image then waits in the present queue and for scanout is not visible
+    */
+    BP_RunningStatistics input_to_present_queued;
+    // Time between the presents of consecutive frames
+    BP_RunningStatistics frame_time;
+};
+
+const char* GetPresentPolicyName(BP_PresentPolicy policy);
+
+// How the draws of a frame are recorded, picked every frame from the pipeline variants that finished compiling
+enum class BP_DrawPath : uint32_t {
+    // Culled on the GPU, one indirect count draw per mesh
+    GPU_CULLED = 0,
+    // Culled on the CPU, one instanced draw per model and level
+    INSTANCED = 1,
+    // Culled on the CPU, one draw per object. Always available, its pipeline is compiled before the first frame
+    PER_OBJECT = 2
+};
+
+const char* GetDrawPathName(BP_DrawPath path);
+
+// Options the renderer is created with
+struct BP_RenderSettings {
+    // Frames the CPU may record ahead of the GPU, 1 to MAX_FRAMES_IN_FLIGHT. More hide stalls, fewer reduce latency
+    uint32_t frames_in_flight = 2;
+    BP_PresentPolicy present_policy = BP_PresentPolicy::LOW_LATENCY;
+    // Frames per second of the PACED policy
+    uint32_t frame_rate_limit = 60;
+    // Compiled pipelines are stored here between runs, empty keeps them in memory only
+    std::string pipeline_cache_path = PIPELINE_CACHE_PATH;
+    // Copies of the viking room in the scene, drawn as instances of one mesh
+    uint32_t instance_count = 1;
+    // Reuse recorded command buffers until the draw list or the swapchain changes
+    bool cache_command_buffers = false;
+    // Rebuild the pipelines of shaders that changed on disk while running
+    bool watch_shaders = false;
+    // Baked into the fragment shader: weight of the vertex color against the texture, and whether the texture is read at all
+    float texture_mix = 0.5f;
+    bool textured = true;
+    // Measure the culling dispatch with every workgroup size the device allows during the first frames and keep the fastest
+    bool tune_workgroup_size = true;
+    // Format the models are uploaded in, compact falls back to full when the device can't read it
+    backpack::VertexLayout vertex_layout = backpack::VertexLayout::COMPACT;
+};
 
-const unsigned short MAX_FRAMES_IN_FLIGHT = 2;
+// Visible objects of one model and level of detail, drawn with a single instanced call
+struct BP_InstanceBatch {
+    uint32_t model;
+    uint32_t lod;
+    uint32_t first_instance;
+    uint32_t instance_count;
+};
+
+// Secondary command buffer of one recording thread with its own pool, one per thread and frame in flight
+struct BP_RecordingSlot {
+    VkCommandPool command_pool = VK_NULL_HANDLE;
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+};
+
+// Buffers the culling pass of one frame in flight reads and writes
+struct BP_CullingFrame {
+    VkBuffer uniforms = VK_NULL_HANDLE;
+    BP_Allocation uniforms_memory;
+    VkBuffer objects = VK_NULL_HANDLE;
+    BP_Allocation objects_memory;
+    VkBuffer draw_commands = VK_NULL_HANDLE;
+    BP_Allocation draw_commands_memory;
+    // Host visible, so the counts of the last use can be read back once its frame finished
+    VkBuffer draw_counts = VK_NULL_HANDLE;
+    BP_Allocation draw_counts_memory;
+    VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+    // Slot of the object buffer in the bindless set, read by the indirect vertex shader
+    uint32_t objects_index = INVALID_BINDLESS_INDEX;
+    bool submitted = false;
+    // Scene version of the world matrices in the object buffer
+    uint64_t world_version = 0;
+    // Workgroup size candidate whose dispatch time the last use measured, UINT32_MAX when it wasn't measured
+    uint32_t measured_candidate = UINT32_MAX;
+};
 
 static VKAPI_ATTR VkBool32 VKAPI_CALL DebugCallback(
     VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
@@ -45,51 +191,170 @@ static void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMesse
 }
 
 class VulkanGraphics {
-    BP_Window* app_window_;
+    // Null when rendering headless into offscreen targets
+    BP_Window* app_window_ = nullptr;
+    bool headless_ = false;
+    // Set when a frame submit failed, nothing is rendered after that
+    bool device_lost_ = false;
+    BP_RenderSettings settings_;
+    // Disabled when only the per object path is available, per object frames are recorded every frame either way
+    bool cache_command_buffers_ = false;
+    // Size of every per-frame resource vector
+    uint32_t frames_in_flight_ = 2;
+    BP_PresentPolicy present_policy_ = BP_PresentPolicy::LOW_LATENCY;
     VkInstance instance_;
     VkDebugUtilsMessengerEXT debug_messenger_;
-    VkSurfaceKHR vulkan_surface_;
+    VkSurfaceKHR vulkan_surface_ = VK_NULL_HANDLE;
     VkPhysicalDevice selected_device_ = VK_NULL_HANDLE;
     VkSampleCountFlagBits device_sample_count;
-    VkDevice vulkan_device_;
+    // Stays VK_NULL_HANDLE when no device was suitable, nothing but the instance is created then
+    VkDevice vulkan_device_ = VK_NULL_HANDLE;
     bool enable_validation_layers_ = false;
     DeviceQueues device_queues_;
+    uint32_t graphics_family_index_ = 0;
+    uint32_t transfer_family_index_ = 0;
+
+    // Sub-allocates all device resources from a few large blocks
+    GPUMemoryAllocator memory_allocator_;
+
+    // Streams geometry and textures through the transfer queue without stalling frames
+    UploadManager upload_manager_;
+
+    // Workers for asset loading
+    ThreadPool thread_pool_;
+    // Reorder meshes for the vertex cache, overdraw and vertex fetch before they are cached and uploaded
+    bool optimize_meshes_ = true;
+    // Vertex format of settings_, falls back to full vertices when the device can't read the compact formats
+    backpack::VertexLayout vertex_layout_ = backpack::VertexLayout::COMPACT;
+    // Levels of detail generated per mesh, and how many pixels of simplification error are tolerated on screen
+    uint32_t mesh_lod_count_ = 4;
+    float lod_pixel_error_ = 1.0f;
 
     VkRenderPass render_pass_;
     VkPipelineLayout pipeline_layout_;
-    VkDescriptorSetLayout descriptor_set_layout_;
-    VkPipeline pipeline_;
+    // The only descriptor set of the graphics pipelines, bound once per command buffer
+    BindlessDescriptors bindless_;
+    // Per object pipeline, compiled before the first frame and the fallback of every variant still compiling
+    VkPipeline pipeline_ = VK_NULL_HANDLE;
+    // Every pipeline is created through it, persisted between runs
+    PipelineCache pipeline_cache_;
+    // Shader modules of all pipelines by content, watched for changes when settings_.watch_shaders is set
+    VulkanShaderLoader shader_loader_;
+    std::chrono::steady_clock::time_point next_shader_check_;
+    // Compiles pipeline variants on thread_pool_ and owns their pipelines, pipeline_ included
+    PipelineRegistry pipeline_registry_;
+    BP_PipelineVariant object_variant_ = INVALID_PIPELINE_VARIANT;
+    // Path of the current frame, switches to the GPU or instanced path once its variant is ready
+    BP_DrawPath draw_path_ = BP_DrawPath::PER_OBJECT;
 
     // Validation layers used in this application
     const std::vector<const char*> validation_layers_ = { "VK_LAYER_KHRONOS_validation"/*, "VK_LAYER_LUNARG_api_dump"*/ };
-    // Required device extensions
-    const std::vector<const char*> required_device_extensions_ = { VK_KHR_SWAPCHAIN_EXTENSION_NAME, VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME, "VK_KHR_external_memory_win32", VK_KHR_EXTERNAL_SEMAPHORE_EXTENSION_NAME, "VK_KHR_external_semaphore_win32", VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME };
+    // Required device extensions, the swapchain and win32 extensions are added in SetRequiredDeviceExtensions
+    std::vector<const char*> required_device_extensions_ = { VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME, VK_KHR_EXTERNAL_SEMAPHORE_EXTENSION_NAME, VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME };
 
+    // In headless mode the images are offscreen render targets instead of swapchain images
     BP_SwapchainInfo swapchain_data_;
+    std::vector<BP_Allocation> offscreen_memory_;
+    uint32_t last_rendered_image_ = 0;
+    uint64_t rendered_frame_count_ = 0;
+
+    // Frame timing of every present policy, kept separately so policies switched at runtime can be compared
+    std::array<BP_FrameTimingStatistics, static_cast<size_t>(BP_PresentPolicy::COUNT)> frame_timing_;
+    // When the input of the current frame was sampled, and the deadline of the PACED limiter
+    std::chrono::steady_clock::time_point frame_input_time_;
+    bool frame_input_marked_ = false;
+    std::chrono::steady_clock::time_point next_frame_start_;
+    std::chrono::steady_clock::time_point last_present_time_;
+    bool presented_before_ = false;
+
+    // Host visible buffer the last rendered frame is copied into
+    VkBuffer readback_buffer_ = VK_NULL_HANDLE;
+    BP_Allocation readback_memory_;
+    VkDeviceSize readback_size_ = 0;
     VkCommandPool command_pool_;
 
     // Scene objects
     std::vector<backpack::Model3D> models;
     std::vector<MeshPushConstants> transforms;
+    // Transform hierarchy and the objects drawn with it, objects sharing a model are instances of it
+    Scene scene_;
+    // Nodes UpdateScene spins every frame
+    std::vector<uint32_t> animated_nodes_;
+    // View of the current frame, written by UpdateUniformBuffer
+    glm::mat4 view_projection_{ 1.0f };
+    backpack::Frustum view_frustum_;
+    // Objects outside the frustum are not recorded
+    backpack::CullingSet culling_set_;
+    std::vector<uint8_t> object_visible_;
+    backpack::CullingStatistics culling_statistics_;
+
+    // Instanced drawing, the visible objects are grouped by model and level and their transforms written to a per-frame vertex buffer
+    BP_PipelineVariant instanced_variant_ = INVALID_PIPELINE_VARIANT;
+    std::vector<VkBuffer> instance_buffers_;
+    std::vector<BP_Allocation> instance_memory_;
+    std::vector<BP_InstanceBatch> instance_batches_;
+    // Batch of every visible object, reused between frames
+    std::vector<uint32_t> object_batches_;
+
+    // GPU driven culling, a compute pass culls the objects and writes their indirect draws. Needs drawIndirectCount and firstInstance support
+    bool gpu_culling_ = true;
+    VkDescriptorSetLayout culling_desc_set_layout_ = VK_NULL_HANDLE;
+    VkDescriptorPool culling_desc_pool_ = VK_NULL_HANDLE;
+    VkPipelineLayout culling_pipeline_layout_ = VK_NULL_HANDLE;
+    // One pipeline per workgroup size candidate of culling_tuner_, they differ in the specialized local_size_x
+    std::vector<VkPipeline> culling_pipelines_;
+    WorkgroupSizeTuner culling_tuner_;
+    // Two timestamps per frame in flight around the culling dispatch, only written while tuning
+    VkQueryPool culling_query_pool_ = VK_NULL_HANDLE;
+    double timestamp_period_ns_ = 1.0;
+    uint64_t timestamp_mask_ = UINT64_MAX;
+    // Draws the indirect commands, reads the object transforms from the object buffer
+    BP_PipelineVariant indirect_variant_ = INVALID_PIPELINE_VARIANT;
+    std::vector<BP_CullingFrame> culling_frames_;
+    // Levels and draw ranges of all models, CPU copy of the mesh buffer
+    std::vector<BP_GpuMesh> gpu_meshes_;
+    VkBuffer mesh_buffer_ = VK_NULL_HANDLE;
+    BP_Allocation mesh_memory_;
     VkBuffer object_transforms_ubo;
     //VkDeviceMemory scene_memory; // scene_data + object_transforms
 
     // Per in-flight frames
     uint32_t current_frame_ = 0;
     std::vector<VkCommandBuffer> command_buffers_;
+    // Draws are recorded in parallel into these and executed by command_buffers_, indexed by frame and then slot
+    std::vector<std::vector<BP_RecordingSlot>> recording_slots_;
+    // Upload state of every model, taken once per frame before the recording threads start
+    std::vector<uint8_t> model_ready_;
+    bool texture_ready_ = false;
+    // Draws of the current frame, sorted by state so recording skips the binds that wouldn't change anything
+    RenderQueue render_queue_;
+    BP_RenderQueueStatistics render_queue_statistics_;
+    // Incremented whenever the recorded commands would differ, starts at 1 so unrecorded buffers never match
+    uint64_t draw_list_version_ = 1;
+    // One primary buffer per frame in flight and swapchain image, indexed frame * image count + image, with the version it was recorded at
+    std::vector<VkCommandBuffer> cached_command_buffers_;
+    std::vector<uint64_t> cached_versions_;
+    struct {
+        uint64_t recorded = 0;
+        uint64_t reused = 0;
+    } command_cache_statistics_;
     std::vector<VkSemaphore> sem_image_available_;
     std::vector<VkSemaphore> sem_render_finished_;
-    std::vector<VkFence> fence_in_flight_;
+    // Signaled by every frame submission, slot_frames_ holds the frame each frame in flight slot was last submitted as
+    FrameClock frame_clock_;
+    std::vector<uint64_t> slot_frames_;
     std::vector<VkBuffer> uniform_buffers_;
-    std::vector<VkDeviceMemory> uniform_memory_;
+    std::vector<BP_Allocation> uniform_memory_;
     std::vector<void*> uniform_mapped_memory_;
+    // Slots of the uniform buffers in the bindless set, one per frame in flight
+    std::vector<uint32_t> uniform_indices_;
 
     // Compute
     std::vector<VkBuffer> storage_buffer_;
-    std::vector<VkDeviceMemory> storage_memory_;
+    std::vector<BP_Allocation> storage_memory_;
     VkDescriptorPool compute_desc_pool_;
     VkDescriptorSetLayout compute_desc_set_layout_;
-    VkDescriptorSet compute_descriptor_set_;
+    std::vector<VkDescriptorSet> compute_descriptor_sets_;
     VkPipelineLayout compute_pipeline_layout_;
     VkPipeline compute_pipeline_;
 
@@ -98,21 +363,26 @@ class VulkanGraphics {
 
     bool resize_necessary_ = false;
     uint32_t win_width_ = 600, win_height_ = 600;
-
-    VkDescriptorPool descriptor_pool_;
-    std::vector<VkDescriptorSet> descriptor_sets_;
+    // Nothing is rendered while the window has no area, the swapchain is recreated once it has one again
+    bool minimized_ = false;
+    // Size and format the color and depth targets were allocated with, at least the swapchain extent
+    VkExtent2D render_target_extent_{ 0, 0 };
+    VkFormat render_target_format_ = VK_FORMAT_UNDEFINED;
 
     VkImage texture_image_;
-    VkDeviceMemory texture_image_memory_;
+    BP_Allocation texture_image_memory_;
     VkImageView texture_image_view_;
     VkSampler texture_sampler_;
+    uint32_t texture_index_ = INVALID_BINDLESS_INDEX;
+    // Mipmaps are generated on the graphics queue after the copy on the transfer queue
+    BP_UploadTicket texture_upload_ticket_;
 
     VkImage depth_image_;
-    VkDeviceMemory depth_image_memory_;
+    BP_Allocation depth_image_memory_;
     VkImageView depth_image_view_;
 
     VkImage color_image_;
-    VkDeviceMemory color_image_memory_;
+    BP_Allocation color_image_memory_;
     VkImageView color_image_view_;
 
 private:
@@ -121,12 +391,19 @@ private:
     void PopulateDebugMessengerCreateInfoStruct(VkDebugUtilsMessengerCreateInfoEXT& createInfo);
 
     /*
-    * Select physical device based on whether it's a dedicated GPU or not
+    * Select physical device based on whether it's a dedicated GPU or not, false when no device is suitable
     */
-    void SelectPhysicalDevice();
+    bool SelectPhysicalDevice();
 
     void CreateLogicalDevice();
 
+    void SetRequiredDeviceExtensions();
+
+    /*
+    * Creates all Vulkan objects, the surface and swapchain are replaced by offscreen targets when headless
+    */
+    void InitializeRenderer();
+
 
 public:
     void ResizeBuffer(uint32_t width, uint32_t height);
@@ -175,6 +452,7 @@ public:
 
     VkSurfaceFormatKHR GetPreferredSwapchainSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& supported_formats);
 
+    // Mode of the active present policy, FIFO when the surface doesn't support it
     VkPresentModeKHR GetPreferredSwapchainPresentMode(const std::vector<VkPresentModeKHR>& present_modes);
 
     VkExtent2D GetPreferredSwapchainExtend(const WindowData& window_data, const VkSurfaceCapabilitiesKHR& capabilities);
@@ -184,16 +462,63 @@ public:
 
     VkFormat FindDepthFormat();
 
-    bool CreateSwapchain(const WindowData& window_data, VkPhysicalDevice device);
+    // old_swapchain is retired by the new one, its presentable images stay valid for the frames in flight
+    bool CreateSwapchain(const WindowData& window_data, VkPhysicalDevice device, VkSwapchainKHR old_swapchain = VK_NULL_HANDLE);
+
+    // Headless replacement for CreateSwapchain, creates one color target per frame in flight
+    bool CreateOffscreenTargets(uint32_t width, uint32_t height);
 
     bool CreateImageViews();
 
     void CreateRenderPass();
 
-    void CreateDescriptorSetLayout();
+    // Creates the bindless set every draw takes its textures and buffers from
+    void CreateBindlessDescriptors();
 
+    // Picks the vertex layout before the pipeline is built for it
+    void SelectVertexLayout();
+
+    // Creates the pipeline layout and requests the pipeline variants, only waits for the per object pipeline
     void CreateGraphicsPipeline();
 
+    // Description of the variants of the renderer, they differ in the vertex shader and the instance binding
+    BP_PipelineDescription GetPipelineDescription(const std::string& vertex_shader, bool instanced) const;
+
+    // Rebuilds the pipelines of changed shaders and swaps in finished rebuilds, which invalidates the recorded command buffers
+    void UpdatePipelines();
+
+    // Picks draw_path_ for the frame from the ready variants, a change invalidates the recorded command buffers
+    void SelectDrawPath();
+
+    // Tests the world space bounds of all models against the view frustum, fills object_visible_
+    void CullObjects();
+
+    void LogCullingStatistics();
+
+    // One host visible instance buffer per frame in flight, large enough for every object
+    void CreateInstanceBuffers();
+
+    // Groups the visible objects into instance_batches_ and writes their transforms to the instance buffer of the current frame
+    void BuildInstanceBatches();
+
+    // Buffers, descriptors and the compute pipelines of the GPU culling pass, created once the models are loaded.
+    // There is a pipeline per workgroup size candidate, the first frames measure them and keep the fastest
+    void CreateCullingResources();
+    // Culling shader specialized to the workgroup size, VK_NULL_HANDLE when the driver refused it
+    VkPipeline CreateCullingPipeline(VkShaderModule shader, uint32_t workgroup_size);
+    // Recreates every workgroup size candidate after the culling shader changed on disk and tunes them again.
+    // The replaced pipelines are destroyed once the frames submitted so far finished. Returns how many were rebuilt
+    uint32_t RebuildCullingPipelines();
+    // Query pool for the dispatch times, false when the graphics queue can't write timestamps
+    bool CreateCullingTimestamps(const VkPhysicalDeviceProperties& device_properties);
+    void DestroyCullingResources();
+
+    // Writes the object and uniform buffers of the current frame and reads back the draw counts and dispatch time of its last use
+    void WriteCullingInputs();
+
+    // Clears the draw counts and dispatches the culling pass, must be recorded outside of a render pass
+    void RecordCullingPass(VkCommandBuffer cmd_buffer);
+
     void CreateCommandPool();
 
     void CreateDepthResources();
@@ -212,20 +537,77 @@ public:
 
     void CreateCommandBuffer();
 
-    void CreateDescriptorPools();
-
-    void CreateDescriptorSets();
+    // Adds the texture, the uniform buffers and the object buffers of the culling pass to the bindless set
+    void WriteBindlessDescriptors();
 
     void RecordCommandBuffer(const VkCommandBuffer& cmd_buffer, uint32_t img_index);
 
+    // Takes the upload state of the models, returns false when nothing can be drawn yet
+    bool PrepareDrawList();
+
+    // Fills and sorts render_queue_ with the draws of the active path, returns how many there are
+    uint32_t BuildRenderQueue();
+
+    void CreateRecordingSlots();
+    void DestroyRecordingSlots();
+
+    // Records the command buffer of the current frame, or returns the cached one when nothing changed since it was recorded
+    VkCommandBuffer GetFrameCommandBuffer(uint32_t image_index);
+
+    void CreateCommandCache();
+    void DestroyCommandCache();
+
+    // Semaphores for acquire and present and the frame clock, they live as long as the device and survive swapchain recreation
     void CreateSyncObjects();
+    void DestroySyncObjects();
 
     void RenderFrame();
 
+    // Renders into the offscreen target of the current frame, no acquire or present
+    void RenderOffscreenFrame();
+
+    /*
+    * Copies the last rendered image to host memory as tightly packed RGBA8 pixels.
+    * Only supported in headless mode, waits for the frame to finish on the GPU.
+    */
+    bool ReadbackFrame(std::vector<uint8_t>& pixels, uint32_t& width, uint32_t& height);
+
+    bool IsHeadless() const;
+    // Blocks until every submitted upload finished, so the next frame draws the whole scene
+    void WaitForUploads();
+    uint64_t GetRenderedFrameCount() const;
+    // Frame N completed once the clock reached N, GetSubmittedFrame is the newest frame
+    FrameClock& GetFrameClock();
+
+    /*
+    * Call before the input of a frame is sampled. The PACED policy sleeps here until the next frame may start,
+    * so the input is as recent as possible when the frame is recorded. Input to present queued is measured from here.
+    */
+    void WaitForNextFrame();
+    // Takes effect with the next frame, the swapchain is recreated with the new mode
+    void SetPresentPolicy(BP_PresentPolicy policy);
+    BP_PresentPolicy GetPresentPolicy() const;
+    const BP_FrameTimingStatistics& GetFrameTimingStatistics(BP_PresentPolicy policy) const;
+    void LogFrameTimingStatistics();
+    // Ends the input to present queued measurement of the current frame once vkQueuePresentKHR returned
+    void RecordFrameTiming();
+
     void UpdateUniformBuffer(uint32_t current_frame);
 
 
+    /*
+    * Creates the new swapchain from the old one without waiting for the device. The old swapchain, its views and framebuffers
+    * are released once the frames in flight finished. Color and depth targets are kept when the size step didn't change.
+    */
     void RecreateSwapchain(const WindowData& window_data, VkPhysicalDevice device);
+    // The window has no area, the application should wait for events instead of rendering
+    bool IsMinimized() const;
+    // False when no device could run the renderer or the model didn't load, nothing may be rendered then
+    bool IsInitialized() const;
+    // A frame submit failed, the application should stop rendering
+    bool IsDeviceLost() const;
+    // Swapchain extent rounded up to RENDER_TARGET_SIZE_STEP
+    VkExtent2D GetRenderTargetExtent() const;
 
 
 
@@ -237,10 +619,15 @@ public:
     //---------------------
 
 
+    // Builds the transform hierarchy and its objects, needs the models to be loaded
     void InitializeScene();
-    void InitializeModels();
+    // False when the model couldn't be loaded, nothing is cached or uploaded then
+    bool InitializeModels();
+    // Animates the scene and updates the world matrices of the nodes that changed
     void UpdateScene();
 
-    VulkanGraphics(BP_Window* window);
+    VulkanGraphics(BP_Window* window, const BP_RenderSettings& settings = {});
+    // Headless renderer without window or surface
+    VulkanGraphics(uint32_t width, uint32_t height, const BP_RenderSettings& settings = {});
     ~VulkanGraphics();
 };
@@ -1,4 +1,30 @@
 #include "vulkan_shader.h"
+#include "mapped_file.h"
+
+#include <cstring>
+
+namespace {
+	uint64_t HashFNV1a(const uint8_t* bytes, size_t size)
+	{
+		uint64_t hash = 0xCBF29CE484222325ull;
+		for (size_t i = 0; i < size; i++) {
+			hash ^= bytes[i];
+			hash *= 0x100000001B3ull;
+		}
+		return hash;
+	}
+
+	// Catches files that are empty, cut off or still being written
+	bool IsSpirv(const uint8_t* code, size_t size)
+	{
+		uint32_t magic = 0;
+		if (size < sizeof(magic) || size % sizeof(uint32_t) != 0) {
+			return false;
+		}
+		memcpy(&magic, code, sizeof(magic));
+		return magic == SPIRV_MAGIC;
+	}
+}
 
 VulkanShaderLoader::VulkanShaderLoader()
 {
@@ -6,43 +32,164 @@ VulkanShaderLoader::VulkanShaderLoader()
 
 std::vector<char> VulkanShaderLoader::LoadShader(std::string path)
 {
-	std::ifstream read_stream(path, std::ios::ate | std::ios::binary);
-	if (!read_stream.is_open()) {
+	MappedFile file;
+	if (!file.Open(path)) {
 		LOG << "Couldn't open shader file: " << path;
 		return std::vector<char>();
 	}
 
-	uint64_t buffer_size = (uint64_t)read_stream.tellg();
-	read_stream.seekg(0);
-	std::vector<char> bytes(buffer_size);
-	read_stream.read(bytes.data(), buffer_size);
+	const char* data = reinterpret_cast<const char*>(file.Data());
+	return std::vector<char>(data, data + file.Size());
+}
 
-	return bytes;
+VkShaderModule VulkanShaderLoader::CreateShaderModule(const std::vector<char>& bytes, VkDevice& device, const VkAllocationCallbacks* pAllocator)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	const uint8_t* code = reinterpret_cast<const uint8_t*>(bytes.data());
+	return GetModuleForCode(HashFNV1a(code, bytes.size()), code, bytes.size(), device, pAllocator);
 }
 
-VkShaderModule VulkanShaderLoader::CreateShaderModule(std::vector<char>& bytes, VkDevice& device, const VkAllocationCallbacks* pAllocator)
+VkShaderModule VulkanShaderLoader::GetModuleForCode(uint64_t hash, const uint8_t* code, size_t size, VkDevice device, const VkAllocationCallbacks* pAllocator)
 {
+	auto found = modules_.find(hash);
+	if (found != modules_.end()) {
+		hits_++;
+		return found->second;
+	}
+
+	// Mapped files start on a page, vectors on the allocator alignment, both are aligned for pCode
 	VkShaderModuleCreateInfo create_info{};
 	create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	create_info.codeSize = bytes.size();
-	create_info.pCode = reinterpret_cast<uint32_t*>(bytes.data());
+	create_info.codeSize = size;
+	create_info.pCode = reinterpret_cast<const uint32_t*>(code);
 
-	VkShaderModule module;
+	VkShaderModule module = VK_NULL_HANDLE;
 	if (vkCreateShaderModule(device, &create_info, pAllocator, &module) == VK_SUCCESS) {
-		shader_modules.push_back(module);
+		modules_.emplace(hash, module);
+		created_++;
 
 		LOG << "SUCCESS Created shader";
 	}
 	else {
+		module = VK_NULL_HANDLE;
 		LOG << "FAILURE Couldn't create shader";
 	}
 
 	return module;
 }
 
+bool VulkanShaderLoader::LoadShaderFile(const std::string& path, VkDevice device, ShaderFile& file)
+{
+	// Taken before mapping, a write that lands in between changes the time again and is picked up next time
+	std::error_code error;
+	std::filesystem::file_time_type write_time = std::filesystem::last_write_time(path, error);
+	MappedFile mapped;
+	if (error || !mapped.Open(path) || !IsSpirv(mapped.Data(), mapped.Size())) {
+		return false;
+	}
+
+	uint64_t hash = HashFNV1a(mapped.Data(), mapped.Size());
+	VkShaderModule module = GetModuleForCode(hash, mapped.Data(), mapped.Size(), device, nullptr);
+	if (module == VK_NULL_HANDLE) {
+		return false;
+	}
+
+	file.write_time = write_time;
+	file.hash = hash;
+	file.module = module;
+	return true;
+}
+
+VkShaderModule VulkanShaderLoader::GetShaderModule(const std::string& path, VkDevice device)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto found = files_.find(path);
+	if (found != files_.end()) {
+		hits_++;
+		return found->second.module;
+	}
+
+	ShaderFile file{};
+	if (!LoadShaderFile(path, device, file)) {
+		LOG << "Couldn't load shader file: " << path;
+		return VK_NULL_HANDLE;
+	}
+
+	files_.emplace(path, file);
+	return file.module;
+}
+
+void VulkanShaderLoader::RetireUnusedModule(uint64_t hash)
+{
+	for (const auto& [path, file] : files_) {
+		if (file.hash == hash) {
+			return;
+		}
+	}
+
+	auto found = modules_.find(hash);
+	if (found == modules_.end()) {
+		return;
+	}
+	retired_.push_back(found->second);
+	modules_.erase(found);
+	retired_count_++;
+}
+
+std::vector<std::string> VulkanShaderLoader::CheckForChanges(VkDevice device)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::vector<std::string> changed;
+	for (auto& [path, file] : files_) {
+		std::error_code error;
+		std::filesystem::file_time_type write_time = std::filesystem::last_write_time(path, error);
+		if (error || write_time == file.write_time) {
+			continue;
+		}
+
+		ShaderFile reloaded{};
+		if (!LoadShaderFile(path, device, reloaded)) {
+			continue;
+		}
+
+		// Saved without changing the code, nothing has to be rebuilt
+		uint64_t old_hash = file.hash;
+		file = reloaded;
+		if (reloaded.hash != old_hash) {
+			RetireUnusedModule(old_hash);
+			reloads_++;
+			changed.push_back(path);
+			LOG << "Shader " << path << " changed on disk";
+		}
+	}
+	return changed;
+}
+
+std::vector<VkShaderModule> VulkanShaderLoader::TakeRetiredModules()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::vector<VkShaderModule> retired;
+	retired.swap(retired_);
+	return retired;
+}
+
 void VulkanShaderLoader::DestroyCreatedShaderModules(VkDevice& device, const VkAllocationCallbacks* pAllocator)
 {
-	for (VkShaderModule& module : shader_modules) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (auto& [hash, module] : modules_) {
 		vkDestroyShaderModule(device, module, pAllocator);
 	}
+	for (VkShaderModule module : retired_) {
+		vkDestroyShaderModule(device, module, pAllocator);
+	}
+	modules_.clear();
+	files_.clear();
+	retired_.clear();
+}
+
+void VulkanShaderLoader::LogStatistics()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	LOG << "Shader modules: " << created_ << " created for " << files_.size() << " files, " << hits_ << " lookups served from the cache, "
+		<< reloads_ << " reloads that retired " << retired_count_ << " modules";
 }
@@ -1,20 +1,65 @@
 #pragma once
 #include <string>
 #include <vector>
-#include <fstream>
+#include <filesystem>
+#include <mutex>
+#include <unordered_map>
 #include <vulkan/vulkan.hpp>
 
 #include "logger.h"
 
+// First word of every SPIR-V module
+const uint32_t SPIRV_MAGIC = 0x07230203;
 
+/*
+* Shader modules keyed by a hash of their SPIR-V, identical code shares one module whichever file it came from.
+* Files are memory mapped once and remembered with their write time, CheckForChanges reloads the ones edited on disk.
+* A module no file uses after a reload is retired instead of destroyed, a worker may still be compiling a pipeline with it.
+* The caller takes the retired modules and destroys them once no compilation runs.
+* All functions are safe to call from several threads.
+*/
 class VulkanShaderLoader {
-	VkShaderModuleCreateInfo create_info;
-	std::vector<VkShaderModule> shader_modules;
+	struct ShaderFile {
+		std::filesystem::file_time_type write_time;
+		uint64_t hash;
+		VkShaderModule module;
+	};
+
+	std::mutex mutex_;
+	std::unordered_map<uint64_t, VkShaderModule> modules_;
+	std::unordered_map<std::string, ShaderFile> files_;
+	// Replaced by CheckForChanges and not taken by TakeRetiredModules yet
+	std::vector<VkShaderModule> retired_;
+
+	// Lookups answered from the cache, modules created and files reloaded after a change
+	uint32_t hits_ = 0;
+	uint32_t created_ = 0;
+	uint32_t reloads_ = 0;
+	uint32_t retired_count_ = 0;
+
+private:
+	// Returns the module of the code with the hash, creating it on first use. Expects mutex_ to be held
+	VkShaderModule GetModuleForCode(uint64_t hash, const uint8_t* code, size_t size, VkDevice device, const VkAllocationCallbacks* pAllocator);
+	// Maps the file and fills in its module, hash and write time. Expects mutex_ to be held
+	bool LoadShaderFile(const std::string& path, VkDevice device, ShaderFile& file);
+	// Moves the module of the hash to retired_ when no file has that code any more. Expects mutex_ to be held
+	void RetireUnusedModule(uint64_t hash);
 
 public:
 	std::vector<char> LoadShader(std::string path);
-	VkShaderModule CreateShaderModule(std::vector<char>& bytes, VkDevice& device, const VkAllocationCallbacks* pAllocator);
+	VkShaderModule CreateShaderModule(const std::vector<char>& bytes, VkDevice& device, const VkAllocationCallbacks* pAllocator);
+
+	// Module of the file, which is only mapped and hashed the first time. VK_NULL_HANDLE when it's missing or no SPIR-V
+	VkShaderModule GetShaderModule(const std::string& path, VkDevice device);
+
+	// Reloads the files whose write time changed and returns the ones whose code differs now.
+	// A file that is still being written fails the SPIR-V check and is tried again on the next call
+	std::vector<std::string> CheckForChanges(VkDevice device);
+	// Hands over the modules CheckForChanges replaced, pipelines compiled before may still be reading them
+	std::vector<VkShaderModule> TakeRetiredModules();
+
 	void DestroyCreatedShaderModules(VkDevice& device, const VkAllocationCallbacks* pAllocator);
+	void LogStatistics();
 
 	VulkanShaderLoader();
 };